@@ -42,18 +42,18 @@ bool BBox::intersection(const Ray &ray) const {
 	}
 
 	Vector3 bbox[2] = {min, max};
-	static const double t0 = 0.0;
-	static const double t1 = 1.0;
+	static const scalar_t t0 = 0.0;
+	static const scalar_t t1 = 1.0;
 
 	int xsign = (int)(ray.dir.x < 0.0);
-	double invdirx = 1.0 / ray.dir.x;
-	double tmin = (bbox[xsign].x - ray.origin.x) * invdirx;
-	double tmax = (bbox[1 - xsign].x - ray.origin.x) * invdirx;
+	scalar_t invdirx = 1.0 / ray.dir.x;
+	scalar_t tmin = (bbox[xsign].x - ray.origin.x) * invdirx;
+	scalar_t tmax = (bbox[1 - xsign].x - ray.origin.x) * invdirx;
 
 	int ysign = (int)(ray.dir.y < 0.0);
-	double invdiry = 1.0 / ray.dir.y;
-	double tymin = (bbox[ysign].y - ray.origin.y) * invdiry;
-	double tymax = (bbox[1 - ysign].y - ray.origin.y) * invdiry;
+	scalar_t invdiry = 1.0 / ray.dir.y;
+	scalar_t tymin = (bbox[ysign].y - ray.origin.y) * invdiry;
+	scalar_t tymax = (bbox[1 - ysign].y - ray.origin.y) * invdiry;
 
 	if((tmin > tymax) || (tymin > tmax)) {
 		return false;
@@ -63,9 +63,9 @@ bool BBox::intersection(const Ray &ray) const {
 	if(tymax < tmax) tmax = tymax;
 
 	int zsign = (int)(ray.dir.z < 0.0);
-	double invdirz = 1.0 / ray.dir.z;
-	double tzmin = (bbox[zsign].z - ray.origin.z) * invdirz;
-	double tzmax = (bbox[1 - zsign].z - ray.origin.z) * invdirz;
+	scalar_t invdirz = 1.0 / ray.dir.z;
+	scalar_t tzmin = (bbox[zsign].z - ray.origin.z) * invdirz;
+	scalar_t tzmax = (bbox[1 - zsign].z - ray.origin.z) * invdirz;
 
 	if((tmin > tzmax) || (tzmin > tmax)) {
 		return false;
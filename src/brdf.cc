@@ -20,19 +20,45 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
 #include <math.h>
-#include <stdlib.h>
+#include <algorithm>
 #include "brdf.h"
-#include "config.h"
-#include "matrix.h"
 
+/* x^e, by squaring for the integer exponents materials usually have, which
+ * is a lot cheaper than pow.
+ */
+static inline double spec_pow(double x, double e) {
+	int n = (int)e;
+	if (n != e || n < 0 || n > 1024) {
+		return pow(x, e);
+	}
 
-double phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp) {
-	Vector3 refindir = reflect(indir, n);
-	double s = dot(refindir, outdir);
-	if (s < 0.0) {
-		return 0.0;
+	double res = 1.0;
+	while (n) {
+		if (n & 1) {
+			res *= x;
+		}
+		x *= x;
+		n >>= 1;
 	}
-	return pow(s, specexp);
+	return res;
+}
+
+/* cos and sin of 2pi * u, which compilers can merge into one sincos */
+static inline void unit_circle(double u, double *c, double *s) {
+	double phi = 2.0 * M_PI * u;
+	*c = cos(phi);
+	*s = sin(phi);
+}
+
+/* Duff et al., "Building an Orthonormal Basis, Revisited", JCGT 2017 */
+void make_basis(const Vector3 &z, Basis *basis) {
+	double sign = z.z >= 0.0 ? 1.0 : -1.0;
+	double a = -1.0 / (sign + z.z);
+	double b = z.x * z.y * a;
+
+	basis->x = Vector3(1.0 + sign * z.x * z.x * a, sign * b, -sign * z.x);
+	basis->y = Vector3(b, sign + z.y * z.y * a, -z.y);
+	basis->z = z;
 }
 
 double lambert(const Vector3 &indir, const Vector3 &n) {
@@ -43,71 +69,62 @@ double lambert(const Vector3 &indir, const Vector3 &n) {
 	return d;
 }
 
-Vector3 sample_lambert(const Vector3 &n) {
-	double rndx, rndy, rndz;
-	double magnitude;
-	do {
-		rndx = 2.0 * (double) rand() / RAND_MAX - 1.0;
-		rndy = 2.0 * (double) rand() / RAND_MAX - 1.0;
-		rndz = 2.0 * (double) rand() / RAND_MAX - 1.0;
-		magnitude = sqrt(rndx * rndx + rndy * rndy + rndz * rndz);
-	} while (magnitude > 1.0); 
-
-	Vector3 rnd_dir(rndx / magnitude, rndy / magnitude, rndz / magnitude);
-	
-	if (dot(rnd_dir, n) < 0) {
-		return -rnd_dir;
-	}
-	
-	return rnd_dir;
+double lambert_pdf(const Vector3 &dir, const Vector3 &n) {
+	return lambert(dir, n) / M_PI;
 }
 
-Vector3 sample_phong(const Vector3 &outdir, const Vector3 &n, double specexp) {
-	Matrix4x4 mat;
-	Vector3 ldir = normalize(outdir);
-
-	Vector3 ref = reflect(ldir, n);
-
-	double ndotl = dot(ldir, n);
+/* cosine weighted direction around n: a uniform point of the unit disk,
+ * projected up on the hemisphere (Malley's method).
+ */
+Vector3 sample_lambert(const Vector3 &n, double u, double v, double *pdf) {
+	double r = sqrt(u);
+	double c, s;
+	unit_circle(v, &c, &s);
+	double z = sqrt(std::max(0.0, 1.0 - u));
 
-	if(1.0 - ndotl > EPSILON) {
-		Vector3 ivec, kvec, jvec;
+	Basis basis;
+	make_basis(n, &basis);
 
-		// build orthonormal basis
-		if(fabs(ndotl) < EPSILON) {
-			kvec = -normalize(ldir);
-			jvec = n;
-			ivec = cross(jvec, kvec);
-		} else {
-			ivec = normalize(cross(ldir, ref));
-			jvec = ref;
-			kvec = cross(ref, ivec);
-		}
-
-		mat.matrix[0][0] = ivec.x;
-		mat.matrix[1][0] = ivec.y;
-		mat.matrix[2][0] = ivec.z;
+	*pdf = z / M_PI;
+	return basis.x * (r * c) + basis.y * (r * s) + basis.z * z;
+}
 
-		mat.matrix[0][1] = jvec.x;
-		mat.matrix[1][1] = jvec.y;
-		mat.matrix[2][1] = jvec.z;
+void make_phong_lobe(const Vector3 &outdir, const Vector3 &n, double specexp, PhongLobe *lobe) {
+	make_basis(reflect(outdir, n), &lobe->basis);
+	lobe->specexp = specexp;
+	lobe->inv_exp = 1.0 / (specexp + 1.0);
+	lobe->norm = (specexp + 1.0) / (2.0 * M_PI);
+}
 
-		mat.matrix[0][2] = kvec.x;
-		mat.matrix[1][2] = kvec.y;
-		mat.matrix[2][2] = kvec.z;
+double phong(const PhongLobe &lobe, const Vector3 &dir) {
+	double s = dot(lobe.basis.z, dir);
+	if (s <= 0.0) {
+		return 0.0;
 	}
+	return spec_pow(s, lobe.specexp);
+}
 
-	double rnd1 = (double)rand() / RAND_MAX;
-	double rnd2 = (double)rand() / RAND_MAX;
-
-	double phi = acos(pow(rnd1, 1.0 / (specexp + 1)));
-	double theta = 2.0 * M_PI * rnd2;
+double phong_pdf(const PhongLobe &lobe, const Vector3 &dir) {
+	return lobe.norm * phong(lobe, dir);
+}
 
-	Vector3 v;
-	v.x = cos(theta) * sin(phi);
-	v.y = cos(phi);
-	v.z = sin(theta) * sin(phi);
-	v.transform(mat);
+/* the cosine of the angle to the mirror direction is u^(1 / (specexp + 1)),
+ * and raised to specexp it's u over itself, which gives the pdf for free.
+ */
+Vector3 sample_phong(const PhongLobe &lobe, double u, double v, double *pdf) {
+	double cos_t = pow(u, lobe.inv_exp);
+	double sin_t = sqrt(std::max(0.0, 1.0 - cos_t * cos_t));
+	double c, s;
+	unit_circle(v, &c, &s);
+
+	*pdf = cos_t > 0.0 ? lobe.norm * u / cos_t : 0.0;
+	return lobe.basis.x * (sin_t * c) + lobe.basis.y * (sin_t * s) + lobe.basis.z * cos_t;
+}
 
-	return v;
+double phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp) {
+	double s = dot(reflect(indir, n), outdir);
+	if (s <= 0.0) {
+		return 0.0;
+	}
+	return spec_pow(s, specexp);
 }
@@ -24,9 +24,41 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 
 #include "vector.h"
 
-double phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp);
+/* orthonormal basis with z along a unit vector */
+struct Basis {
+	Vector3 x, y, z;
+};
+
+void make_basis(const Vector3 &z, Basis *basis);
+
+/* the kernels of the two lobes of the brdf: eval, the solid angle pdf of
+ * sampling a direction, and sampling, which maps the uniform numbers u, v
+ * in [0, 1) to a direction and returns its pdf in *pdf. Directions point
+ * away from the surface and n is the shading normal on their side.
+ */
+
+// cosine of the angle to n, clamped to 0
 double lambert(const Vector3 &indir, const Vector3 &n);
-Vector3 sample_phong(const Vector3 &outdir, const Vector3 &n, double specexp);
-Vector3 sample_lambert(const Vector3 &n);
+double lambert_pdf(const Vector3 &dir, const Vector3 &n);
+Vector3 sample_lambert(const Vector3 &n, double u, double v, double *pdf);
+
+/* the phong lobe of a shading point, for the direction outdir it's seen
+ * from: cos^specexp of the angle to the mirror direction of outdir. The
+ * basis around the mirror direction is built once for all the kernels.
+ */
+struct PhongLobe {
+	Basis basis;
+	double specexp;
+	double inv_exp;		// 1 / (specexp + 1)
+	double norm;		// (specexp + 1) / 2pi, which makes the pdf
+};
+
+void make_phong_lobe(const Vector3 &outdir, const Vector3 &n, double specexp, PhongLobe *lobe);
+double phong(const PhongLobe &lobe, const Vector3 &dir);
+double phong_pdf(const PhongLobe &lobe, const Vector3 &dir);
+Vector3 sample_phong(const PhongLobe &lobe, double u, double v, double *pdf);
+
+// the phong lobe of outdir at a single direction indir
+double phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp);
 
 #endif
@@ -22,67 +22,110 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include <math.h>
 #include "camera.h"
 #include "config.h"
-
-extern int width, height;
+#include "sampler.h"
 
 Camera::Camera() {
 	this->position = Vector3(0,0,0);
 	this->target = Vector3(0,0,1);
 	fov = M_PI/4;
+	update_basis();
 }
 
 Camera::Camera(const Vector3 &position, const Vector3 &target) {
 	this->position = position;
 	this->target = target;
 	fov = M_PI/4;
+	update_basis();
 }
 
 void Camera::set_position(const Vector3 &position) {
 	this->position = position;
+	update_basis();
 }
 
 void Camera::set_target(const Vector3 &target) {
 	this->target = target;
+	update_basis();
 }
 
 void Camera::set_fov(double fov) {
 	this->fov = fov;
+	update_basis();
 }
 
-Ray Camera::get_primary_ray(double x, double y) {
-	Ray prim_ray;
-	Vector3 dir;
+const Vector3 &Camera::get_position() const {
+	return position;
+}
 
-	dir.x = x;
-	dir.y = y; 
-	dir.z = 1.0 / tan(fov / 2.0);
+double Camera::get_fov() const {
+	return fov;
+}
 
-	Vector3 up(0,1,0); 
+void Camera::update_basis() {
+	Vector3 world_up(0,1,0);
 	Vector3 d = normalize(target-position);
 
-	Vector3 i,j,k;
-	
-	i = cross(up, d);
-	j = cross(d, i);
-	k = d;
-
-	Matrix4x4 m;
+	Vector3 i = cross(world_up, d);
+	Vector3 j = cross(d, i);
 
-	m.matrix[0][0] = i.x; 
-	m.matrix[1][0] = i.y;
-	m.matrix[2][0] = i.z;
-
-	m.matrix[0][1] = j.x;
-	m.matrix[1][1] = j.y;
-	m.matrix[2][1] = j.z;
-
-	m.matrix[0][2] = k.x;
-	m.matrix[1][2] = k.y;
-	m.matrix[2][2] = k.z;
+	/* the image plane is at 1 / tan(fov / 2) along the view direction, and
+	 * the ray magnitude is folded in as well.
+	 */
+	right = i * RAY_MAG;
+	up = j * RAY_MAG;
+	view = d * (RAY_MAG / tan(fov / 2.0));
+}
 
+Ray Camera::get_primary_ray(double x, double y) const {
+	Ray prim_ray;
 	prim_ray.origin = position;
-	dir.transform(m);
-	prim_ray.dir = dir * RAY_MAG;
+	prim_ray.dir = right * x + up * y + view;
 	return prim_ray;
 }
 
+void Camera::get_tile_rays(int img_width, int img_height, int x0, int y0, int tile_width,
+		int tile_height, int first, int spp, Sampler *smp, RayBatch *batch) const {
+	int count = tile_width * tile_height * spp;
+
+	batch->origin = position;
+	batch->count = count;
+	batch->dir_x.resize(count);
+	batch->dir_y.resize(count);
+	batch->dir_z.resize(count);
+	batch->pos_x.resize(count);
+	batch->pos_y.resize(count);
+
+	scalar_t *dx = &batch->dir_x[0];
+	scalar_t *dy = &batch->dir_y[0];
+	scalar_t *dz = &batch->dir_z[0];
+	float *pos_x = &batch->pos_x[0];
+	float *pos_y = &batch->pos_y[0];
+
+	// size of a pixel on the image plane
+	double pxl_w = 2.0 / (double)img_width;
+	double pxl_h = 2.0 / (double)img_height;
+
+	for(int y=y0; y<y0 + tile_height; y++) {
+		double py = 1.0 - (double)y * pxl_h;
+
+		for(int x=x0; x<x0 + tile_width; x++) {
+			double px = (double)x * pxl_w - 1.0;
+
+			for(int i=0; i<spp; i++) {
+				double u, v;
+				smp->start_sample(x, y, first + i, 0);
+				smp->next_2d(&u, &v);
+
+				*pos_x++ = x + u;
+				*pos_y++ = y + v;
+
+				double ix = px + u * pxl_w;
+				double iy = py - v * pxl_h;
+
+				*dx++ = right.x * ix + up.x * iy + view.x;
+				*dy++ = right.y * ix + up.y * iy + view.y;
+				*dz++ = right.z * ix + up.z * iy + view.z;
+			}
+		}
+	}
+}
@@ -22,22 +22,56 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef CAMERA_H_
 #define CAMERA_H_
 
-#include "matrix.h"
+#include <vector>
 #include "ray.h"
 #include "vector.h"
 
+class Sampler;
+
+/* the primary rays of an image tile, in structure of arrays form. All rays
+ * start at origin, ray i has direction (dir_x[i], dir_y[i], dir_z[i]) of
+ * magnitude about RAY_MAG, like get_primary_ray, and passes through
+ * (pos_x[i], pos_y[i]) of the image, in pixels. The rays of each pixel are
+ * consecutive, and the pixels are in scanline order.
+ */
+struct RayBatch {
+	Vector3 origin;
+	int count;
+	std::vector<scalar_t> dir_x, dir_y, dir_z;
+	std::vector<float> pos_x, pos_y;
+};
+
 class Camera{
 private:
 	Vector3 position;
 	Vector3 target;
 	double fov;
+
+	/* view basis, updated whenever the camera changes. Scaled so that the
+	 * point (x, y) of the image plane ([-1, 1] on both axes) is in the
+	 * direction x * right + y * up + view.
+	 */
+	Vector3 right, up, view;
+	void update_basis();
+
 public:
 	Camera();
 	Camera(const Vector3 &position, const Vector3 &target);
 	void set_position(const Vector3 &position);
 	void set_target(const Vector3 &target);
 	void set_fov(double fov);
-	Ray get_primary_ray(double x, double y);
+	const Vector3 &get_position() const;
+	double get_fov() const;
+	Ray get_primary_ray(double x, double y) const;
+
+	/* fills batch with the primary rays of the tile_width x tile_height
+	 * tile at pixel (x0, y0) of an img_width x img_height image, for the
+	 * spp samples of each pixel from sample first. The position of the ray
+	 * of sample i of a pixel within it is the first two dimensions of the
+	 * sample.
+	 */
+	void get_tile_rays(int img_width, int img_height, int x0, int y0, int tile_width,
+			int tile_height, int first, int spp, Sampler *smp, RayBatch *batch) const;
 };
 
 #endif
@@ -24,8 +24,80 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 
 #define EPSILON		1e-6
 #define RAY_MAG		10000.0
-#define MAX_DEPTH	5
+
+/* default maximum number of bounces of a path (-maxdepth), and the number of
+ * bounces before russian roulette may end it
+ */
+#define MAX_DEPTH	16
+#define RR_MIN_DEPTH	1
+
+/* number of lights sampled at each shaded point */
+#define LIGHT_SAMPLES	1
+
+/* shadow rays towards area lights are shortened by this factor, so that they
+ * don't hit the light surface they aim for
+ */
+#define SHADOW_RAY_SCALE	0.9999
 
 #define USE_BBOX
 
+/* maximum number of faces per chunk of out-of-core meshes */
+#define GEOM_CHUNK_FACES	65536
+
+/* least number of faces of the coarsest mesh level of detail */
+#define LOD_MIN_FACES	256
+
+/* path guiding: the share of the bounces sampled from the learned
+ * distributions, the samples of a region before it's split in the first
+ * training pass (growing with the square root of the pass samples), the
+ * share of the light of a region that makes a direction quadrant subdivide,
+ * the depth of the direction quadtrees, the default memory cap in MB and the
+ * number of vertices of each path that are learned from.
+ */
+#define GUIDE_FRACTION		0.5
+#define GUIDE_SPATIAL_THRES	12000
+#define GUIDE_DIR_THRES		0.01
+#define GUIDE_DIR_MAX_DEPTH	20
+#define GUIDE_MAX_MEM		64
+#define GUIDE_PATH_VERTICES	32
+
+/* photon map: the number of photons an irradiance estimate is made of, the
+ * bounces of a photon and the largest lookup radius, as a share of the
+ * diagonal of the scene.
+ */
+#define PHOTON_LOOKUP		64
+#define PHOTON_MAX_BOUNCES	16
+#define PHOTON_MAX_DIST		0.1
+
+/* denoiser: the a-trous passes and how far apart, relative to the light at a
+ * pixel, the colors of the first pass can be before they stop being
+ * averaged. The normals, albedos and relative depths of the first hits stop
+ * it at the edges of the surfaces. Colors at albedos below DENOISE_MIN_ALBEDO
+ * aren't divided by them.
+ */
+#define DENOISE_ITERATIONS	5
+#define DENOISE_SIGMA_COLOR	3.0
+#define DENOISE_SIGMA_NORMAL	0.3
+#define DENOISE_SIGMA_ALBEDO	0.1
+#define DENOISE_SIGMA_DEPTH	0.05
+#define DENOISE_MIN_ALBEDO	0.01
+
+/* steps of the lookup table of the pixel reconstruction filter */
+#define FILTER_TABLE_SIZE	64
+
+/* largest radius of the reconstruction filter in pixels, wider filters are
+ * cut there
+ */
+#define FILTER_MAX_RADIUS	3.5
+
+/* how often the light samples pick the environment light, when the scene
+ * has other lights too
+ */
+#define ENV_LIGHT_PROB		0.5
+
+/* run geometry and ray traversal in single precision floats, pixel samples
+ * are still accumulated in double precision
+ */
+/* #define SINGLE_PRECISION */
+
 #endif
@@ -0,0 +1,126 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <string.h>
+#include "config.h"
+#include "denoise.h"
+
+// B3 spline, the 5 taps of each pass
+static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+static inline float dist_sq(const float *a, const float *b)
+{
+	float dx = a[0] - b[0];
+	float dy = a[1] - b[1];
+	float dz = a[2] - b[2];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static void filter_pass(const float *src, float *dest, const float *albedo, const float *normal,
+		const float *depth, int width, int height, int step, float sigma_color)
+{
+	float inv_color = 1.0f / (sigma_color * sigma_color);
+	float inv_normal = 1.0f / (DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL);
+	float inv_albedo = 1.0f / (DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int y=0; y<height; y++) {
+		for(int x=0; x<width; x++) {
+			int p = y * width + x;
+			const float *cp = src + p * 3;
+
+			float lum_p = (cp[0] + cp[1] + cp[2]) / 3.0f;
+
+			float sum[3] = {0, 0, 0};
+			float wsum = 0.0f;
+
+			for(int i=0; i<5; i++) {
+				int qy = y + (i - 2) * step;
+				if(qy < 0 || qy >= height) continue;
+
+				for(int j=0; j<5; j++) {
+					int qx = x + (j - 2) * step;
+					if(qx < 0 || qx >= width) continue;
+
+					int q = qy * width + qx;
+					const float *cq = src + q * 3;
+
+					// the color distance is relative to the brighter of the two
+					float lum = (cq[0] + cq[1] + cq[2]) / 3.0f;
+					lum = lum > lum_p ? lum : lum_p;
+					float inv_c = inv_color / (lum * lum + 1e-4f);
+
+					float zp = depth[p], zq = depth[q];
+					float zmax = zp > zq ? zp : zq;
+					float dz = zmax > 0.0f ? fabs(zp - zq) / (zmax * DENOISE_SIGMA_DEPTH) : 0.0f;
+
+					float w = kernel[i] * kernel[j] * expf(-dist_sq(cp, cq) * inv_c -
+							dist_sq(normal + p * 3, normal + q * 3) * inv_normal -
+							dist_sq(albedo + p * 3, albedo + q * 3) * inv_albedo - dz);
+
+					sum[0] += cq[0] * w;
+					sum[1] += cq[1] * w;
+					sum[2] += cq[2] * w;
+					wsum += w;
+				}
+			}
+
+			// p itself always has some weight
+			float *d = dest + p * 3;
+			d[0] = sum[0] / wsum;
+			d[1] = sum[1] / wsum;
+			d[2] = sum[2] / wsum;
+		}
+	}
+}
+
+void denoise(float *color, const float *albedo, const float *normal, const float *depth,
+		int width, int height, int iterations)
+{
+	int num = width * height * 3;
+	float *buf = new float[num * 2];
+	float *src = buf, *dest = buf + num;
+
+	/* textures and material edges are kept by filtering the light that
+	 * reaches the surfaces, over their albedo. Where there's no albedo to
+	 * divide by (emitters and misses) the color is filtered as it is.
+	 */
+	for(int i=0; i<num; i++) {
+		src[i] = albedo[i] > DENOISE_MIN_ALBEDO ? color[i] / albedo[i] : color[i];
+	}
+
+	// the radius doubles and the color edges sharpen with each pass
+	float sigma_color = DENOISE_SIGMA_COLOR;
+	for(int i=0; i<iterations; i++) {
+		filter_pass(src, dest, albedo, normal, depth, width, height, 1 << i, sigma_color);
+		sigma_color *= 0.5f;
+
+		float *tmp = src;
+		src = dest;
+		dest = tmp;
+	}
+
+	for(int i=0; i<num; i++) {
+		color[i] = albedo[i] > DENOISE_MIN_ALBEDO ? src[i] * albedo[i] : src[i];
+	}
+	delete [] buf;
+}
@@ -0,0 +1,36 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef DENOISE_H_
+#define DENOISE_H_
+
+/* edge avoiding a-trous wavelet filter (Dammertz et al., "Edge-Avoiding
+ * A-Trous Wavelet Transform for fast Global Illumination Filtering", HPG
+ * 2010) of the linear rgb image color, in place. albedo and normal are rgb
+ * and xyz buffers of the first hits of the camera rays and depth their
+ * distance from the camera, 0 where nothing was hit. The light is filtered
+ * apart from the albedo, over iterations passes of growing radius that stop
+ * at the edges of the three buffers.
+ */
+void denoise(float *color, const float *albedo, const float *normal, const float *depth,
+		int width, int height, int iterations);
+
+#endif
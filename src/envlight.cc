@@ -0,0 +1,251 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <algorithm>
+#include "config.h"
+#include "envlight.h"
+
+static bool load_pfm(FILE *fp, std::vector<Color> *pixels, int *width, int *height);
+static bool load_ppm(FILE *fp, std::vector<Color> *pixels, int *width, int *height);
+
+EnvLight::EnvLight() {
+	width = height = 0;
+	material.kd = material.ks = Color(0, 0, 0);
+	material.ke = Color(1, 1, 1);
+	material.specexp = 1.0;
+	material.kr = 0.0;
+	material.mclass = MAT_EMISSIVE;
+}
+
+bool EnvLight::load(const char *fname) {
+	FILE *fp;
+	if(!(fp = fopen(fname, "rb"))) {
+		fprintf(stderr, "failed to open environment map: %s\n", fname);
+		return false;
+	}
+
+	char magic[3] = {0, 0, 0};
+	bool res = false;
+	if(fread(magic, 1, 2, fp) == 2) {
+		if(strcmp(magic, "PF") == 0) {
+			res = load_pfm(fp, &pixels, &width, &height);
+		} else if(strcmp(magic, "P6") == 0) {
+			res = load_ppm(fp, &pixels, &width, &height);
+		}
+	}
+	fclose(fp);
+
+	if(!res) {
+		fprintf(stderr, "environment map %s is not a valid PFM or binary PPM image\n", fname);
+		return false;
+	}
+	return true;
+}
+
+/* the sampling function of pixel (x, y): its luminance, times the sine of
+ * its row, which is how much the row shrinks on the sphere.
+ */
+double EnvLight::func(int x, int y) const {
+	const Color &c = pixels[y * width + x];
+	double theta = M_PI * (y + 0.5) / height;
+	return (c.x + c.y + c.z) / 3.0 * sin(theta);
+}
+
+void EnvLight::dir_to_pixel(const Vector3 &dir, int *x, int *y) const {
+	double theta = acos(std::max(-1.0, std::min(1.0, (double)dir.y)));
+	double phi = atan2(dir.z, dir.x);
+	if(phi < 0.0) {
+		phi += 2.0 * M_PI;
+	}
+
+	*x = std::min((int)(phi / (2.0 * M_PI) * width), width - 1);
+	*y = std::min((int)(theta / M_PI * height), height - 1);
+}
+
+Color EnvLight::radiance(const Vector3 &dir) const {
+	int x, y;
+	dir_to_pixel(dir, &x, &y);
+	return pixels[y * width + x] * material.ke;
+}
+
+/* the pdf over the image is constant in each pixel, func over its integral,
+ * and the image covers 2pi^2 sin(theta) of solid angle per unit area.
+ */
+double EnvLight::pdf(const Vector3 &dir) const {
+	double total = row_cdf.empty() ? 0.0 : row_cdf.back();
+	double sin_theta = sqrt(std::max(0.0, 1.0 - (double)dir.y * dir.y));
+	if(total <= 0.0 || sin_theta <= 0.0) {
+		return 0.0;
+	}
+
+	int x, y;
+	dir_to_pixel(dir, &x, &y);
+	return func(x, y) * width * height / total / (2.0 * M_PI * M_PI * sin_theta);
+}
+
+bool EnvLight::intersection(const Ray &ray, IntInfo* i_info) const {
+	return false;
+}
+
+void EnvLight::calc_bbox() {
+	bbox = BBox(Vector3(-RAY_MAG, -RAY_MAG, -RAY_MAG), Vector3(RAY_MAG, RAY_MAG, RAY_MAG));
+}
+
+Vector3 EnvLight::sample() const {
+	return Vector3(0, 0, 0);
+}
+
+bool EnvLight::is_light() const {
+	return true;
+}
+
+void EnvLight::prepare_light_sampling() {
+	row_cdf.resize(height);
+	col_cdf.resize(width * height);
+
+	double total = 0.0;
+	for(int y=0; y<height; y++) {
+		double row = 0.0;
+		for(int x=0; x<width; x++) {
+			row += func(x, y);
+			col_cdf[y * width + x] = row;
+		}
+		total += row;
+		row_cdf[y] = total;
+	}
+}
+
+/* picks the row with u, then the column in it with v, reusing what's left of
+ * each for the position in the pixel.
+ */
+bool EnvLight::sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const {
+	if(row_cdf.empty() || row_cdf.back() <= 0.0) {
+		return false;
+	}
+
+	double target = u * row_cdf.back();
+	int y = std::upper_bound(row_cdf.begin(), row_cdf.end(), target) - row_cdf.begin();
+	y = std::min(y, height - 1);
+	double row_start = y ? row_cdf[y - 1] : 0.0;
+	double fy = (target - row_start) / (row_cdf[y] - row_start);
+
+	const double *row = &col_cdf[y * width];
+	target = v * row[width - 1];
+	int x = std::upper_bound(row, row + width, target) - row;
+	x = std::min(x, width - 1);
+	double col_start = x ? row[x - 1] : 0.0;
+	double fx = (target - col_start) / (row[x] - col_start);
+
+	double theta = M_PI * (y + std::min(fy, 1.0)) / height;
+	double phi = 2.0 * M_PI * (x + std::min(fx, 1.0)) / width;
+	double sin_theta = sin(theta);
+	Vector3 dir(sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+
+	if(sin_theta <= 0.0) {
+		return false;
+	}
+	ls->pos = ref + dir * RAY_MAG;
+	ls->normal = -dir;
+	ls->radiance = pixels[y * width + x] * material.ke;
+	ls->pdf = func(x, y) * width * height / row_cdf.back() / (2.0 * M_PI * M_PI * sin_theta);
+	ls->delta = false;
+	return ls->pdf > 0.0;
+}
+
+double EnvLight::light_power() const {
+	if(row_cdf.empty()) {
+		return 0.0;
+	}
+	double ke = (material.ke.x + material.ke.y + material.ke.z) / 3.0;
+	return ke * row_cdf.back() * 2.0 * M_PI * M_PI / (width * height);
+}
+
+static bool read_header(FILE *fp, int *width, int *height, double *scale) {
+	return fscanf(fp, "%d %d %lf", width, height, scale) == 3 && *width > 0 && *height > 0 &&
+		fgetc(fp) != EOF;
+}
+
+/* PFM: rgb floats, from the bottom row up, little endian if the scale is
+ * negative.
+ */
+static bool load_pfm(FILE *fp, std::vector<Color> *pixels, int *width, int *height) {
+	double scale;
+	if(!read_header(fp, width, height, &scale)) {
+		return false;
+	}
+
+	uint32_t one = 1;
+	bool little_endian = *(unsigned char*)&one == 1;
+	bool swap = (scale < 0.0) != little_endian;
+
+	int w = *width, h = *height;
+	std::vector<float> row(w * 3);
+	pixels->resize(w * h);
+
+	for(int y=h - 1; y>=0; y--) {
+		if(fread(&row[0], sizeof(float), w * 3, fp) != (size_t)(w * 3)) {
+			return false;
+		}
+		for(int i=0; i<w * 3; i++) {
+			if(swap) {
+				unsigned char *b = (unsigned char*)&row[i];
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+			}
+		}
+		for(int x=0; x<w; x++) {
+			(*pixels)[y * w + x] = Color(row[x * 3], row[x * 3 + 1], row[x * 3 + 2]);
+		}
+	}
+	return true;
+}
+
+/* PPM: 8 bit rgb, taken to be sRGB encoded like any 8 bit image, so the
+ * values are decoded to linear radiance.
+ */
+static bool load_ppm(FILE *fp, std::vector<Color> *pixels, int *width, int *height) {
+	double maxval;
+	if(!read_header(fp, width, height, &maxval) || maxval != 255.0) {
+		return false;
+	}
+
+	int num = *width * *height;
+	std::vector<unsigned char> data(num * 3);
+	if(fread(&data[0], 1, num * 3, fp) != (size_t)(num * 3)) {
+		return false;
+	}
+
+	double linear[256];
+	for(int i=0; i<256; i++) {
+		double v = i / 255.0;
+		linear[i] = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+	}
+
+	pixels->resize(num);
+	for(int i=0; i<num; i++) {
+		(*pixels)[i] = Color(linear[data[i * 3]], linear[data[i * 3 + 1]], linear[data[i * 3 + 2]]);
+	}
+	return true;
+}
@@ -0,0 +1,72 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef ENVLIGHT_H_
+#define ENVLIGHT_H_
+
+#include <vector>
+#include "object.h"
+
+/* light arriving from infinitely far away, from every direction, given by a
+ * lat-long image: the top row is straight up (+y) and the columns go around
+ * y from +x towards +z. The radiance is the image times the ke of the
+ * material. Directions are sampled by the luminance of the image, with a
+ * marginal CDF over the rows and a conditional CDF over each row (Pharr et
+ * al., "Physically Based Rendering", 3rd ed., 14.2.4).
+ */
+class EnvLight : public Object {
+private:
+	int width, height;
+	std::vector<Color> pixels;
+	std::vector<double> row_cdf;		// sums of the sampling function up to each row
+	std::vector<double> col_cdf;		// and along each row
+
+	double func(int x, int y) const;
+	void dir_to_pixel(const Vector3 &dir, int *x, int *y) const;
+
+public:
+	EnvLight();
+
+	/* loads the image, from a PFM (float, linear) or a binary PPM file
+	 * (8 bit, sRGB)
+	 */
+	bool load(const char *fname);
+
+	// radiance arriving from the direction dir, and the pdf of sampling it
+	Color radiance(const Vector3 &dir) const;
+	double pdf(const Vector3 &dir) const;
+
+	bool intersection(const Ray &ray, IntInfo* i_info) const;
+	void calc_bbox();
+	Vector3 sample() const;
+	bool is_light() const;
+
+	void prepare_light_sampling();
+	bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+
+	/* power reaching a disk of unit area facing it from any direction, the
+	 * integral of the radiance over the sphere. Scenes gather it over the
+	 * area of their bounds.
+	 */
+	double light_power() const;
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <string.h>
+#include "film.h"
+
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+// the most pixels a sample reaches along each axis
+#define MAX_FOOTPRINT	((int)(2.0 * FILTER_MAX_RADIUS) + 1)
+
+Filter::Filter(double radius)
+{
+	this->radius = radius;
+}
+
+Filter::~Filter()
+{
+}
+
+
+class BoxFilter : public Filter {
+public:
+	BoxFilter() : Filter(0.5) {}
+	double eval(double x) const { return 1.0; }
+};
+
+class TentFilter : public Filter {
+public:
+	TentFilter() : Filter(1.0) {}
+	double eval(double x) const { return 1.0 - fabs(x); }
+};
+
+// standard deviation of half a pixel, down to 0 at 3 of them
+class GaussianFilter : public Filter {
+public:
+	GaussianFilter() : Filter(1.5) {}
+	double eval(double x) const
+	{
+		return exp(-2.0 * x * x) - exp(-2.0 * radius * radius);
+	}
+};
+
+/* Mitchell and Netravali, "Reconstruction Filters in Computer Graphics",
+ * SIGGRAPH 1988. The negative lobes sharpen the image.
+ */
+class MitchellFilter : public Filter {
+public:
+	MitchellFilter() : Filter(2.0) {}
+	double eval(double x) const
+	{
+		const double b = 1.0 / 3.0;
+		const double c = 1.0 / 3.0;
+
+		x = fabs(x);
+		if(x < 1.0) {
+			return ((12.0 - 9.0 * b - 6.0 * c) * x * x * x + (-18.0 + 12.0 * b + 6.0 * c) * x * x +
+				(6.0 - 2.0 * b)) / 6.0;
+		}
+		if(x < 2.0) {
+			return ((-b - 6.0 * c) * x * x * x + (6.0 * b + 30.0 * c) * x * x +
+				(-12.0 * b - 48.0 * c) * x + (8.0 * b + 24.0 * c)) / 6.0;
+		}
+		return 0.0;
+	}
+};
+
+Filter *create_filter(const char *name)
+{
+	if(strcmp(name, "box") == 0) {
+		return new BoxFilter;
+	}
+	if(strcmp(name, "tent") == 0) {
+		return new TentFilter;
+	}
+	if(strcmp(name, "gaussian") == 0) {
+		return new GaussianFilter;
+	}
+	if(strcmp(name, "mitchell") == 0) {
+		return new MitchellFilter;
+	}
+	return 0;
+}
+
+
+Film::Film()
+{
+	width = height = 0;
+	pixels = 0;
+	radius = 0.5f;
+}
+
+Film::~Film()
+{
+	delete [] pixels;
+}
+
+bool Film::create(int width, int height, const Filter *filter)
+{
+	delete [] pixels;
+	if(!(pixels = new float[width * height * 4])) {
+		return false;
+	}
+	this->width = width;
+	this->height = height;
+
+	// the filter is looked up at the centers of FILTER_TABLE_SIZE steps
+	radius = filter->radius < FILTER_MAX_RADIUS ? filter->radius : FILTER_MAX_RADIUS;
+	for(int i=0; i<FILTER_TABLE_SIZE; i++) {
+		table[i] = filter->eval((i + 0.5) * radius / FILTER_TABLE_SIZE);
+	}
+
+	clear();
+	return true;
+}
+
+void Film::clear()
+{
+	memset(pixels, 0, width * height * 4 * sizeof *pixels);
+}
+
+int Film::get_width() const
+{
+	return width;
+}
+
+int Film::get_height() const
+{
+	return height;
+}
+
+float Film::get_radius() const
+{
+	return radius;
+}
+
+void Film::add_sample(double x, double y, const Color &color)
+{
+	// the pixels with centers within the radius of (x, y)
+	int x0 = (int)ceil(x - 0.5 - radius);
+	int x1 = (int)floor(x - 0.5 + radius);
+	int y0 = (int)ceil(y - 0.5 - radius);
+	int y1 = (int)floor(y - 0.5 + radius);
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 >= width) x1 = width - 1;
+	if(y1 >= height) y1 = height - 1;
+
+	float scale = FILTER_TABLE_SIZE / radius;
+	float wx[MAX_FOOTPRINT], wy[MAX_FOOTPRINT];
+	for(int i=x0; i<=x1; i++) {
+		int idx = (int)(fabs(i + 0.5 - x) * scale);
+		wx[i - x0] = idx < FILTER_TABLE_SIZE ? table[idx] : 0.0f;
+	}
+	for(int i=y0; i<=y1; i++) {
+		int idx = (int)(fabs(i + 0.5 - y) * scale);
+		wy[i - y0] = idx < FILTER_TABLE_SIZE ? table[idx] : 0.0f;
+	}
+
+	float r = color.x, g = color.y, b = color.z;
+
+	/* threads add their samples to the same pixels at the borders of what
+	 * they render, so the sums are updated atomically.
+	 */
+	for(int i=y0; i<=y1; i++) {
+		for(int j=x0; j<=x1; j++) {
+			float w = wx[j - x0] * wy[i - y0];
+			if(w == 0.0f) continue;
+
+			float *pix = pixels + (i * width + j) * 4;
+			#pragma omp atomic
+			pix[0] += r * w;
+			#pragma omp atomic
+			pix[1] += g * w;
+			#pragma omp atomic
+			pix[2] += b * w;
+			#pragma omp atomic
+			pix[3] += w;
+		}
+	}
+}
+
+Color Film::get_pixel(int x, int y) const
+{
+	const float *pix = pixels + (y * width + x) * 4;
+	if(pix[3] <= 0.0f) {
+		return Color(0, 0, 0);
+	}
+
+	// the negative lobes of some filters can take the sums below 0
+	float inv_w = 1.0f / pix[3];
+	return Color(MAX(pix[0] * inv_w, 0.0f), MAX(pix[1] * inv_w, 0.0f), MAX(pix[2] * inv_w, 0.0f));
+}
@@ -0,0 +1,80 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef FILM_H_
+#define FILM_H_
+
+#include "color.h"
+#include "config.h"
+
+/* pixel reconstruction filter. Filters are separable, the weight of a
+ * sample (dx, dy) pixels away from the center of a pixel is
+ * eval(dx) * eval(dy), 0 past radius.
+ */
+class Filter {
+public:
+	double radius;
+
+	Filter(double radius);
+	virtual ~Filter();
+
+	virtual double eval(double x) const = 0;
+};
+
+/* creates the filter named: "box" (each sample counts for its own pixel
+ * only), "tent", "gaussian" or "mitchell" (Mitchell-Netravali, B = C = 1/3).
+ * Returns 0 for unknown names.
+ */
+Filter *create_filter(const char *name);
+
+/* the image being rendered, as the filtered sums of the colors of its
+ * samples and of their weights, in linear rgb. Samples are spread over
+ * every pixel within the radius of the filter, and they can be added at any
+ * time and from any thread, so more samples can be added to a finished
+ * image to refine it.
+ */
+class Film {
+private:
+	int width, height;
+	float *pixels;		// r, g, b and weight sums of each pixel
+	float radius;
+	float table[FILTER_TABLE_SIZE];		// the filter over [0, radius)
+
+public:
+	Film();
+	~Film();
+
+	bool create(int width, int height, const Filter *filter);
+	void clear();
+
+	int get_width() const;
+	int get_height() const;
+	/* the radius of the filter in pixels, as far as a sample reaches */
+	float get_radius() const;
+
+	/* adds a sample at (x, y) of the image, in pixels */
+	void add_sample(double x, double y, const Color &color);
+
+	/* the filtered color of pixel (x, y), 0 where there are no samples yet */
+	Color get_pixel(int x, int y) const;
+};
+
+#endif
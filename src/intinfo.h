@@ -28,8 +28,9 @@ class Object;
 
 struct IntInfo {
 	Vector3 normal;
+	Vector3 geom_normal;	// true surface normal, for offsetting secondary rays
 	Vector3 i_point;
-	double t;
+	scalar_t t;
 	const Object* object;
 };
 
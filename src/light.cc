@@ -23,10 +23,12 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 
 PointLight::PointLight() {
 	position = Vector3(0, 0, 0);
+	falloff = false;
 }
 
 PointLight::PointLight(const Vector3 &pos, const Color &color) {
 	this->position = pos;
+	falloff = false;
 }
 
 bool PointLight::intersection(const Ray &ray, IntInfo* i_info) const {
@@ -34,11 +36,6 @@ bool PointLight::intersection(const Ray &ray, IntInfo* i_info) const {
 }
 
 void PointLight::calc_bbox() {
-#ifdef USE_BBOX
-	if(!bbox.intersection(ray)) {
-		return false;
-	}
-#endif
 	bbox.max = bbox.min = position;
 }
 
@@ -46,6 +43,20 @@ Vector3 PointLight::sample() const {
 	return position;
 }
 
+bool PointLight::sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const {
+	ls->pos = position;
+	ls->normal = Vector3(0, 0, 0);
+	ls->radiance = material.ke;
+	ls->pdf = 0.0;
+	ls->delta = true;
+	ls->falloff = falloff;
+	return true;
+}
+
 bool PointLight::is_light() const {
 	return true;
 }
+
+double PointLight::light_power() const {
+	return (material.ke.x + material.ke.y + material.ke.z) / 3.0 * 4.0 * M_PI;
+}
@@ -29,12 +29,19 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 class PointLight: public Object {
 public:
 	Vector3 position;
+	/* ke is a radiant intensity falling off with the squared distance, and
+	 * is shaded with the normalized brdfs like the area lights. Otherwise
+	 * ke scales the plain phong terms directly, with no falloff.
+	 */
+	bool falloff;
 
 	PointLight();
 	PointLight(const Vector3 &pos, const Color &color);
 	bool intersection(const Ray &ray, IntInfo* i_info) const;
 	void calc_bbox();
 	Vector3 sample() const;
+	bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+	double light_power() const;
 	bool is_light() const;
 };
 
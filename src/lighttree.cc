@@ -0,0 +1,230 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "lighttree.h"
+
+struct CentroidLess {
+	const std::vector<Vector3> *centroids;
+	int axis;
+
+	bool operator ()(int a, int b) const
+	{
+		const Vector3 &ca = (*centroids)[a];
+		const Vector3 &cb = (*centroids)[b];
+		return axis == 0 ? ca.x < cb.x : (axis == 1 ? ca.y < cb.y : ca.z < cb.z);
+	}
+};
+
+static BBox bbox_union(const BBox &a, const BBox &b)
+{
+	BBox res;
+	res.min.x = std::min(a.min.x, b.min.x);
+	res.min.y = std::min(a.min.y, b.min.y);
+	res.min.z = std::min(a.min.z, b.min.z);
+	res.max.x = std::max(a.max.x, b.max.x);
+	res.max.y = std::max(a.max.y, b.max.y);
+	res.max.z = std::max(a.max.z, b.max.z);
+	return res;
+}
+
+void LightTree::build(const std::vector<Object*> &all_lights)
+{
+	nodes.clear();
+	lights.clear();
+	light_leaf.clear();
+
+	std::vector<double> power;
+	std::vector<Vector3> centroids;
+	for(size_t i=0; i<all_lights.size(); i++) {
+		double pwr = all_lights[i]->light_power();
+		if(pwr > 0.0) {
+			all_lights[i]->calc_bbox();
+			const BBox &b = all_lights[i]->get_bbox();
+
+			lights.push_back(all_lights[i]);
+			power.push_back(pwr);
+			centroids.push_back((b.min + b.max) * 0.5);
+		}
+	}
+	if(lights.empty()) {
+		return;
+	}
+
+	std::vector<int> idx(lights.size());
+	for(size_t i=0; i<lights.size(); i++) {
+		idx[i] = (int)i;
+	}
+	nodes.reserve(lights.size() * 2 - 1);
+	build_node(idx, 0, (int)idx.size(), power, centroids);
+	nodes[0].parent = -1;
+}
+
+/* splits the lights in the middle of the longest axis of their centroids */
+int LightTree::build_node(std::vector<int> &idx, int start, int end,
+		const std::vector<double> &power, const std::vector<Vector3> &centroids)
+{
+	int node_idx = (int)nodes.size();
+	nodes.push_back(LightNode());
+
+	if(end - start == 1) {
+		const Object *light = lights[idx[start]];
+
+		LightNode &node = nodes[node_idx];
+		node.bounds = light->get_bbox();
+		node.power = power[idx[start]];
+		node.left = node.right = -1;
+		node.light = idx[start];
+		light_leaf[light] = node_idx;
+		return node_idx;
+	}
+
+	Vector3 cmin, cmax;
+	for(int i=start; i<end; i++) {
+		const Vector3 &c = centroids[idx[i]];
+
+		if(i == start) {
+			cmin = cmax = c;
+		} else {
+			cmin.x = std::min(cmin.x, c.x); cmax.x = std::max(cmax.x, c.x);
+			cmin.y = std::min(cmin.y, c.y); cmax.y = std::max(cmax.y, c.y);
+			cmin.z = std::min(cmin.z, c.z); cmax.z = std::max(cmax.z, c.z);
+		}
+	}
+
+	Vector3 ext = cmax - cmin;
+	CentroidLess less;
+	less.centroids = &centroids;
+	less.axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+
+	int mid = (start + end) / 2;
+	std::nth_element(idx.begin() + start, idx.begin() + mid, idx.begin() + end, less);
+
+	int left = build_node(idx, start, mid, power, centroids);
+	int right = build_node(idx, mid, end, power, centroids);
+
+	LightNode &node = nodes[node_idx];
+	node.left = left;
+	node.right = right;
+	node.light = -1;
+	node.bounds = bbox_union(nodes[left].bounds, nodes[right].bounds);
+	node.power = nodes[left].power + nodes[right].power;
+	nodes[left].parent = nodes[right].parent = node_idx;
+	return node_idx;
+}
+
+/* estimated contribution of the lights of a node to the point p with normal
+ * n: their power over the squared distance of the node bounds, times the
+ * largest cosine at p of a direction towards the bounds.
+ */
+double LightTree::importance(const LightNode &node, const Vector3 &p, const Vector3 &n) const
+{
+	Vector3 c = (node.bounds.min + node.bounds.max) * 0.5;
+	Vector3 ext = (node.bounds.max - node.bounds.min) * 0.5;
+	Vector3 d = c - p;
+
+	double dist_sq = dot(d, d);
+	double rad_sq = dot(ext, ext);
+	if(dist_sq <= rad_sq) {
+		// p is inside the bounding sphere of the node
+		return node.power / std::max(rad_sq, 1e-12);
+	}
+
+	double dist = sqrt(dist_sq);
+	double cos_t = dot(n, d) / dist;
+	double sin_u = sqrt(rad_sq / dist_sq);
+	double cos_u = sqrt(1.0 - sin_u * sin_u);
+
+	// cos(max(0, theta - theta_u)), theta_u the half angle of the bounding sphere
+	double cos_bound = 1.0;
+	if(cos_t < cos_u) {
+		double sin_t = sqrt(std::max(0.0, 1.0 - cos_t * cos_t));
+		cos_bound = cos_t * cos_u + sin_t * sin_u;
+		if(cos_bound <= 0.0) {
+			return 0.0;
+		}
+	}
+	return node.power * cos_bound / dist_sq;
+}
+
+int LightTree::get_light_count() const
+{
+	return (int)lights.size();
+}
+
+const Object *LightTree::sample(const Vector3 &p, const Vector3 &n, double u, double *prob) const
+{
+	if(nodes.empty()) {
+		return 0;
+	}
+
+	int idx = 0;
+	double pr = 1.0;
+	while(nodes[idx].left != -1) {
+		const LightNode &node = nodes[idx];
+		double il = importance(nodes[node.left], p, n);
+		double ir = importance(nodes[node.right], p, n);
+		if(il + ir <= 0.0) {
+			return 0;
+		}
+
+		// u is rescaled to [0, 1) within the chosen side, for the next level
+		double pl = il / (il + ir);
+		if(u < pl) {
+			idx = node.left;
+			pr *= pl;
+			u /= pl;
+		} else {
+			idx = node.right;
+			pr *= 1.0 - pl;
+			u = (u - pl) / (1.0 - pl);
+		}
+		u = std::min(u, 1.0 - 1e-12);
+	}
+
+	*prob = pr;
+	return lights[nodes[idx].light];
+}
+
+double LightTree::prob(const Vector3 &p, const Vector3 &n, const Object *light) const
+{
+	std::map<const Object*, int>::const_iterator it = light_leaf.find(light);
+	if(it == light_leaf.end()) {
+		return 0.0;
+	}
+
+	double pr = 1.0;
+	int idx = it->second;
+	while(nodes[idx].parent != -1) {
+		const LightNode &parent = nodes[nodes[idx].parent];
+		double il = importance(nodes[parent.left], p, n);
+		double ir = importance(nodes[parent.right], p, n);
+		if(il + ir <= 0.0) {
+			return 0.0;
+		}
+
+		pr *= (idx == parent.left ? il : ir) / (il + ir);
+		idx = nodes[idx].parent;
+	}
+	return pr;
+}
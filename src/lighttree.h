@@ -0,0 +1,78 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef LIGHTTREE_H_
+#define LIGHTTREE_H_
+
+#include <map>
+#include <vector>
+#include "bbox.h"
+#include "object.h"
+#include "vector.h"
+
+struct LightNode {
+	BBox bounds;
+	double power;
+	int left, right;	// children, -1 for leaves
+	int parent;
+	int light;		// index of the light of leaves
+};
+
+/* bounding hierarchy of the lights, for picking one light per shaded point
+ * with probability proportional to an estimate of its contribution: the
+ * power of each subtree over the squared distance of its bounds, times a
+ * bound of the cosine at the shaded point. Picking is a single walk from
+ * the root, so its cost grows with the log of the number of lights.
+ *
+ * The lights of this renderer emit in all directions (spheres, point
+ * lights) or from both sides of their faces (meshes), so unlike the
+ * original (Conty Estevez and Kulla, "Importance Sampling of Many Lights
+ * with Adaptive Tree Splitting", 2018) the nodes don't bound the emission
+ * directions.
+ */
+class LightTree {
+private:
+	std::vector<LightNode> nodes;
+	std::vector<const Object*> lights;
+	std::map<const Object*, int> light_leaf;	// leaf of each light
+
+	int build_node(std::vector<int> &idx, int start, int end, const std::vector<double> &power,
+			const std::vector<Vector3> &centroids);
+	double importance(const LightNode &node, const Vector3 &p, const Vector3 &n) const;
+
+public:
+	/* builds the tree from the lights that can be sampled, using their
+	 * bounding boxes.
+	 */
+	void build(const std::vector<Object*> &all_lights);
+
+	int get_light_count() const;
+
+	/* picks a light for the point p with normal n using the uniform number
+	 * u, and returns its probability. Returns 0 if no light can reach p.
+	 */
+	const Object *sample(const Vector3 &p, const Vector3 &n, double u, double *prob) const;
+
+	/* the probability of sample(p, n) picking light */
+	double prob(const Vector3 &p, const Vector3 &n, const Object *light) const;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "mapfile.h"
+
+#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#elif defined(WIN32) || defined(__WIN32__)
+#define USE_WIN32_MAPPING
+#include <windows.h>
+#endif
+
+MappedFile::MappedFile() {
+	data = 0;
+	size = 0;
+	mapped = false;
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const char *fname) {
+	close();
+
+#ifdef USE_MMAP
+	int fd;
+	struct stat st;
+
+	if((fd = ::open(fname, O_RDONLY)) == -1) {
+		fprintf(stderr, "failed to open file: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	if(fstat(fd, &st) == -1) {
+		fprintf(stderr, "failed to stat file: %s: %s\n", fname, strerror(errno));
+		::close(fd);
+		return false;
+	}
+
+	/* mmap fails on empty files, leave data null and report zero size */
+	if(st.st_size > 0) {
+		void *ptr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(ptr == MAP_FAILED) {
+			fprintf(stderr, "failed to map file: %s: %s\n", fname, strerror(errno));
+			::close(fd);
+			return false;
+		}
+#ifdef MADV_SEQUENTIAL
+		madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+#endif
+		data = (char*)ptr;
+		size = st.st_size;
+		mapped = true;
+	}
+	::close(fd);
+	return true;
+
+#elif defined(USE_WIN32_MAPPING)
+	HANDLE file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if(file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "failed to open file: %s\n", fname);
+		return false;
+	}
+
+	LARGE_INTEGER fsize;
+	if(!GetFileSizeEx(file, &fsize)) {
+		fprintf(stderr, "failed to get the size of file: %s\n", fname);
+		CloseHandle(file);
+		return false;
+	}
+
+	if(fsize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+		void *ptr = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+		if(mapping) {
+			CloseHandle(mapping);	// the view keeps the mapping alive
+		}
+		if(!ptr) {
+			fprintf(stderr, "failed to map file: %s\n", fname);
+			CloseHandle(file);
+			return false;
+		}
+		data = (char*)ptr;
+		size = (size_t)fsize.QuadPart;
+		mapped = true;
+	}
+	CloseHandle(file);
+	return true;
+
+#else
+	FILE *fp;
+
+	if(!(fp = fopen(fname, "rb"))) {
+		fprintf(stderr, "failed to open file: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long sz = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if(sz > 0) {
+		if(!(data = (char*)malloc(sz))) {
+			fprintf(stderr, "failed to allocate %ld bytes for file: %s\n", sz, fname);
+			fclose(fp);
+			return false;
+		}
+		if(fread(data, 1, sz, fp) != (size_t)sz) {
+			fprintf(stderr, "failed to read file: %s\n", fname);
+			free(data);
+			data = 0;
+			fclose(fp);
+			return false;
+		}
+		size = sz;
+	}
+	fclose(fp);
+	return true;
+#endif
+}
+
+void MappedFile::close() {
+	if(data) {
+		if(mapped) {
+#if defined(USE_MMAP)
+			munmap(data, size);
+#elif defined(USE_WIN32_MAPPING)
+			UnmapViewOfFile(data);
+#endif
+		} else {
+			free(data);
+		}
+	}
+	data = 0;
+	size = 0;
+	mapped = false;
+}
+
+const char *MappedFile::get_data() const {
+	return data;
+}
+
+size_t MappedFile::get_size() const {
+	return size;
+}
@@ -0,0 +1,50 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef MAPFILE_H_
+#define MAPFILE_H_
+
+#include <stddef.h>
+
+/* read-only memory mapping of a whole file. Falls back to reading the file
+ * into memory on platforms with neither mmap nor win32 file mappings.
+ */
+class MappedFile {
+private:
+	char *data;
+	size_t size;
+	bool mapped;
+
+	MappedFile(const MappedFile &mf);
+	MappedFile &operator =(const MappedFile &mf);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char *fname);
+	void close();
+
+	const char *get_data() const;
+	size_t get_size() const;
+};
+
+#endif
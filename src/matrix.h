@@ -22,18 +22,92 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef MATRIX_H_
 #define MATRIX_H_
 
-class Vector3;
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "vector.h"
 
 class Matrix4x4 {
 public:
 	double matrix[4][4];
-	Matrix4x4();
-	void set_translation(const Vector3 &tr);
-	void set_rotation(const Vector3 &axis, double angle); 
-	void set_scaling(const Vector3 &sc); 
-	void transpose();
-	void print();
+	inline Matrix4x4();
+	inline void set_translation(const Vector3 &tr);
+	inline void set_rotation(const Vector3 &axis, double angle); 
+	inline void set_scaling(const Vector3 &sc); 
+	inline void transpose();
+	inline void print() const;
 };
 
-#endif
+inline Matrix4x4::Matrix4x4() {
+	for (int i=0; i<4; i++) {
+		for (int j=0; j<4; j++) {
+			matrix[i][j] = (i == j ? 1 : 0);
+		}
+	}
+}
+
+inline void Matrix4x4::set_translation(const Vector3 &tr) {
+	matrix[0][3] = tr.x;
+	matrix[1][3] = tr.y;
+	matrix[2][3] = tr.z;
+}
+
+inline void Matrix4x4::set_rotation(const Vector3 &axis, double angle) {
+	double sina = sin(angle);
+	double cosa = cos(angle);
+	double invcosa = 1 - cosa;
+	double sqx = axis.x * axis.x;
+	double sqy = axis.y * axis.y;
+	double sqz = axis.z * axis.z;
+	
+	matrix[0][0] = sqx + (1 - sqx) * cosa;
+	matrix[0][1] = axis.x * axis.y * invcosa + axis.z * sina;
+	matrix[0][2] = axis.x * axis.z * invcosa + axis.y * sina;
+	matrix[1][0] = axis.x * axis.y * invcosa + axis.z * sina;
+	matrix[1][1] = sqy + (1 - sqy) * cosa;
+	matrix[1][2] = axis.y * axis.z * invcosa - axis.x * sina;
+	matrix[2][0] = axis.x * axis.z * invcosa - axis.y * sina;
+	matrix[2][1] = axis.y * axis.z * invcosa + axis.x * sina;
+	matrix[2][2] = sqz + (1 - sqz) * cosa;
+}
+
+inline void Matrix4x4::set_scaling(const Vector3 &sc) {
+	matrix[0][0] = sc.x;
+	matrix[1][1] = sc.y;
+	matrix[2][2] = sc.z;
+}
+
+inline void Matrix4x4::transpose() {
+	double m[4][4];
 
+	memcpy(m, matrix, sizeof m);
+
+	for(int i=0; i<4; i++) {
+		for(int j=0; j<4; j++) {
+			matrix[i][j] = m[j][i];
+		}
+	}
+}
+
+inline void Matrix4x4::print() const {
+	printf("\n");
+	for (int i=0; i<4; i++) {
+		for (int j=0; j<4; j++) {
+			printf("%f", matrix[i][j]);
+			char nxt = (j%4 == 3 ? '\n' : '\t');
+			printf("%c", nxt);
+		}
+	}
+	printf("\n");
+}
+
+inline void Vector3::transform(const Matrix4x4 &tm) {
+	double x1 = tm.matrix[0][0]*x + tm.matrix[0][1]*y + tm.matrix[0][2]*z + tm.matrix[0][3];
+	double y1 = tm.matrix[1][0]*x + tm.matrix[1][1]*y + tm.matrix[1][2]*z + tm.matrix[1][3];
+	double z1 = tm.matrix[2][0]*x + tm.matrix[2][1]*y + tm.matrix[2][2]*z + tm.matrix[2][3];
+	x = x1;
+	y = y1;
+	z = z1;
+}
+
+#endif
@@ -24,12 +24,36 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include "config.h"
 #include "kdtree.h"
+#include "mapfile.h"
 #include "mesh.h"
 
-static bool tri_intersection(const Face *face, const Ray &ray, IntInfo *i_info);
-static bool quad_intersection(const Face *face, const Ray &ray, IntInfo *i_info);
+static void setup_ray(const Ray &ray, RaySetup *rs);
+static bool tri_intersection(const RaySetup &rs, const float *vpos, const uint32_t *vidx,
+		FaceHit *hit);
+static bool quad_intersection(const RaySetup &rs, const float *vpos, const uint32_t *vidx,
+		FaceHit *hit);
+static uint32_t encode_normal(const Vector3 &n);
+static Vector3 decode_normal(uint32_t enc);
+static inline scalar_t vcomp(const Vector3 &v, int idx);
+
+static MeshStorage *new_storage(MappedFile *mfile)
+{
+	MeshStorage *st = new MeshStorage;
+	st->mfile = mfile;
+	st->ref_count = 1;
+	return st;
+}
+
+static void release_storage(MeshStorage *st)
+{
+	if(--st->ref_count == 0) {
+		delete st->mfile;
+		delete st;
+	}
+}
 
 
 void Face::calc_normal()
@@ -45,33 +69,40 @@ void Face::calc_normal()
 Vector3 Face::sample(MeshPrim prim) const {
 	Vector3 smpl;
 
-	if (prim == MESH_PRIM_TRI) {
-		double a, b, c;
-		do {
-			a = (double) rand() / RAND_MAX;
-			b = (double) rand() / RAND_MAX;
-			c = (double) rand() / RAND_MAX;
-		} while(a + b + c > 1.0);
+	double u = (double) rand() / RAND_MAX;
+	double w = (double) rand() / RAND_MAX;
 
-		smpl = v[0].pos * a + v[1].pos * b + v[2].pos * c;
+	// the triangle of a quad is picked by area
+	int sub = 0;
+	if (prim == MESH_PRIM_QUAD) {
+		double area0 = length(cross(v[1].pos - v[0].pos, v[2].pos - v[0].pos));
+		double area1 = length(cross(v[2].pos - v[0].pos, v[3].pos - v[0].pos));
+		if (u * (area0 + area1) >= area0) {
+			sub = 1;
+		}
+		u = (double) rand() / RAND_MAX;
 	}
-	else {
-		Vector3 edge_a = v[1].pos - v[0].pos;
-		Vector3 edge_b = v[2].pos - v[0].pos;
-		
-		double a = (double) rand() / RAND_MAX;
-		double b = (double) rand() / RAND_MAX;
 
-		smpl = (a * edge_a) + (b * edge_b) + v[0].pos;
-	}
+	double su = sqrt(u);
+	smpl = v[0].pos * (1.0 - su) + v[1 + sub].pos * (su * (1.0 - w)) + v[2 + sub].pos * (su * w);
 	return smpl;
 }
 
 Mesh::Mesh(MeshPrim prim) {
+	num_verts = num_faces = 0;
+	vpos = 0;
+	vnorm = indices = fnorm = 0;
+	storage = new_storage(0);
+	cur_lod = -1;
+	light_area = 0.0;
 	set_primitive(prim);
 }
 
 Mesh::~Mesh() {
+	for(size_t i=0; i<lods.size(); i++) {
+		delete lods[i];
+	}
+	release_storage(storage);
 }
 
 void Mesh::set_primitive(MeshPrim prim) {
@@ -93,26 +124,163 @@ void Mesh::set_primitive(MeshPrim prim) {
 	}
 }
 
+MeshPrim Mesh::get_primitive() const {
+	return prim;
+}
+
+void Mesh::reserve(int num_verts, int num_faces) {
+	storage->vpos.reserve(num_verts * 3);
+	storage->vnorm.reserve(num_verts);
+	storage->indices.reserve(num_faces * prim);
+	storage->fnorm.reserve(num_faces * (prim - 2));
+}
+
+int Mesh::add_vertex(const Vector3 &pos, const Vector3 &norm) {
+	assert(!storage->mfile && storage->ref_count == 1);
+
+	storage->vpos.push_back((float)pos.x);
+	storage->vpos.push_back((float)pos.y);
+	storage->vpos.push_back((float)pos.z);
+	storage->vnorm.push_back(encode_normal(norm));
+
+	vpos = &storage->vpos[0];
+	vnorm = &storage->vnorm[0];
+	return num_verts++;
+}
+
+int Mesh::get_vertex_count() const {
+	return num_verts;
+}
+
+Vector3 Mesh::get_vertex_pos(int idx) const {
+	const float *v = vpos + idx * 3;
+	return Vector3(v[0], v[1], v[2]);
+}
+
+Vector3 Mesh::get_vertex_normal(int idx) const {
+	return decode_normal(vnorm[idx]);
+}
+
+void Mesh::add_face(const int *vidx) {
+	assert(!storage->mfile && storage->ref_count == 1);
+
+	for(int i=0; i<prim; i++) {
+		storage->indices.push_back((uint32_t)vidx[i]);
+	}
+
+	/* geometric normals of the face triangles, (v0 v1 v2) and (v0 v2 v3) */
+	Vector3 p0 = get_vertex_pos(vidx[0]);
+	for(int i=0; i<prim - 2; i++) {
+		Vector3 p1 = get_vertex_pos(vidx[i + 1]);
+		Vector3 p2 = get_vertex_pos(vidx[i + 2]);
+		storage->fnorm.push_back(encode_normal(cross(p1 - p0, p2 - p0)));
+	}
+
+	indices = &storage->indices[0];
+	fnorm = &storage->fnorm[0];
+	num_faces++;
+}
+
 void Mesh::add_face(const Face &face) {
-	faces.push_back(face);
+	int vidx[4];
+
+	for(int i=0; i<prim; i++) {
+		vidx[i] = add_vertex(face.v[i].pos, face.v[i].norm);
+	}
+	add_face(vidx);
 }
 
 int Mesh::get_face_count() const {
-	return (int)faces.size();
+	return num_faces;
 }
 
-Face *Mesh::get_face(int idx) {
-	if(idx < 0 || idx >= (int)faces.size()) {
-		return 0;
+bool Mesh::get_face(int idx, Face *face) const {
+	if(idx < 0 || idx >= get_face_count()) {
+		return false;
+	}
+
+	const uint32_t *vidx = indices + idx * prim;
+	for(int i=0; i<prim; i++) {
+		face->v[i].pos = get_vertex_pos(vidx[i]);
+		face->v[i].norm = get_vertex_normal(vidx[i]);
 	}
-	return &faces[idx];
+	face->calc_normal();
+	return true;
 }
 
-const Face *Mesh::get_face(int idx) const {
-	if(idx < 0 || idx >= (int)faces.size()) {
-		return 0;
+void Mesh::set_mapped_data(MappedFile *mfile, int num_verts, int num_faces, const float *vpos,
+		const uint32_t *vnorm, const uint32_t *indices, const uint32_t *fnorm,
+		const BBox &bounds) {
+	release_storage(storage);
+	storage = new_storage(mfile);
+
+	this->num_verts = num_verts;
+	this->num_faces = num_faces;
+	this->vpos = vpos;
+	this->vnorm = vnorm;
+	this->indices = indices;
+	this->fnorm = fnorm;
+	bbox = bounds;
+}
+
+void Mesh::share_data(const Mesh *mesh) {
+	if(mesh->storage == storage) {
+		return;
 	}
-	return &faces[idx];
+	release_storage(storage);
+	storage = mesh->storage;
+	storage->ref_count++;
+
+	set_primitive(mesh->prim);
+	num_verts = mesh->num_verts;
+	num_faces = mesh->num_faces;
+	vpos = mesh->vpos;
+	vnorm = mesh->vnorm;
+	indices = mesh->indices;
+	fnorm = mesh->fnorm;
+	bbox = mesh->bbox;
+
+	/* the levels of detail are shared as well */
+	std::vector<Mesh*> levels;
+	for(size_t i=0; i<mesh->lods.size(); i++) {
+		Mesh *lod = new Mesh;
+		lod->share_data(mesh->lods[i]);
+		levels.push_back(lod);
+	}
+	set_lods(levels, mesh->lod_errors);
+}
+
+void Mesh::set_lods(const std::vector<Mesh*> &levels, const std::vector<double> &errors) {
+	for(size_t i=0; i<lods.size(); i++) {
+		delete lods[i];
+	}
+	lods = levels;
+	lod_errors = errors;
+	cur_lod = -1;
+}
+
+int Mesh::get_lod_count() const {
+	return (int)lods.size();
+}
+
+int Mesh::get_lod() const {
+	return cur_lod;
+}
+
+const float *Mesh::get_vertex_data() const {
+	return vpos;
+}
+
+const uint32_t *Mesh::get_normal_data() const {
+	return vnorm;
+}
+
+const uint32_t *Mesh::get_index_data() const {
+	return indices;
+}
+
+const uint32_t *Mesh::get_face_normal_data() const {
+	return fnorm;
 }
 
 bool Mesh::intersection(const Ray &ray, IntInfo *i_info) const {
@@ -120,6 +288,16 @@ bool Mesh::intersection(const Ray &ray, IntInfo *i_info) const {
 		return false;
 	}
 
+	if(cur_lod >= 0) {
+		if(!lods[cur_lod]->intersection(ray, i_info)) {
+			return false;
+		}
+		if(i_info) {
+			i_info->object = this;
+		}
+		return true;
+	}
+
 	// first check if the ray intersects the bounding box of the mesh
 #ifdef USE_BBOX
 	if(!bbox.intersection(ray)) {
@@ -127,153 +305,501 @@ bool Mesh::intersection(const Ray &ray, IntInfo *i_info) const {
 	}
 #endif
 
-	bool found = false;
+	RaySetup rs;
+	setup_ray(ray, &rs);
 
-	IntInfo nearest;
-	nearest.t = DBL_MAX;
+	FaceHit nearest;
+	nearest.t = FLT_MAX;
+	int nearest_idx = -1;
 
 	// TODO implement space subdivision
-	for(size_t i=0; i<faces.size(); i++) {
-		IntInfo inf;
-		if(face_intersection(&faces[i], ray, &inf) && inf.t < nearest.t) {
-			nearest = inf;
-			found = true;
+	const uint32_t *vidx = indices;
+	for(int i=0; i<num_faces; i++) {
+		FaceHit hit;
+		if(face_intersection(rs, vpos, vidx, &hit) && hit.t < nearest.t) {
+			nearest = hit;
+			nearest_idx = i;
 		}
+		vidx += prim;
 	}
 
-	if(!found) {
+	if(nearest_idx == -1) {
 		return false;
 	}
 
 	if(i_info) {
-		*i_info = nearest;
+		/* interpolate the vertex normals only once, for the nearest hit */
+		const uint32_t *fidx = indices + nearest_idx * prim;
+		int v0 = fidx[0];
+		int v1 = fidx[1 + nearest.sub];
+		int v2 = fidx[2 + nearest.sub];
+
+		Vector3 n0 = get_vertex_normal(v0);
+		Vector3 n1 = get_vertex_normal(v1);
+		Vector3 n2 = get_vertex_normal(v2);
+		i_info->normal = normalize(nearest.bc[0] * n0 + nearest.bc[1] * n1 + nearest.bc[2] * n2);
+
+		/* the hit point is interpolated from the vertices instead of moving
+		 * along the ray, which keeps its error small relative to the vertex
+		 * coordinates, as offset_ray_origin expects.
+		 */
+		Vector3 p0 = get_vertex_pos(v0);
+		Vector3 p1 = get_vertex_pos(v1);
+		Vector3 p2 = get_vertex_pos(v2);
+		i_info->i_point = nearest.bc[0] * p0 + nearest.bc[1] * p1 + nearest.bc[2] * p2;
+		i_info->geom_normal = decode_normal(fnorm[nearest_idx * (prim - 2) + nearest.sub]);
+		i_info->t = nearest.t;
 		i_info->object = this;
 	}
 	return true;
 }
 
 void Mesh::calc_bbox() {
-	bbox.max = Vector3(-DBL_MAX, -DBL_MAX, -DBL_MAX);
-	bbox.min = Vector3(DBL_MAX, DBL_MAX, DBL_MAX);
+	if(storage->mfile) {
+		// the bounds of mapped meshes are stored in the file
+		return;
+	}
 
-	for(size_t i=0; i<faces.size(); i++) {
-		for(int j=0; j<prim; j++) {
-			Vector3 v = faces[i].v[j].pos;
+	bbox.max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	bbox.min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
 
-			if(v.x < bbox.min.x) bbox.min.x = v.x;
-			if(v.y < bbox.min.y) bbox.min.y = v.y;
-			if(v.z < bbox.min.z) bbox.min.z = v.z;
+	for(int i=0; i<num_verts; i++) {
+		const float *v = vpos + i * 3;
 
-			if(v.x > bbox.max.x) bbox.max.x = v.x;
-			if(v.y > bbox.max.y) bbox.max.y = v.y;
-			if(v.z > bbox.max.z) bbox.max.z = v.z;
-		}
+		if(v[0] < bbox.min.x) bbox.min.x = v[0];
+		if(v[1] < bbox.min.y) bbox.min.y = v[1];
+		if(v[2] < bbox.min.z) bbox.min.z = v[2];
+
+		if(v[0] > bbox.max.x) bbox.max.x = v[0];
+		if(v[1] > bbox.max.y) bbox.max.y = v[1];
+		if(v[2] > bbox.max.z) bbox.max.z = v[2];
 	}
 }
 
 Vector3 Mesh::sample() const {
-	int rnd = (int) ((double) rand() / ((double)RAND_MAX + 1) * (double)faces.size());
-	assert(rnd < (int) faces.size());
-	const Face* rnd_face = &faces[rnd];
-	return rnd_face->sample(prim);
+	LightSample ls;
+	if(sample_surface((double) rand() / RAND_MAX, (double) rand() / RAND_MAX, &ls)) {
+		return ls.pos;
+	}
+
+	// no light sampling tables, any face will do
+	int nfaces = get_face_count();
+	int rnd = (int) ((double) rand() / ((double)RAND_MAX + 1) * (double)nfaces);
+	assert(rnd < nfaces);
+
+	Face rnd_face;
+	get_face(rnd, &rnd_face);
+	return rnd_face.sample(prim);
+}
+
+static inline double tri_area(const float *p0, const float *p1, const float *p2)
+{
+	Vector3 a(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]);
+	Vector3 b(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]);
+	return length(cross(a, b)) * 0.5;
 }
 
-static Vector3 bary_coords(const Vector3 &pt, const Face *face)
+static inline double face_area(const float *vpos, const uint32_t *fidx, int prim)
 {
-	Vector3 bc;
+	const float *p0 = vpos + fidx[0] * 3;
+	double area = 0.0;
+	for(int j=0; j<prim - 2; j++) {
+		area += tri_area(p0, vpos + fidx[j + 1] * 3, vpos + fidx[j + 2] * 3);
+	}
+	return area;
+}
+
+/* builds the alias table of the faces: the areas are scaled so that they
+ * average 1, and each face below 1 is topped up with what a face above 1
+ * has in excess, which becomes its alias.
+ */
+void Mesh::prepare_light_sampling() {
+	face_alias.clear();
+	light_area = 0.0;
+	if(!num_faces) {
+		return;
+	}
+
+	std::vector<double> scaled(num_faces);
+	for(int i=0; i<num_faces; i++) {
+		scaled[i] = face_area(vpos, indices + i * prim, prim);
+		light_area += scaled[i];
+	}
+	if(light_area <= 0.0) {
+		return;
+	}
+
+	std::vector<int> small, large;
+	for(int i=0; i<num_faces; i++) {
+		scaled[i] *= num_faces / light_area;
+		if(scaled[i] < 1.0) {
+			small.push_back(i);
+		} else {
+			large.push_back(i);
+		}
+	}
 
-	// find the area of the whole triangle
-	Vector3 vi = face->v[1].pos - face->v[0].pos;
-	Vector3 vj = face->v[2].pos - face->v[0].pos;
-	double area = fabs(dot(cross(vi, vj), face->norm) / 2.0);
-	if(area < 1e-8) {
-		return bc;	// zero-area triangle (points coplanar or coincident)
+	face_alias.resize(num_faces);
+	while(!small.empty() && !large.empty()) {
+		int s = small.back();
+		int l = large.back();
+		small.pop_back();
+
+		face_alias[s].prob = scaled[s];
+		face_alias[s].alias = l;
+
+		scaled[l] -= 1.0 - scaled[s];
+		if(scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
 	}
 
-	// three vectors radiating from the point to the vertices;
-	Vector3 pv0 = face->v[0].pos - pt;
-	Vector3 pv1 = face->v[1].pos - pt;
-	Vector3 pv2 = face->v[2].pos - pt;
+	// whatever is left is 1 but for rounding errors
+	for(size_t i=0; i<large.size(); i++) {
+		face_alias[large[i]].prob = 1.0;
+		face_alias[large[i]].alias = large[i];
+	}
+	for(size_t i=0; i<small.size(); i++) {
+		face_alias[small[i]].prob = 1.0;
+		face_alias[small[i]].alias = small[i];
+	}
+}
 
-	// calculate the areas of each sub-triangle
-	double a0 = fabs(dot(cross(pv1, pv2), face->norm) / 2.0);
-	double a1 = fabs(dot(cross(pv2, pv0), face->norm) / 2.0);
-	double a2 = fabs(dot(cross(pv0, pv1), face->norm) / 2.0);
+bool Mesh::sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const {
+	if(!sample_surface(u, v, ls)) {
+		return false;
+	}
+	ls->radiance = material.ke;
+	ls->pdf = area_to_solid_angle(ref, ls->pos, ls->normal, light_area);
+	return ls->pdf > 0.0;
+}
+
+bool Mesh::sample_surface(double u, double v, LightSample *ls) const {
+	if(face_alias.empty()) {
+		return false;
+	}
+
+	/* pick a face by area with u through the alias table, and the triangle
+	 * of a quad by area as well, rescaling u to [0, 1) within the choice
+	 * each time so that it can be used again.
+	 */
+	double rnd = u * num_faces;
+	int face = std::min((int)rnd, num_faces - 1);
+	u = rnd - face;
+
+	const FaceAlias &entry = face_alias[face];
+	if(u < entry.prob) {
+		u /= entry.prob;
+	} else {
+		u = (u - entry.prob) / (1.0 - entry.prob);
+		face = entry.alias;
+	}
+	u = std::min(u, 1.0);
+
+	const uint32_t *fidx = indices + face * prim;
+	const float *p0 = vpos + fidx[0] * 3;
+
+	int sub = 0;
+	if(prim == MESH_PRIM_QUAD) {
+		double area = face_area(vpos, fidx, prim);
+		double split = area > 0.0 ? tri_area(p0, vpos + fidx[1] * 3, vpos + fidx[2] * 3) / area : 1.0;
+		if(u >= split) {
+			sub = 1;
+			u = (u - split) / (1.0 - split);
+		} else {
+			u /= split;
+		}
+	}
+	Vector3 v0 = get_vertex_pos(fidx[0]);
+	Vector3 v1 = get_vertex_pos(fidx[1 + sub]);
+	Vector3 v2 = get_vertex_pos(fidx[2 + sub]);
+
+	/* uniform point of the triangle by the square root mapping of the
+	 * barycentric coordinates, which keeps neighbouring (u, v) together
+	 * unlike folding a parallelogram in half.
+	 */
+	double su = sqrt(u);
+	ls->pos = v0 * (1.0 - su) + v1 * (su * (1.0 - v)) + v2 * (su * v);
+	ls->normal = decode_normal(fnorm[face * (prim - 2) + sub]);
+	ls->pdf = 1.0 / light_area;
+	ls->delta = false;
+	return true;
+}
+
+double Mesh::light_pdf(const Vector3 &ref, const IntInfo &hit) const {
+	if(face_alias.empty()) {
+		return 0.0;
+	}
+	return area_to_solid_angle(ref, hit.i_point, hit.geom_normal, light_area);
+}
 
-	bc.x = a0 / area;
-	bc.y = a1 / area;
-	bc.z = a2 / area;
-	return bc;
+double Mesh::light_power() const {
+	return (material.ke.x + material.ke.y + material.ke.z) / 3.0 * M_PI * light_area;
 }
 
-static bool tri_intersection(const Face *face, const Ray &ray, IntInfo *i_info)
+void Mesh::select_detail(const Vector3 &view_pos, double pixel_size, double max_error) {
+	cur_lod = -1;
+
+	/* emissive meshes keep their full detail, which is what their light
+	 * samples and pdfs are computed on
+	 */
+	if(max_error <= 0.0 || is_light()) {
+		return;
+	}
+
+	// distance of the closest point of the bounding box
+	double dist_sq = 0.0;
+	for(int i=0; i<3; i++) {
+		double d = std::max(vcomp(bbox.min, i) - vcomp(view_pos, i),
+				vcomp(view_pos, i) - vcomp(bbox.max, i));
+		if(d > 0.0) {
+			dist_sq += d * d;
+		}
+	}
+	double allowed = max_error * pixel_size * sqrt(dist_sq);
+
+	for(int i=(int)lods.size() - 1; i>=0; i--) {
+		if(lod_errors[i] <= allowed) {
+			cur_lod = i;
+			break;
+		}
+	}
+}
+
+/* octahedral normal encoding based on:
+ * "A Survey of Efficient Representations for Independent Unit Vectors",
+ * Zina H. Cigolle, Sam Donow, Daniel Evangelakos, Michael Mara, Morgan McGuire,
+ * and Quirin Meyer, Journal of Computer Graphics Techniques, 3(2):1-30, 2014
+ *
+ * The unit sphere is projected on the octahedron |x| + |y| + |z| = 1 and the
+ * lower half is folded over the upper one, so that the result fits the [-1, 1]
+ * square, which is then stored as two 16bit snorm values.
+ */
+static inline double sign_nz(double x)
 {
-	/* Step 1: solve the plane equation to find intersection with the triangle
-	   plane */
+	return x >= 0.0 ? 1.0 : -1.0;
+}
 
-	/* triangle vertices */
-	Vector3 pointA = face->v[0].pos;
-	Vector3 pointB = face->v[1].pos;
-	Vector3 pointC = face->v[2].pos;
+static inline uint32_t pack_snorm16(double x)
+{
+	if(x < -1.0) x = -1.0;
+	if(x > 1.0) x = 1.0;
+	return (uint32_t)(int)floor(x * 32767.0 + 0.5) & 0xffff;
+}
+
+static inline double unpack_snorm16(uint32_t x)
+{
+	double res = (double)(int16_t)(uint16_t)x / 32767.0;
+	return res < -1.0 ? -1.0 : res;
+}
 
-	Vector3 normalA = face->v[0].norm;
-	Vector3 normalB = face->v[1].norm;
-	Vector3 normalC = face->v[2].norm;
+static uint32_t encode_normal(const Vector3 &n)
+{
+	double l1norm = fabs(n.x) + fabs(n.y) + fabs(n.z);
+	if(l1norm == 0.0) {
+		return 0;
+	}
 
-	Vector3 n = face->norm;
+	double px = n.x / l1norm;
+	double py = n.y / l1norm;
 
-	/* in case that the points A, B, C belong to the same line --A--B--C--
-	 we don't have a triangle! */
-	if (n.x == 0 && n.y == 0 && n.z == 0)
-		return false;
+	if(n.z < 0.0) {
+		double tmp = (1.0 - fabs(py)) * sign_nz(px);
+		py = (1.0 - fabs(px)) * sign_nz(py);
+		px = tmp;
+	}
+	return pack_snorm16(px) | (pack_snorm16(py) << 16);
+}
 
-	/*plane normal and parameter d*/
-	double d = dot(n, pointA);
+static Vector3 decode_normal(uint32_t enc)
+{
+	double px = unpack_snorm16(enc & 0xffff);
+	double py = unpack_snorm16(enc >> 16);
 
-	/* find the ray-plane intersection - if any */
-	double ndir = dot(n, ray.dir);
-	if (ndir == 0)
-		return false;
-	double t = (d - dot(n, ray.origin))/ndir;
-	if(t < EPSILON || t > 1.0) {
-		return false;
+	Vector3 n(px, py, 1.0 - fabs(px) - fabs(py));
+	if(n.z < 0.0) {
+		n.x = (1.0 - fabs(py)) * sign_nz(px);
+		n.y = (1.0 - fabs(px)) * sign_nz(py);
 	}
+	return normalize(n);
+}
 
-	Vector3 point = ray.origin + ray.dir * t; /* intersection point */
+static inline scalar_t vcomp(const Vector3 &v, int idx)
+{
+	return (&v.x)[idx];
+}
 
-	// calculate barycentric coordinates of the intersection point
-	Vector3 bc = bary_coords(point, face);
+static void setup_ray(const Ray &ray, RaySetup *rs)
+{
+	scalar_t ax = fabs(ray.dir.x);
+	scalar_t ay = fabs(ray.dir.y);
+	scalar_t az = fabs(ray.dir.z);
+
+	/* permute the axes so that kz is the dominant ray direction, and swap kx
+	 * with ky if needed to preserve the winding of the triangles
+	 */
+	rs->kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+	rs->kx = (rs->kz + 1) % 3;
+	rs->ky = (rs->kx + 1) % 3;
+
+	scalar_t dz = vcomp(ray.dir, rs->kz);
+	if(dz < 0.0) {
+		int tmp = rs->kx;
+		rs->kx = rs->ky;
+		rs->ky = tmp;
+	}
 
-	double bc_sum = bc.x + bc.y + bc.z;
-	if(bc_sum < -1e-8 || bc_sum > 1.0 + 1e-8) {
-		/* if the sum of the barycentric coordinates of the intersection point
-		 * are outside of the interval [0, 1], then the point is not inside
-		 * the triangle.
-		 */
+	rs->sx = vcomp(ray.dir, rs->kx) / dz;
+	rs->sy = vcomp(ray.dir, rs->ky) / dz;
+	rs->sz = 1 / dz;
+
+	rs->ox = vcomp(ray.origin, rs->kx);
+	rs->oy = vcomp(ray.origin, rs->ky);
+	rs->oz = vcomp(ray.origin, rs->kz);
+}
+
+/* watertight ray-triangle intersection based on:
+ * "Watertight Ray/Triangle Intersection",
+ * Sven Woop, Carsten Benthin, and Ingo Wald
+ * Journal of Computer Graphics Techniques, 2(1):65-82, 2013
+ *
+ * The vertices are transformed to the space of the ray set up by setup_ray,
+ * where the 2D edge functions U, V, W are also the unnormalized barycentric
+ * coordinates. Every vertex is transformed the same way regardless of the
+ * triangle it belongs to, so rays hitting a shared edge can't slip through
+ * both of its triangles. Degenerate triangles have det = 0 and never hit.
+ */
+/* vertex transformed to the space of the ray set up by setup_ray */
+struct RayVertex {
+	scalar_t x, y, z;
+};
+
+static inline void to_ray_space(const RaySetup &rs, const float *v, RayVertex *res)
+{
+	/* relative to the ray origin, then sheared */
+	res->z = v[rs.kz] - rs.oz;
+	res->x = v[rs.kx] - rs.ox - rs.sx * res->z;
+	res->y = v[rs.ky] - rs.oy - rs.sy * res->z;
+}
+
+/* 2D edge function of the edge p->q at the ray */
+static inline scalar_t edge_func(const RayVertex &p, const RayVertex &q)
+{
+	scalar_t e = q.x * p.y - q.y * p.x;
+#ifdef SINGLE_PRECISION
+	/* an edge function of exactly 0 may be the result of float rounding, in
+	 * which case its sign is unreliable, recalculate it in double precision.
+	 */
+	if(e == 0.0f) {
+		e = (scalar_t)((double)q.x * (double)p.y - (double)q.y * (double)p.x);
+	}
+#endif
+	return e;
+}
+
+/* finishes the test of a triangle (a, b, c) given its scaled barycentric
+ * coordinates u, v, w (the edge functions of the opposite edges)
+ */
+static inline bool tri_hit(const RaySetup &rs, scalar_t u, scalar_t v, scalar_t w,
+		scalar_t az, scalar_t bz, scalar_t cz, FaceHit *hit)
+{
+	if((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) {
+		return false;
+	}
+
+	scalar_t det = u + v + w;
+	if(det == 0.0) {
 		return false;
 	}
 
-	if (i_info) {
-		/* calculate the normal at the intersection point */
-		i_info->normal = normalize(bc.x * normalA + bc.y * normalB + bc.z * normalC);
-		i_info->i_point = point;
-		i_info->t = t;
+	/* scaled hit distance, ray.dir is not normalized so t is in [0, 1] */
+	scalar_t tscaled = (u * az + v * bz + w * cz) * rs.sz;
+	scalar_t inv_det = 1 / det;
+	scalar_t t = tscaled * inv_det;
+	if(t <= 0.0 || t > 1.0) {
+		return false;
 	}
 
+	hit->t = t;
+	hit->bc[0] = u * inv_det;
+	hit->bc[1] = v * inv_det;
+	hit->bc[2] = w * inv_det;
 	return true;
 }
 
-static bool quad_intersection(const Face *face, const Ray &ray, IntInfo *i_info)
+static bool tri_intersection(const RaySetup &rs, const float *vpos, const uint32_t *vidx,
+		FaceHit *hit)
+{
+	RayVertex a, b, c;
+	to_ray_space(rs, vpos + vidx[0] * 3, &a);
+	to_ray_space(rs, vpos + vidx[1] * 3, &b);
+	to_ray_space(rs, vpos + vidx[2] * 3, &c);
+
+	hit->sub = 0;
+	return tri_hit(rs, edge_func(b, c), edge_func(c, a), edge_func(a, b), a.z, b.z, c.z, hit);
+}
+
+/* true unless the two edge functions have strictly opposite signs */
+static inline bool same_side(scalar_t e0, scalar_t e1)
 {
-	Face tri = *face;
+	return !((e0 < 0.0 && e1 > 0.0) || (e0 > 0.0 && e1 < 0.0));
+}
+
+/* the quad (a, b, c, d) in a single test. Quads entirely to one side of
+ * the ray are rejected on the transformed vertices alone. Otherwise the four
+ * boundary edge functions come first: the surface is the pair of triangles
+ * (a, b, c) and (a, c, d), each with two of the boundary edges, and a ray on
+ * the outer side of an edge of each half misses without going further. Only
+ * then is the diagonal's edge function computed, and the hit finished as in
+ * the triangle test, usually for one half only.
+ *
+ * Hits are the same as testing the two triangles separately: rays through a
+ * shared boundary edge see the same edge function from both faces, so quads
+ * stay watertight, planar or not.
+ */
+static bool quad_intersection(const RaySetup &rs, const float *vpos, const uint32_t *vidx,
+		FaceHit *hit)
+{
+	RayVertex a, b, c, d;
+	to_ray_space(rs, vpos + vidx[0] * 3, &a);
+	to_ray_space(rs, vpos + vidx[1] * 3, &b);
+	to_ray_space(rs, vpos + vidx[2] * 3, &c);
+	to_ray_space(rs, vpos + vidx[3] * 3, &d);
+
+	/* most quads a ray is tested against lie entirely to one side of it */
+	if((a.x > 0.0 && b.x > 0.0 && c.x > 0.0 && d.x > 0.0) ||
+			(a.x < 0.0 && b.x < 0.0 && c.x < 0.0 && d.x < 0.0) ||
+			(a.y > 0.0 && b.y > 0.0 && c.y > 0.0 && d.y > 0.0) ||
+			(a.y < 0.0 && b.y < 0.0 && c.y < 0.0 && d.y < 0.0)) {
+		return false;
+	}
+
+	scalar_t e_ab = edge_func(a, b);
+	scalar_t e_bc = edge_func(b, c);
+	scalar_t e_cd = edge_func(c, d);
+	scalar_t e_da = edge_func(d, a);
+
+	bool in0 = same_side(e_ab, e_bc);
+	bool in1 = same_side(e_cd, e_da);
+	if(!in0 && !in1) {
+		return false;
+	}
+
+	scalar_t e_ca = edge_func(c, a);
+	bool found = in0 && tri_hit(rs, e_bc, e_ca, e_ab, a.z, b.z, c.z, hit);
 
-	if(tri_intersection(&tri, ray, i_info)) {
+	/* both halves can only be hit if the quad is folded along the diagonal */
+	FaceHit hit1;
+	bool found1 = in1 && tri_hit(rs, e_cd, e_da, -e_ca, a.z, c.z, d.z, &hit1);
+	if(found1 && (!found || hit1.t < hit->t)) {
+		*hit = hit1;
+		hit->sub = 1;
 		return true;
 	}
 
-	tri.v[1] = face->v[2];
-	tri.v[2] = face->v[3];
-	return tri_intersection(&tri, ray, i_info);
+	hit->sub = 0;
+	return found;
 }
 
 static KDNode* construct_kdtree();
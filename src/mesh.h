@@ -23,6 +23,7 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #define MESH_H_
 
 #include <vector>
+#include <inttypes.h>
 #include "object.h"
 #include "vector.h"
 #include "bbox.h"
@@ -38,6 +39,10 @@ struct Vertex {
 	// Vector3 tex;
 };
 
+/* Face is only a transient, expanded view of a mesh face, built on demand by
+ * Mesh::get_face. The mesh itself keeps shared, compact vertex and index
+ * buffers.
+ */
 class Face {
 public:
 	Vertex v[4];
@@ -47,12 +52,89 @@ public:
 	Vector3 sample(MeshPrim prim) const;
 };
 
+/* per-ray setup of the watertight ray-triangle test: the ray is permuted so
+ * that its dominant direction is kz, and sheared/scaled so that it becomes the
+ * unit +z axis. Computed once per ray and shared by all the faces of a mesh.
+ */
+struct RaySetup {
+	int kx, ky, kz;
+	scalar_t sx, sy, sz;
+	scalar_t ox, oy, oz;	// permuted ray origin
+};
+
+/* intersection of a ray with a single face, t and the barycentric
+ * coordinates of the hit point with respect to the face vertices.
+ */
+struct FaceHit {
+	scalar_t t;
+	scalar_t bc[3];
+	int sub;	// which triangle of a quad was hit (0: v0 v1 v2, 1: v0 v2 v3)
+};
+
+/* entry of the alias table of the faces of an emissive mesh (Vose, "A
+ * linear algorithm for generating random numbers with a given distribution"):
+ * a face is kept with probability prob, and swapped for alias otherwise.
+ */
+struct FaceAlias {
+	double prob;
+	int alias;
+};
+
+class MappedFile;
+
+/* the storage behind the arrays of a mesh: either the buffers of a mesh built
+ * in memory, or the mapped file of a binary mesh. Reference counted, since
+ * meshes with the same geometry share it.
+ */
+struct MeshStorage {
+	std::vector<float> vpos;
+	std::vector<uint32_t> vnorm;
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> fnorm;
+	MappedFile *mfile;
+	int ref_count;
+};
+
 class Mesh : public Object {
 protected:
 	MeshPrim prim;
-	std::vector<Face> faces;
-
-	bool (*face_intersection)(const Face*, const Ray&, IntInfo*);
+	int num_verts, num_faces;
+
+	/* shared vertex buffer: float positions (3 per vertex) and octahedral
+	 * encoded unit normals (two 16bit snorm components packed per vertex)
+	 * kept in separate arrays, since the intersection loop only needs the
+	 * positions.
+	 */
+	const float *vpos;
+	const uint32_t *vnorm;
+
+	/* index buffer, prim indices per face */
+	const uint32_t *indices;
+
+	/* octahedral encoded geometric normals, one per triangle (two per quad) */
+	const uint32_t *fnorm;
+
+	/* the arrays above point either to the buffers of the storage, or
+	 * straight into its mapped file.
+	 */
+	MeshStorage *storage;
+
+	bool (*face_intersection)(const RaySetup &rs, const float *vpos, const uint32_t *vidx,
+			FaceHit *hit);
+
+	/* levels of detail: simplified versions of the mesh, finest first, with
+	 * their geometric error, and the one rays are tested against (-1 for the
+	 * full detail mesh).
+	 */
+	std::vector<Mesh*> lods;
+	std::vector<double> lod_errors;
+	int cur_lod;
+
+	/* alias table over the face areas, for sampling emissive meshes by
+	 * area in constant time, and the area of the whole mesh.
+	 */
+	std::vector<FaceAlias> face_alias;
+	double light_area;
 
 public:
 
@@ -62,14 +144,51 @@ public:
 	void set_primitive(MeshPrim prim);
 	MeshPrim get_primitive() const;
 
+	/* reserve space for the expected number of vertices and faces */
+	void reserve(int num_verts, int num_faces);
+
+	int add_vertex(const Vector3 &pos, const Vector3 &norm);
+	int get_vertex_count() const;
+	Vector3 get_vertex_pos(int idx) const;
+	Vector3 get_vertex_normal(int idx) const;
+
+	/* add a face from prim indices to the vertex buffer */
+	void add_face(const int *vidx);
+	/* add a face with its own, unshared, vertices */
 	void add_face(const Face &face);
 	int get_face_count() const;
-	Face *get_face(int idx);
-	const Face *get_face(int idx) const;
+	bool get_face(int idx, Face *face) const;
+
+	/* use the arrays of a mapped binary mesh in place. The mesh takes
+	 * ownership of the mapping, and its bounds are not recalculated.
+	 */
+	void set_mapped_data(MappedFile *mfile, int num_verts, int num_faces, const float *vpos,
+			const uint32_t *vnorm, const uint32_t *indices, const uint32_t *fnorm,
+			const BBox &bounds);
+
+	/* use the geometry of another mesh, without copying it */
+	void share_data(const Mesh *mesh);
+
+	/* takes ownership of the levels of detail built by simplify_mesh */
+	void set_lods(const std::vector<Mesh*> &levels, const std::vector<double> &errors);
+	int get_lod_count() const;
+	int get_lod() const;
+
+	/* raw arrays, as described above */
+	const float *get_vertex_data() const;
+	const uint32_t *get_normal_data() const;
+	const uint32_t *get_index_data() const;
+	const uint32_t *get_face_normal_data() const;
 
 	virtual bool intersection(const Ray &ray, IntInfo *i_info) const;
 	virtual void calc_bbox();
 	virtual Vector3 sample() const;
+	virtual void prepare_light_sampling();
+	virtual bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+	virtual double light_pdf(const Vector3 &ref, const IntInfo &hit) const;
+	virtual bool sample_surface(double u, double v, LightSample *ls) const;
+	virtual double light_power() const;
+	virtual void select_detail(const Vector3 &view_pos, double pixel_size, double max_error);
 };
 
 #endif
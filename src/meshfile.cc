@@ -0,0 +1,702 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "mapfile.h"
+#include "meshfile.h"
+#include "meshimport.h"
+#include "textparse.h"
+#include "timer.h"
+
+/* the body of a mesh data file is split in chunks of whole lines which are
+ * counted and then parsed in parallel. The counts give every chunk the offsets
+ * of its records in the shared arrays and the number of its first line.
+ */
+struct MeshChunk {
+	const char *start, *end;
+	int first_line;
+	int num_lines;
+	int num_verts, num_normals, num_faces;
+	int vert_offs, norm_offs, face_offs;
+	int err_line;	/* first malformed line of the chunk or 0 */
+};
+
+#define MIN_CHUNK_SIZE	(64 * 1024)
+
+/* binary mesh file header. All values are little endian and every array
+ * starts at a 16 byte aligned offset from the beginning of the file, so that
+ * the mesh can use the mapped arrays in place.
+ */
+struct BinMeshHeader {
+	char magic[4];			// "BMSH"
+	uint32_t version;
+	uint32_t prim;			// MESH_PRIM_TRI or MESH_PRIM_QUAD
+	uint32_t num_verts;
+	uint32_t num_faces;
+	float bmin[3], bmax[3];	// bounds of the vertex positions
+	uint32_t reserved;
+	uint64_t vpos_offs;		// num_verts * 3 float positions
+	uint64_t vnorm_offs;	// num_verts octahedral encoded normals
+	uint64_t index_offs;	// num_faces * prim vertex indices
+	uint64_t fnorm_offs;	// num_faces * (prim - 2) encoded triangle normals
+};
+
+#define BMESH_MAGIC		"BMSH"
+#define BMESH_VERSION	1
+#define BMESH_ALIGN		16
+
+static bool load_text_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale);
+static bool load_binary_mesh(Mesh *mesh, const char *fname, MappedFile *mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale, bool *in_place);
+static void count_chunk(MeshChunk *chunk);
+static void parse_chunk(MeshChunk *chunk, int prim, const Vector3 &pos, const Matrix4x4 &rot,
+		const Vector3 &scale, int total_verts, int total_normals, Vector3 *verts,
+		Vector3 *normals, int *face_idx);
+static int get_mesh_vertex(Mesh *mesh, int pidx, int nidx, const std::vector<Vector3> &verts,
+		const std::vector<Vector3> &normals, std::vector<int> &pos_first,
+		std::vector<int> &pos_next, std::vector<int> &vert_nidx);
+
+/* case insensitive check of the file name extension */
+static bool has_suffix(const char *fname, const char *suffix) {
+	size_t len = strlen(fname);
+	size_t slen = strlen(suffix);
+	if(len < slen) {
+		return false;
+	}
+
+	fname += len - slen;
+	for(size_t i=0; i<slen; i++) {
+		if(tolower(fname[i]) != tolower(suffix[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool load_mesh_file(Mesh *mesh, const char *fname, const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
+	MappedFile *mf = new MappedFile;
+
+	unsigned long start = get_msec();
+
+	if(!mf->open(fname)) {
+		fprintf(stderr, "failed to open mesh data file: %s\n", fname);
+		delete mf;
+		return false;
+	}
+
+	if(has_suffix(fname, ".bmesh")) {
+		bool in_place = false;
+		bool res = load_binary_mesh(mesh, fname, mf, pos, rot, scale, &in_place);
+		if(!in_place) {
+			delete mf;
+		}
+		if(!res) {
+			return false;
+		}
+		printf("loaded mesh %s: %d vertices, %d faces in %lu msec\n", fname,
+				mesh->get_vertex_count(), mesh->get_face_count(), get_msec() - start);
+		return true;
+	}
+
+	bool res;
+	if(has_suffix(fname, ".obj")) {
+		res = load_obj_mesh(mesh, fname, *mf, pos, rot, scale);
+	} else if(has_suffix(fname, ".ply")) {
+		res = load_ply_mesh(mesh, fname, *mf, pos, rot, scale);
+	} else {
+		res = load_text_mesh(mesh, fname, *mf, pos, rot, scale);
+	}
+	double mb = (double)mf->get_size() / (1024.0 * 1024.0);
+	delete mf;
+
+	if(!res) {
+		return false;
+	}
+
+	unsigned long msec = get_msec() - start;
+	printf("loaded mesh %s: %d vertices, %d faces, %.1f MB in %lu msec (%.1f MB/s)\n", fname,
+			mesh->get_vertex_count(), mesh->get_face_count(), mb, msec,
+			msec ? mb * 1000.0 / msec : 0.0);
+	return true;
+}
+
+bool map_binary_mesh(Mesh *mesh, const char *fname) {
+	MappedFile *mf = new MappedFile;
+
+	if(!mf->open(fname)) {
+		delete mf;
+		return false;
+	}
+
+	Matrix4x4 identity;
+	bool in_place = false;
+	bool res = load_binary_mesh(mesh, fname, mf, Vector3(0, 0, 0), identity, Vector3(1, 1, 1), &in_place);
+	if(!in_place) {
+		delete mf;
+	}
+	return res;
+}
+
+static bool is_identity(const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
+	if(pos.x != 0.0 || pos.y != 0.0 || pos.z != 0.0 ||
+			scale.x != 1.0 || scale.y != 1.0 || scale.z != 1.0) {
+		return false;
+	}
+	for(int i=0; i<3; i++) {
+		for(int j=0; j<4; j++) {
+			if(rot.matrix[i][j] != (i == j ? 1.0 : 0.0)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static bool check_array(const BinMeshHeader &hdr, uint64_t offs, uint64_t size, size_t file_size) {
+	return offs % BMESH_ALIGN == 0 && offs >= sizeof hdr && offs <= file_size &&
+		size <= file_size - offs;
+}
+
+static bool is_little_endian() {
+	uint32_t val = 1;
+	return *(unsigned char*)&val == 1;
+}
+
+/* returns the first face with a vertex index out of range, or -1 */
+static int64_t find_invalid_face(const uint32_t *indices, uint64_t nfaces, int prim, uint64_t nverts) {
+	uint64_t count = nfaces * prim;
+	for(uint64_t i=0; i<count; i++) {
+		if(indices[i] >= nverts) {
+			return (int64_t)(i / prim);
+		}
+	}
+	return -1;
+}
+
+static bool check_bounds(const BinMeshHeader &hdr) {
+	for(int i=0; i<3; i++) {
+		/* written this way so that NaNs fail too */
+		if(!(hdr.bmin[i] <= hdr.bmax[i]) || !(hdr.bmin[i] > -FLT_MAX) || !(hdr.bmax[i] < FLT_MAX)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* on success in_place tells if the mesh uses the arrays of the mapped file,
+ * in which case it has taken ownership of the mapping.
+ */
+static bool load_binary_mesh(Mesh *mesh, const char *fname, MappedFile *mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale, bool *in_place) {
+	const char *data = mf->get_data();
+	size_t size = mf->get_size();
+	BinMeshHeader hdr;
+
+	/* the arrays are used as they are in the file, so a big endian host
+	 * would need a byte swapped copy which is not implemented.
+	 */
+	if(!is_little_endian()) {
+		fprintf(stderr, "failed to read binary mesh file: %s: big endian hosts are not supported\n", fname);
+		return false;
+	}
+
+	if(size < sizeof hdr) {
+		fprintf(stderr, "failed to read binary mesh file: %s: file too short\n", fname);
+		return false;
+	}
+	memcpy(&hdr, data, sizeof hdr);
+
+	if(memcmp(hdr.magic, BMESH_MAGIC, 4) != 0) {
+		fprintf(stderr, "failed to read binary mesh file: %s: invalid header\n", fname);
+		return false;
+	}
+	if(hdr.version != BMESH_VERSION) {
+		fprintf(stderr, "failed to read binary mesh file: %s: unsupported version %u\n",
+				fname, (unsigned int)hdr.version);
+		return false;
+	}
+	if(hdr.prim != MESH_PRIM_TRI && hdr.prim != MESH_PRIM_QUAD) {
+		fprintf(stderr, "failed to read binary mesh file: %s: invalid primitive %u\n",
+				fname, (unsigned int)hdr.prim);
+		return false;
+	}
+
+	uint64_t nverts = hdr.num_verts;
+	uint64_t nfaces = hdr.num_faces;
+	if(nverts > INT_MAX || nfaces > INT_MAX ||
+			!check_array(hdr, hdr.vpos_offs, nverts * 3 * sizeof(float), size) ||
+			!check_array(hdr, hdr.vnorm_offs, nverts * sizeof(uint32_t), size) ||
+			!check_array(hdr, hdr.index_offs, nfaces * hdr.prim * sizeof(uint32_t), size) ||
+			!check_array(hdr, hdr.fnorm_offs, nfaces * (hdr.prim - 2) * sizeof(uint32_t), size)) {
+		fprintf(stderr, "failed to read binary mesh file: %s: invalid array size or offset\n", fname);
+		return false;
+	}
+
+	const float *vpos = (const float*)(data + hdr.vpos_offs);
+	const uint32_t *vnorm = (const uint32_t*)(data + hdr.vnorm_offs);
+	const uint32_t *indices = (const uint32_t*)(data + hdr.index_offs);
+	const uint32_t *fnorm = (const uint32_t*)(data + hdr.fnorm_offs);
+
+	/* the intersection code trusts the indices and the bounds, so they are
+	 * checked once here. This only reads the index array, the positions and
+	 * normals stay untouched until they are needed.
+	 */
+	int64_t bad_face = find_invalid_face(indices, nfaces, hdr.prim, nverts);
+	if(bad_face >= 0) {
+		fprintf(stderr, "failed to read binary mesh file: %s: invalid index in face %" PRId64 "\n",
+				fname, bad_face);
+		return false;
+	}
+	if(nverts > 0 && !check_bounds(hdr)) {
+		fprintf(stderr, "failed to read binary mesh file: %s: invalid bounds\n", fname);
+		return false;
+	}
+
+	mesh->set_primitive((MeshPrim)hdr.prim);
+
+	if(is_identity(pos, rot, scale)) {
+		BBox bounds(Vector3(hdr.bmin[0], hdr.bmin[1], hdr.bmin[2]),
+				Vector3(hdr.bmax[0], hdr.bmax[1], hdr.bmax[2]));
+		mesh->set_mapped_data(mf, (int)nverts, (int)nfaces, vpos, vnorm, indices, fnorm, bounds);
+		*in_place = true;
+		return true;
+	}
+
+	/* meshes have no transformation of their own, so transformed instances
+	 * are copied to memory, like the text meshes.
+	 */
+	Mesh tmp;
+	tmp.set_primitive((MeshPrim)hdr.prim);
+	tmp.set_mapped_data(0, (int)nverts, (int)nfaces, vpos, vnorm, indices, fnorm, BBox());
+
+	mesh->reserve((int)nverts, (int)nfaces);
+	for(int i=0; i<(int)nverts; i++) {
+		Vector3 v = tmp.get_vertex_pos(i);
+		v = Vector3(v.x * scale.x, v.y * scale.y, v.z * scale.z);
+		v.transform(rot);
+
+		Vector3 n = tmp.get_vertex_normal(i);
+		n.transform(rot);
+		mesh->add_vertex(v + pos, normalize(n));
+	}
+
+	for(int i=0; i<(int)nfaces; i++) {
+		int vidx[4];
+		for(int j=0; j<(int)hdr.prim; j++) {
+			vidx[j] = indices[i * hdr.prim + j];
+		}
+		mesh->add_face(vidx);
+	}
+	return true;
+}
+
+static bool write_padding(FILE *fp, long offs) {
+	static const char zeros[BMESH_ALIGN] = {0};
+
+	long pad = (BMESH_ALIGN - offs % BMESH_ALIGN) % BMESH_ALIGN;
+	return fwrite(zeros, 1, pad, fp) == (size_t)pad;
+}
+
+bool save_binary_mesh(const Mesh *mesh, const char *fname) {
+	FILE *fp;
+	BinMeshHeader hdr;
+
+	int prim = mesh->get_primitive();
+	int nverts = mesh->get_vertex_count();
+	int nfaces = mesh->get_face_count();
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, BMESH_MAGIC, 4);
+	hdr.version = BMESH_VERSION;
+	hdr.prim = prim;
+	hdr.num_verts = nverts;
+	hdr.num_faces = nfaces;
+
+	for(int i=0; i<3; i++) {
+		hdr.bmin[i] = nverts ? FLT_MAX : 0.0f;
+		hdr.bmax[i] = nverts ? -FLT_MAX : 0.0f;
+	}
+	const float *vpos = mesh->get_vertex_data();
+	for(int i=0; i<nverts * 3; i++) {
+		if(vpos[i] < hdr.bmin[i % 3]) hdr.bmin[i % 3] = vpos[i];
+		if(vpos[i] > hdr.bmax[i % 3]) hdr.bmax[i % 3] = vpos[i];
+	}
+
+	const void *arrays[4];
+	size_t sizes[4];
+	uint64_t *offsets[4] = {&hdr.vpos_offs, &hdr.vnorm_offs, &hdr.index_offs, &hdr.fnorm_offs};
+
+	arrays[0] = vpos;
+	sizes[0] = (size_t)nverts * 3 * sizeof(float);
+	arrays[1] = mesh->get_normal_data();
+	sizes[1] = (size_t)nverts * sizeof(uint32_t);
+	arrays[2] = mesh->get_index_data();
+	sizes[2] = (size_t)nfaces * prim * sizeof(uint32_t);
+	arrays[3] = mesh->get_face_normal_data();
+	sizes[3] = (size_t)nfaces * (prim - 2) * sizeof(uint32_t);
+
+	uint64_t offs = sizeof hdr;
+	for(int i=0; i<4; i++) {
+		offs = (offs + BMESH_ALIGN - 1) & ~(uint64_t)(BMESH_ALIGN - 1);
+		*offsets[i] = offs;
+		offs += sizes[i];
+	}
+
+	if(!(fp = fopen(fname, "wb"))) {
+		fprintf(stderr, "failed to open binary mesh file for writing: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	bool res = fwrite(&hdr, sizeof hdr, 1, fp) == 1;
+	for(int i=0; i<4 && res; i++) {
+		res = write_padding(fp, ftell(fp)) &&
+			(!sizes[i] || fwrite(arrays[i], 1, sizes[i], fp) == sizes[i]);
+	}
+	if(fclose(fp) != 0) {
+		res = false;
+	}
+
+	if(!res) {
+		fprintf(stderr, "failed to write binary mesh file: %s\n", fname);
+		return false;
+	}
+	return true;
+}
+
+static bool load_text_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
+	const char *data = mf.get_data();
+	const char *end = data + mf.get_size();
+
+	/* header: MESH3 or MESH4 */
+	const char *ptr = data;
+	int prim = 0;
+	if(end - ptr >= 5 && memcmp(ptr, "MESH", 4) == 0) {
+		prim = ptr[4] - '0';
+		ptr = skip_space(ptr + 5, end);
+	}
+	if((prim != MESH_PRIM_TRI && prim != MESH_PRIM_QUAD) || (ptr < end && *ptr != '\n')) {
+		fprintf(stderr, "failed to read mesh data file: %s: line 1: invalid header\n", fname);
+		return false;
+	}
+	if(ptr < end) {
+		ptr++;
+	}
+
+	/* split the rest of the file in chunks at line boundaries */
+	int num_threads = 1;
+#ifdef _OPENMP
+	num_threads = omp_get_max_threads();
+#endif
+	size_t body_size = end - ptr;
+	size_t num_chunks = body_size / MIN_CHUNK_SIZE;
+	if(num_chunks > (size_t)num_threads * 8) {
+		num_chunks = num_threads * 8;
+	}
+	if(num_chunks < 1) {
+		num_chunks = 1;
+	}
+
+	std::vector<MeshChunk> chunks(num_chunks);
+	for(size_t i=0; i<num_chunks; i++) {
+		MeshChunk *c = &chunks[i];
+		memset(c, 0, sizeof *c);
+
+		c->start = i ? chunks[i - 1].end : ptr;
+		if(i == num_chunks - 1) {
+			c->end = end;
+		} else {
+			const char *split = ptr + body_size * (i + 1) / num_chunks;
+			if(split < c->start) {
+				split = c->start;
+			}
+			split = find_eol(split, end);
+			c->end = split < end ? split + 1 : end;
+		}
+	}
+
+	/* first pass: count the lines and records of every chunk */
+	#pragma omp parallel for schedule(dynamic)
+	for(int i=0; i<(int)num_chunks; i++) {
+		count_chunk(&chunks[i]);
+	}
+
+	int num_verts = 0, num_normals = 0, num_faces = 0, line = 2;
+	for(size_t i=0; i<num_chunks; i++) {
+		MeshChunk *c = &chunks[i];
+		c->first_line = line;
+		c->vert_offs = num_verts;
+		c->norm_offs = num_normals;
+		c->face_offs = num_faces;
+
+		line += c->num_lines;
+		num_verts += c->num_verts;
+		num_normals += c->num_normals;
+		num_faces += c->num_faces;
+	}
+
+	/* second pass: parse the records straight into their final place */
+	std::vector<Vector3> verts(num_verts), normals(num_normals);
+	std::vector<int> face_idx((size_t)num_faces * prim * 2);
+
+	#pragma omp parallel for schedule(dynamic)
+	for(int i=0; i<(int)num_chunks; i++) {
+		parse_chunk(&chunks[i], prim, pos, rot, scale, num_verts, num_normals,
+				verts.empty() ? 0 : &verts[0], normals.empty() ? 0 : &normals[0],
+				face_idx.empty() ? 0 : &face_idx[0]);
+	}
+
+	for(size_t i=0; i<num_chunks; i++) {
+		if(chunks[i].err_line) {
+			fprintf(stderr, "failed to read mesh data file: %s: line %d: invalid format\n",
+					fname, chunks[i].err_line);
+			return false;
+		}
+	}
+
+	return build_mesh(mesh, (MeshPrim)prim, verts, normals, face_idx);
+}
+
+static void count_chunk(MeshChunk *chunk) {
+	const char *ptr = chunk->start;
+	const char *end = chunk->end;
+
+	while(ptr < end) {
+		const char *eol = find_eol(ptr, end);
+		const char *line = skip_space(ptr, eol);
+
+		if(line < eol) {
+			switch(*line) {
+			case 'v':
+				chunk->num_verts++;
+				break;
+			case 'n':
+				chunk->num_normals++;
+				break;
+			case 'f':
+				chunk->num_faces++;
+				break;
+			default:
+				break;
+			}
+		}
+
+		chunk->num_lines++;
+		ptr = eol + 1;
+	}
+}
+
+static const char *parse_vec(const char *ptr, const char *end, Vector3 *vec) {
+	double x, y, z;
+
+	if(!(ptr = parse_float(ptr, end, &x)) || !(ptr = parse_float(ptr, end, &y)) ||
+			!(ptr = parse_float(ptr, end, &z))) {
+		return 0;
+	}
+
+	/* values are rounded to float like the file format always did */
+	*vec = Vector3((float)x, (float)y, (float)z);
+	return ptr;
+}
+
+static void parse_chunk(MeshChunk *chunk, int prim, const Vector3 &pos, const Matrix4x4 &rot,
+		const Vector3 &scale, int total_verts, int total_normals, Vector3 *verts,
+		Vector3 *normals, int *face_idx) {
+	const char *ptr = chunk->start;
+	const char *end = chunk->end;
+
+	verts += chunk->vert_offs;
+	normals += chunk->norm_offs;
+	face_idx += chunk->face_offs * prim * 2;
+
+	for(int lnum = chunk->first_line; ptr < end; lnum++) {
+		const char *eol = find_eol(ptr, end);
+		const char *line = skip_space(ptr, eol);
+		Vector3 vec;
+		int count;
+
+		ptr = eol + 1;
+
+		if(line >= eol || *line == '#') {
+			continue;
+		}
+
+		switch(*line) {
+		case 'v':
+			if(!parse_vec(line + 1, eol, &vec)) {
+				goto err;
+			}
+			vec = Vector3(vec.x * scale.x, vec.y * scale.y, vec.z * scale.z);
+			vec.transform(rot);
+			*verts++ = vec + pos;
+			break;
+
+		case 'n':
+			if(!parse_vec(line + 1, eol, &vec)) {
+				goto err;
+			}
+			vec.transform(rot);
+			*normals++ = normalize(vec);
+			break;
+
+		case 'f':
+			line++;
+			for(count=0; count<4; count++) {
+				int vidx, nidx;
+				const char *next = skip_space(line, eol);
+
+				if(next >= eol || !(is_digit(*next) || *next == '-' || *next == '+')) {
+					break;
+				}
+				if(!(next = parse_int(next, eol, &vidx)) || next >= eol || *next != '/' ||
+						!(next = parse_int(next + 1, eol, &nidx))) {
+					goto err;
+				}
+				if(vidx < 1 || vidx > total_verts || nidx < 1 || nidx > total_normals) {
+					goto err;
+				}
+				if(count < prim) {
+					face_idx[count * 2] = vidx - 1;
+					face_idx[count * 2 + 1] = nidx - 1;
+				}
+				line = next;
+			}
+			if(count != prim) {
+				goto err;
+			}
+			face_idx += prim * 2;
+			break;
+
+		default:
+			goto err;
+		}
+		continue;
+
+err:
+		chunk->err_line = lnum;
+		return;
+	}
+}
+
+/* returns the index of the mesh vertex with position pidx and normal nidx,
+ * adding it to the mesh the first time this pair is used. Vertices sharing a
+ * position are kept in a linked list through pos_next, starting at pos_first.
+ */
+static int get_mesh_vertex(Mesh *mesh, int pidx, int nidx, const std::vector<Vector3> &verts,
+		const std::vector<Vector3> &normals, std::vector<int> &pos_first,
+		std::vector<int> &pos_next, std::vector<int> &vert_nidx) {
+	int vidx = pos_first[pidx];
+	while(vidx != -1) {
+		if(vert_nidx[vidx] == nidx) {
+			return vidx;
+		}
+		vidx = pos_next[vidx];
+	}
+
+	vidx = mesh->add_vertex(verts[pidx], normals[nidx]);
+	vert_nidx.push_back(nidx);
+	pos_next.push_back(pos_first[pidx]);
+	pos_first[pidx] = vidx;
+	return vidx;
+}
+
+/* corners without a normal get the area weighted average of the normals of
+ * the faces around their position, appended after the normals of the file.
+ */
+static void calc_missing_normals(MeshPrim prim, const std::vector<Vector3> &verts,
+		std::vector<Vector3> &normals, std::vector<int> &face_idx) {
+	size_t i = 1;
+	while(i < face_idx.size() && face_idx[i] >= 0) {
+		i += 2;
+	}
+	if(i >= face_idx.size()) {
+		return;
+	}
+
+	int num_verts = (int)verts.size();
+	int num_faces = (int)(face_idx.size() / (prim * 2));
+
+	std::vector<Vector3> vert_normals(num_verts, Vector3(0, 0, 0));
+	for(int j=0; j<num_faces; j++) {
+		const int *fidx = &face_idx[j * prim * 2];
+		const Vector3 &p0 = verts[fidx[0]];
+
+		for(int k=1; k<prim - 1; k++) {
+			Vector3 n = cross(verts[fidx[k * 2]] - p0, verts[fidx[k * 2 + 2]] - p0);
+			vert_normals[fidx[0]] += n;
+			vert_normals[fidx[k * 2]] += n;
+			vert_normals[fidx[k * 2 + 2]] += n;
+		}
+	}
+
+	int base = (int)normals.size();
+	normals.reserve(base + num_verts);
+	for(int j=0; j<num_verts; j++) {
+		const Vector3 &n = vert_normals[j];
+		normals.push_back(dot(n, n) > 0.0 ? normalize(n) : Vector3(0, 0, 1));
+	}
+
+	for(; i<face_idx.size(); i+=2) {
+		if(face_idx[i] < 0) {
+			face_idx[i] = base + face_idx[i - 1];
+		}
+	}
+}
+
+bool build_mesh(Mesh *mesh, MeshPrim prim, const std::vector<Vector3> &verts,
+		std::vector<Vector3> &normals, std::vector<int> &face_idx) {
+	int num_verts = (int)verts.size();
+	int num_faces = (int)(face_idx.size() / (prim * 2));
+
+	calc_missing_normals(prim, verts, normals, face_idx);
+
+	/* build the indexed mesh, sharing the vertices with the same position and normal */
+	std::vector<int> pos_first(num_verts, -1), pos_next, vert_nidx;
+	pos_next.reserve(num_verts);
+	vert_nidx.reserve(num_verts);
+
+	mesh->set_primitive(prim);
+	mesh->reserve(num_verts, num_faces);
+
+	const int *fidx = face_idx.empty() ? 0 : &face_idx[0];
+	for(int i=0; i<num_faces; i++) {
+		int vidx[4];
+		for(int j=0; j<prim; j++) {
+			vidx[j] = get_mesh_vertex(mesh, fidx[0], fidx[1], verts, normals,
+					pos_first, pos_next, vert_nidx);
+			fidx += 2;
+		}
+		mesh->add_face(vidx);
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef MESHFILE_H_
+#define MESHFILE_H_
+
+#include <vector>
+#include "matrix.h"
+#include "mesh.h"
+#include "vector.h"
+
+/* loads the mesh data file fname into mesh, scaling, rotating and then
+ * translating the vertices while they are read. The format is chosen by the
+ * extension: .bmesh files are binary meshes, which are used in place from the
+ * mapped file when no transformation is needed, .obj and .ply files are
+ * imported (see meshimport.h) and everything else is parsed as MESH3/MESH4
+ * text.
+ */
+bool load_mesh_file(Mesh *mesh, const char *fname, const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale);
+
+/* maps the binary mesh file fname and uses its arrays in place, quietly */
+bool map_binary_mesh(Mesh *mesh, const char *fname);
+
+/* writes mesh to fname in the binary mesh format */
+bool save_binary_mesh(const Mesh *mesh, const char *fname);
+
+/* builds the indexed mesh from what the loaders read: vertex positions,
+ * normals and prim (position, normal) index pairs per face. Faces can leave
+ * the normal index at -1 to get smooth normals calculated from the faces
+ * around their vertex.
+ */
+bool build_mesh(Mesh *mesh, MeshPrim prim, const std::vector<Vector3> &verts,
+		std::vector<Vector3> &normals, std::vector<int> &face_idx);
+
+#endif
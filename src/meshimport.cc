@@ -0,0 +1,514 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <vector>
+#include "meshfile.h"
+#include "meshimport.h"
+#include "textparse.h"
+
+static Vector3 transform_pos(const Vector3 &v, const Vector3 &pos, const Matrix4x4 &rot,
+		const Vector3 &scale) {
+	Vector3 res(v.x * scale.x, v.y * scale.y, v.z * scale.z);
+	res.transform(rot);
+	return res + pos;
+}
+
+static Vector3 transform_normal(const Vector3 &n, const Matrix4x4 &rot) {
+	Vector3 res = n;
+	res.transform(rot);
+	return normalize(res);
+}
+
+/* splits the polygon in poly, (position, normal) index pairs, into a fan of
+ * triangles around its first vertex
+ */
+static void add_polygon(const std::vector<int> &poly, std::vector<int> &face_idx) {
+	int nverts = (int)poly.size() / 2;
+
+	for(int i=1; i<nverts - 1; i++) {
+		face_idx.push_back(poly[0]);
+		face_idx.push_back(poly[1]);
+		face_idx.push_back(poly[i * 2]);
+		face_idx.push_back(poly[i * 2 + 1]);
+		face_idx.push_back(poly[i * 2 + 2]);
+		face_idx.push_back(poly[i * 2 + 3]);
+	}
+}
+
+/* ---- OBJ ---- */
+
+/* resolves a 1-based or negative (relative to the end) OBJ index, returns -1
+ * if it's out of range
+ */
+static int obj_index(int idx, int count) {
+	idx = idx < 0 ? count + idx : idx - 1;
+	return idx >= 0 && idx < count ? idx : -1;
+}
+
+/* parses a v, v/vt, v//vn or v/vt/vn face vertex, nidx is 0 if there's no
+ * normal index, which is never valid in OBJ
+ */
+static const char *parse_obj_vertex(const char *ptr, const char *end, int *vidx, int *nidx) {
+	int tidx;
+
+	*nidx = 0;
+	if(!(ptr = parse_int(ptr, end, vidx))) {
+		return 0;
+	}
+	if(ptr < end && *ptr == '/') {
+		ptr++;
+		if(ptr < end && *ptr != '/' && !(ptr = parse_int(ptr, end, &tidx))) {
+			return 0;
+		}
+		if(ptr < end && *ptr == '/') {
+			if(!(ptr = parse_int(ptr + 1, end, nidx))) {
+				return 0;
+			}
+		}
+	}
+	return ptr >= end || is_space(*ptr) ? ptr : 0;
+}
+
+bool load_obj_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
+	const char *ptr = mf.get_data();
+	const char *end = ptr + mf.get_size();
+
+	std::vector<Vector3> verts, normals;
+	std::vector<int> face_idx, poly;
+
+	for(int lnum = 1; ptr < end; lnum++) {
+		const char *eol = find_eol(ptr, end);
+		const char *line = skip_space(ptr, eol);
+		ptr = eol + 1;
+
+		if(line >= eol || *line == '#') {
+			continue;
+		}
+
+		const char *args = line;
+		while(args < eol && !is_space(*args)) {
+			args++;
+		}
+		size_t kwlen = args - line;
+
+		double x, y, z;
+		const char *next;
+
+		if(kwlen == 1 && line[0] == 'v') {
+			/* an optional w is ignored */
+			if(!(next = parse_float(args, eol, &x)) || !(next = parse_float(next, eol, &y)) ||
+					!(next = parse_float(next, eol, &z))) {
+				goto err;
+			}
+			verts.push_back(transform_pos(Vector3((float)x, (float)y, (float)z), pos, rot, scale));
+
+		} else if(kwlen == 2 && line[0] == 'v' && line[1] == 'n') {
+			if(!(next = parse_float(args, eol, &x)) || !(next = parse_float(next, eol, &y)) ||
+					!(next = parse_float(next, eol, &z))) {
+				goto err;
+			}
+			normals.push_back(transform_normal(Vector3((float)x, (float)y, (float)z), rot));
+
+		} else if(kwlen == 1 && line[0] == 'f') {
+			poly.clear();
+
+			next = skip_space(args, eol);
+			while(next < eol) {
+				int vidx, nidx, norm = -1;
+				if(!(next = parse_obj_vertex(next, eol, &vidx, &nidx))) {
+					goto err;
+				}
+				if((vidx = obj_index(vidx, (int)verts.size())) == -1) {
+					goto err;
+				}
+				if(nidx && (norm = obj_index(nidx, (int)normals.size())) == -1) {
+					goto err;
+				}
+				poly.push_back(vidx);
+				poly.push_back(norm);
+				next = skip_space(next, eol);
+			}
+			if(poly.size() < 6) {
+				goto err;
+			}
+			add_polygon(poly, face_idx);
+		}
+		/* texture coordinates, groups, materials, lines etc are ignored */
+		continue;
+
+err:
+		fprintf(stderr, "failed to read obj file: %s: line %d: invalid format\n", fname, lnum);
+		return false;
+	}
+
+	return build_mesh(mesh, MESH_PRIM_TRI, verts, normals, face_idx);
+}
+
+/* ---- PLY ---- */
+
+enum PlyFormat { PLY_ASCII, PLY_BINARY_LE, PLY_BINARY_BE };
+
+enum PlyType {
+	PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32,
+	PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID
+};
+
+static const char *ply_type_names[][2] = {
+	{"char", "int8"}, {"uchar", "uint8"}, {"short", "int16"}, {"ushort", "uint16"},
+	{"int", "int32"}, {"uint", "uint32"}, {"float", "float32"}, {"double", "float64"}
+};
+static const int ply_type_size[] = {1, 1, 2, 2, 4, 4, 4, 8};
+
+/* the vertex and face properties the importer uses */
+enum PlyRole { PLY_NONE, PLY_X, PLY_Y, PLY_Z, PLY_NX, PLY_NY, PLY_NZ, PLY_VINDICES };
+
+struct PlyProperty {
+	PlyType type;
+	PlyType count_type;	// PLY_INVALID for scalar properties
+	PlyRole role;
+};
+
+enum PlyElemType { PLY_ELEM_OTHER, PLY_ELEM_VERTEX, PLY_ELEM_FACE };
+
+struct PlyElement {
+	PlyElemType type;
+	int count;
+	std::vector<PlyProperty> props;
+};
+
+/* reads PLY values from the data following the header */
+struct PlyReader {
+	const char *ptr, *end;
+	PlyFormat format;
+	bool swap;
+};
+
+static PlyType ply_type(const char *name, size_t len) {
+	for(int i=0; i<PLY_INVALID; i++) {
+		for(int j=0; j<2; j++) {
+			if(strlen(ply_type_names[i][j]) == len && memcmp(ply_type_names[i][j], name, len) == 0) {
+				return (PlyType)i;
+			}
+		}
+	}
+	return PLY_INVALID;
+}
+
+static bool read_ply_value(PlyReader *rd, PlyType type, double *val) {
+	if(rd->format == PLY_ASCII) {
+		while(rd->ptr < rd->end && (is_space(*rd->ptr) || *rd->ptr == '\n')) {
+			rd->ptr++;
+		}
+		const char *next = parse_float(rd->ptr, rd->end, val);
+		if(!next || (next < rd->end && !is_space(*next) && *next != '\n')) {
+			return false;
+		}
+		rd->ptr = next;
+		return true;
+	}
+
+	int size = ply_type_size[type];
+	if(rd->end - rd->ptr < size) {
+		return false;
+	}
+
+	unsigned char buf[8];
+	memcpy(buf, rd->ptr, size);
+	rd->ptr += size;
+
+	if(rd->swap) {
+		for(int i=0; i<size / 2; i++) {
+			unsigned char tmp = buf[i];
+			buf[i] = buf[size - i - 1];
+			buf[size - i - 1] = tmp;
+		}
+	}
+
+	switch(type) {
+	case PLY_INT8:
+		*val = (int8_t)buf[0];
+		break;
+	case PLY_UINT8:
+		*val = buf[0];
+		break;
+	case PLY_INT16:
+		{ int16_t x; memcpy(&x, buf, 2); *val = x; }
+		break;
+	case PLY_UINT16:
+		{ uint16_t x; memcpy(&x, buf, 2); *val = x; }
+		break;
+	case PLY_INT32:
+		{ int32_t x; memcpy(&x, buf, 4); *val = x; }
+		break;
+	case PLY_UINT32:
+		{ uint32_t x; memcpy(&x, buf, 4); *val = x; }
+		break;
+	case PLY_FLOAT32:
+		{ float x; memcpy(&x, buf, 4); *val = x; }
+		break;
+	case PLY_FLOAT64:
+		{ double x; memcpy(&x, buf, 8); *val = x; }
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+/* returns the next whitespace separated word of the header line */
+static const char *ply_word(const char **ptr, const char *eol, size_t *len) {
+	const char *start = skip_space(*ptr, eol);
+	const char *wend = start;
+	while(wend < eol && !is_space(*wend)) {
+		wend++;
+	}
+	*ptr = wend;
+	*len = wend - start;
+	return start;
+}
+
+static bool ply_word_is(const char *word, size_t len, const char *str) {
+	return strlen(str) == len && memcmp(word, str, len) == 0;
+}
+
+static bool read_ply_header(const char *fname, const MappedFile &mf, PlyFormat *format,
+		std::vector<PlyElement> &elems, const char **data) {
+	const char *ptr = mf.get_data();
+	const char *end = ptr + mf.get_size();
+	bool have_format = false;
+
+	for(int lnum = 1; ptr < end; lnum++) {
+		const char *eol = find_eol(ptr, end);
+		const char *line = ptr;
+		ptr = eol + 1;
+
+		size_t len;
+		const char *word = ply_word(&line, eol, &len);
+
+		if(lnum == 1) {
+			if(!ply_word_is(word, len, "ply")) {
+				fprintf(stderr, "failed to read ply file: %s: not a ply file\n", fname);
+				return false;
+			}
+			continue;
+		}
+
+		if(ply_word_is(word, len, "end_header")) {
+			if(!have_format) {
+				break;
+			}
+			*data = ptr < end ? ptr : end;
+			return true;
+
+		} else if(ply_word_is(word, len, "format")) {
+			word = ply_word(&line, eol, &len);
+			if(ply_word_is(word, len, "ascii")) {
+				*format = PLY_ASCII;
+			} else if(ply_word_is(word, len, "binary_little_endian")) {
+				*format = PLY_BINARY_LE;
+			} else if(ply_word_is(word, len, "binary_big_endian")) {
+				*format = PLY_BINARY_BE;
+			} else {
+				goto err;
+			}
+			have_format = true;
+
+		} else if(ply_word_is(word, len, "element")) {
+			PlyElement elem;
+			int count;
+
+			word = ply_word(&line, eol, &len);
+			if(ply_word_is(word, len, "vertex")) {
+				elem.type = PLY_ELEM_VERTEX;
+			} else if(ply_word_is(word, len, "face")) {
+				elem.type = PLY_ELEM_FACE;
+			} else {
+				elem.type = PLY_ELEM_OTHER;
+			}
+			if(!parse_int(line, eol, &count) || count < 0) {
+				goto err;
+			}
+			elem.count = count;
+			elems.push_back(elem);
+
+		} else if(ply_word_is(word, len, "property")) {
+			PlyProperty prop;
+			prop.count_type = PLY_INVALID;
+
+			if(elems.empty()) {
+				goto err;
+			}
+
+			word = ply_word(&line, eol, &len);
+			if(ply_word_is(word, len, "list")) {
+				word = ply_word(&line, eol, &len);
+				if((prop.count_type = ply_type(word, len)) == PLY_INVALID) {
+					goto err;
+				}
+				word = ply_word(&line, eol, &len);
+			}
+			if((prop.type = ply_type(word, len)) == PLY_INVALID) {
+				goto err;
+			}
+
+			PlyElemType etype = elems.back().type;
+			word = ply_word(&line, eol, &len);
+			prop.role = PLY_NONE;
+			if(etype == PLY_ELEM_VERTEX && prop.count_type == PLY_INVALID) {
+				static const char *names[] = {"x", "y", "z", "nx", "ny", "nz"};
+				for(int i=0; i<6; i++) {
+					if(ply_word_is(word, len, names[i])) {
+						prop.role = (PlyRole)(PLY_X + i);
+					}
+				}
+			} else if(etype == PLY_ELEM_FACE && prop.count_type != PLY_INVALID &&
+					(ply_word_is(word, len, "vertex_indices") || ply_word_is(word, len, "vertex_index"))) {
+				prop.role = PLY_VINDICES;
+			}
+			elems.back().props.push_back(prop);
+
+		} else if(!(len == 0 || ply_word_is(word, len, "comment") || ply_word_is(word, len, "obj_info"))) {
+			goto err;
+		}
+		continue;
+
+err:
+		fprintf(stderr, "failed to read ply file: %s: header line %d: invalid format\n", fname, lnum);
+		return false;
+	}
+
+	fprintf(stderr, "failed to read ply file: %s: incomplete header\n", fname);
+	return false;
+}
+
+bool load_ply_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
+	std::vector<PlyElement> elems;
+	PlyReader rd;
+
+	if(!read_ply_header(fname, mf, &rd.format, elems, &rd.ptr)) {
+		return false;
+	}
+	rd.end = mf.get_data() + mf.get_size();
+
+	uint16_t one = 1;
+	bool little_endian = *(unsigned char*)&one == 1;
+	rd.swap = (rd.format == PLY_BINARY_LE && !little_endian) ||
+		(rd.format == PLY_BINARY_BE && little_endian);
+
+	/* the vertex element comes first in practice, but the vertex count and
+	 * the presence of normals are known from the header anyway
+	 */
+	const PlyElement *vert_elem = 0;
+	for(size_t i=0; i<elems.size(); i++) {
+		if(elems[i].type == PLY_ELEM_VERTEX) {
+			vert_elem = vert_elem ? 0 : &elems[i];
+			if(!vert_elem) {
+				break;
+			}
+		}
+	}
+
+	int roles = 0;
+	for(size_t i=0; vert_elem && i<vert_elem->props.size(); i++) {
+		roles |= 1 << vert_elem->props[i].role;
+	}
+	int pos_roles = (1 << PLY_X) | (1 << PLY_Y) | (1 << PLY_Z);
+	int norm_roles = (1 << PLY_NX) | (1 << PLY_NY) | (1 << PLY_NZ);
+	if(!vert_elem || (roles & pos_roles) != pos_roles) {
+		fprintf(stderr, "failed to read ply file: %s: missing or invalid vertex element\n", fname);
+		return false;
+	}
+	bool have_normals = (roles & norm_roles) == norm_roles;
+	int num_verts = vert_elem->count;
+
+	std::vector<Vector3> verts, normals;
+	std::vector<int> face_idx, poly;
+
+	verts.reserve(num_verts);
+	if(have_normals) {
+		normals.reserve(num_verts);
+	}
+
+	for(size_t i=0; i<elems.size(); i++) {
+		const PlyElement &elem = elems[i];
+
+		for(int j=0; j<elem.count; j++) {
+			double vals[PLY_NZ + 1] = {0};
+			poly.clear();
+
+			for(size_t k=0; k<elem.props.size(); k++) {
+				const PlyProperty &prop = elem.props[k];
+				double val, count = 1;
+
+				if(prop.count_type != PLY_INVALID && (!read_ply_value(&rd, prop.count_type, &count) ||
+							count < 0 || count > INT_MAX)) {
+					goto err;
+				}
+
+				for(int n=0; n<(int)count; n++) {
+					if(!read_ply_value(&rd, prop.type, &val)) {
+						goto err;
+					}
+
+					if(prop.role == PLY_VINDICES) {
+						int idx = (int)val;
+						if(idx < 0 || idx >= num_verts) {
+							goto err;
+						}
+						poly.push_back(idx);
+						poly.push_back(have_normals ? idx : -1);
+					} else if(prop.role != PLY_NONE) {
+						vals[prop.role] = val;
+					}
+				}
+			}
+
+			if(elem.type == PLY_ELEM_VERTEX) {
+				Vector3 v((float)vals[PLY_X], (float)vals[PLY_Y], (float)vals[PLY_Z]);
+				verts.push_back(transform_pos(v, pos, rot, scale));
+
+				if(have_normals) {
+					Vector3 n((float)vals[PLY_NX], (float)vals[PLY_NY], (float)vals[PLY_NZ]);
+					normals.push_back(transform_normal(n, rot));
+				}
+			} else if(elem.type == PLY_ELEM_FACE) {
+				if(poly.size() < 6) {
+					goto err;
+				}
+				add_polygon(poly, face_idx);
+			}
+			continue;
+
+err:
+			fprintf(stderr, "failed to read ply file: %s: element %d, item %d: invalid or truncated data\n",
+					fname, (int)i, j);
+			return false;
+		}
+	}
+
+	return build_mesh(mesh, MESH_PRIM_TRI, verts, normals, face_idx);
+}
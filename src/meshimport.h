@@ -0,0 +1,48 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef MESHIMPORT_H_
+#define MESHIMPORT_H_
+
+#include "mapfile.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "vector.h"
+
+/* importers of common mesh file formats. Both read the mapped file in a
+ * single sequential pass, triangulate polygons as fans and transform the
+ * vertices while reading them, like the MESH3/MESH4 loader.
+ */
+
+/* Wavefront OBJ: positions, normals and faces, everything else is ignored.
+ * Faces without normals get smooth normals calculated from the mesh.
+ */
+bool load_obj_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale);
+
+/* Stanford PLY, binary (either byte order) or ascii: the x, y, z and
+ * optional nx, ny, nz properties of the vertices and the vertex index lists
+ * of the faces.
+ */
+bool load_ply_mesh(Mesh *mesh, const char *fname, const MappedFile &mf,
+		const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale);
+
+#endif
@@ -19,10 +19,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
+#include <math.h>
 #include "object.h"
 
+void classify_material(Material *mat) {
+	bool diffuse = mat->kd.x > 0.0 || mat->kd.y > 0.0 || mat->kd.z > 0.0;
+	bool specular = mat->ks.x > 0.0 || mat->ks.y > 0.0 || mat->ks.z > 0.0;
+
+	if (diffuse && specular) {
+		mat->mclass = MAT_MIXED;
+	} else if (diffuse) {
+		mat->mclass = MAT_DIFFUSE;
+	} else if (specular) {
+		mat->mclass = MAT_GLOSSY;
+	} else {
+		mat->mclass = MAT_EMISSIVE;
+	}
+}
+
+double area_to_solid_angle(const Vector3 &ref, const Vector3 &pos, const Vector3 &normal,
+		double area) {
+	Vector3 d = pos - ref;
+	double dist_sq = dot(d, d);
+	double cos_l = fabs(dot(normal, d)) / sqrt(dist_sq);
+	if (cos_l <= 0.0) {
+		return 0.0;
+	}
+	return dist_sq / (cos_l * area);
+}
+
 Object::Object() {
 	ignore = false;
+	material.mclass = MAT_MIXED;
+}
+
+Object::~Object() {
 }
 
 Material* Object::get_material() {
@@ -33,6 +64,10 @@ const Material* Object::get_material() const {
 	return &material;
 }
 
+const BBox &Object::get_bbox() const {
+	return bbox;
+}
+
 bool Object::is_light() const {
 	const Color *ke = &get_material()->ke;
 	if (ke->x > 0.0 || ke->y > 0.0 || ke->z > 0.0) {
@@ -40,3 +75,25 @@ bool Object::is_light() const {
 	}
 	return false;
 }
+
+void Object::prepare_light_sampling() {
+}
+
+bool Object::sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const {
+	return false;
+}
+
+double Object::light_pdf(const Vector3 &ref, const IntInfo &hit) const {
+	return 0.0;
+}
+
+bool Object::sample_surface(double u, double v, LightSample *ls) const {
+	return false;
+}
+
+double Object::light_power() const {
+	return 0.0;
+}
+
+void Object::select_detail(const Vector3 &view_pos, double pixel_size, double max_error) {
+}
@@ -27,14 +27,47 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "ray.h"
 #include "bbox.h"
 
+/* the lobes a material has, which shading is specialized for. Emissive
+ * materials reflect nothing, only emitting light if anything.
+ */
+enum MaterialClass {
+	MAT_MIXED,
+	MAT_DIFFUSE,
+	MAT_GLOSSY,
+	MAT_EMISSIVE
+};
+
 struct Material {
 	Color kd;
 	Color ks;
 	Color ke;
 	double specexp;
 	double kr;
+	MaterialClass mclass;
+};
+
+/* sets the class of mat by its reflectances */
+void classify_material(Material *mat);
+
+/* a point on a light source, sampled for the direct lighting of a surface
+ * point. Point lights are delta lights and have no pdf.
+ */
+struct LightSample {
+	Vector3 pos;
+	Vector3 normal;
+	Color radiance;	// emitted from pos towards the lit point
+	double pdf;	// with respect to solid angle at the lit point
+	bool delta;
+	bool falloff;	// delta lights only: radiance is an intensity, falling off with 1/r^2
 };
 
+/* converts the pdf of a point sampled uniformly on a surface of the given
+ * area, with the normal at pos, to solid angle at ref. 0 if pos is seen
+ * edge on.
+ */
+double area_to_solid_angle(const Vector3 &ref, const Vector3 &pos, const Vector3 &normal,
+		double area);
+
 class Object {
 protected:
 	Material material;
@@ -44,6 +77,7 @@ public:
 	bool ignore;
 
 	Object();
+	virtual ~Object();
 
 	virtual bool intersection(const Ray &ray, IntInfo* i_info) const = 0;
 
@@ -52,7 +86,38 @@ public:
 	virtual bool is_light() const;
 
 	virtual void calc_bbox() = 0;
+	const BBox &get_bbox() const;
 	virtual Vector3 sample() const = 0;
+
+	/* precalculates whatever sample_light needs, called once the object
+	 * is known to be a light.
+	 */
+	virtual void prepare_light_sampling();
+	/* samples a point of the object as a light source for the surface point
+	 * ref, from the uniform numbers u, v. False if the object can't be
+	 * sampled; such emitters are only found by the bounces of the paths.
+	 */
+	virtual bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+	/* the pdf sample_light(ref) has for the surface point of hit, 0 if the
+	 * object can't be sampled.
+	 */
+	virtual double light_pdf(const Vector3 &ref, const IntInfo &hit) const;
+	/* samples a point of the surface of a light uniformly by area, for
+	 * emitting light from it. The pdf of ls is per unit area. False if the
+	 * object can't be sampled.
+	 */
+	virtual bool sample_surface(double u, double v, LightSample *ls) const;
+	/* emitted power, for picking among the lights. 0 if the object can't
+	 * be sampled.
+	 */
+	virtual double light_power() const;
+
+	/* picks the level of detail to use when seen from view_pos: the coarsest
+	 * one whose geometric error covers at most max_error pixels, pixel_size
+	 * being the size of a pixel at unit distance. Objects without levels of
+	 * detail ignore it, and lights always keep their full detail.
+	 */
+	virtual void select_detail(const Vector3 &view_pos, double pixel_size, double max_error);
 };
 
 #endif
@@ -0,0 +1,853 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(WIN32) || defined(__WIN32__)
+#include <process.h>
+#define getpid	_getpid
+#else
+#include <unistd.h>
+#endif
+#include "config.h"
+#include "meshfile.h"
+#include "pagedmesh.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+struct GeomChunk {
+	char fname[512];
+	BBox bounds;
+	int num_faces;
+	double area;
+	size_t size;		// size of the chunk file, counted against the cap while mapped
+	bool emissive;		// the mapped mesh is prepared for light sampling
+	bool kept;			// emitter chunk kept mapped and pinned, outside the cap
+
+	/* the mapped chunk or null, and the intersections currently using it.
+	 * Both are read and pinned without the cache lock, see acquire_chunk, so
+	 * these three are only accessed through the atomic helpers below.
+	 */
+	Mesh *mesh;
+	int pins;
+	int referenced;		// used since the eviction scan last passed it
+	GeomChunk *lru_prev, *lru_next;
+};
+
+/* node of the bounding volume hierarchy over the chunks of a mesh, a leaf
+ * if chunk is not -1
+ */
+struct ChunkNode {
+	BBox bounds;
+	int left, right;
+	int chunk;
+};
+
+struct PagedGeometry {
+	std::vector<GeomChunk*> chunks;
+	std::vector<ChunkNode> nodes;	// the root is the first node
+	BBox bounds;
+	int num_faces;
+	double area;
+	std::vector<double> area_cdf;	// of the chunks, for the light samples
+	int ref_count;
+};
+
+/* geometry cache state, protected by cache_lock */
+static bool paging;
+static size_t mem_cap;
+static char cache_dir[400];
+static int num_files;
+
+static size_t resident, peak_resident;
+static size_t kept_resident;	// emitter chunks, not counted against the cap
+static unsigned long page_ins, evictions, page_in_failures;
+static GeomChunk *lru_head, *lru_tail;	// mapped chunks, most recently mapped first
+
+#ifdef _OPENMP
+static omp_lock_t cache_lock;
+#endif
+
+static inline void lock_cache() {
+#ifdef _OPENMP
+	omp_set_lock(&cache_lock);
+#endif
+}
+
+static inline void unlock_cache() {
+#ifdef _OPENMP
+	omp_unset_lock(&cache_lock);
+#endif
+}
+
+void enable_geom_paging(size_t cap, const char *dir) {
+	if(!dir && !(dir = getenv("TMPDIR")) && !(dir = getenv("TEMP"))) {
+		dir = "/tmp";
+	}
+	if(strlen(dir) >= sizeof cache_dir) {
+		fprintf(stderr, "geometry cache directory name too long, using the current directory\n");
+		dir = ".";
+	}
+	strcpy(cache_dir, dir);
+
+	if(!paging) {
+#ifdef _OPENMP
+		omp_init_lock(&cache_lock);
+#endif
+	}
+	paging = true;
+	mem_cap = cap;
+}
+
+bool geom_paging_enabled() {
+	return paging;
+}
+
+void print_geom_paging_stats() {
+	if(!paging) {
+		return;
+	}
+	printf("geometry paging: %lu page-ins, %lu evictions, %lu failed, peak %.1f MB mapped (cap %.1f MB)"
+			", %.1f MB of emitters kept\n", page_ins, evictions, page_in_failures,
+			peak_resident / (1024.0 * 1024.0), mem_cap / (1024.0 * 1024.0),
+			kept_resident / (1024.0 * 1024.0));
+}
+
+static void lru_unlink(GeomChunk *chunk) {
+	if(chunk->lru_prev) {
+		chunk->lru_prev->lru_next = chunk->lru_next;
+	} else if(lru_head == chunk) {
+		lru_head = chunk->lru_next;
+	}
+	if(chunk->lru_next) {
+		chunk->lru_next->lru_prev = chunk->lru_prev;
+	} else if(lru_tail == chunk) {
+		lru_tail = chunk->lru_prev;
+	}
+	chunk->lru_prev = chunk->lru_next = 0;
+}
+
+static void lru_push_front(GeomChunk *chunk) {
+	chunk->lru_prev = 0;
+	chunk->lru_next = lru_head;
+	if(lru_head) {
+		lru_head->lru_prev = chunk;
+	}
+	lru_head = chunk;
+	if(!lru_tail) {
+		lru_tail = chunk;
+	}
+}
+
+static inline Mesh *chunk_mesh(const GeomChunk *chunk) {
+	Mesh *mesh;
+	#pragma omp atomic read
+	mesh = chunk->mesh;
+	return mesh;
+}
+
+static inline void set_chunk_mesh(GeomChunk *chunk, Mesh *mesh) {
+	#pragma omp atomic write
+	chunk->mesh = mesh;
+}
+
+static inline void pin_chunk(GeomChunk *chunk) {
+	#pragma omp atomic
+	chunk->pins++;
+}
+
+static inline void unpin_chunk(GeomChunk *chunk) {
+	#pragma omp atomic
+	chunk->pins--;
+}
+
+static inline int chunk_pins(const GeomChunk *chunk) {
+	int pins;
+	#pragma omp atomic read
+	pins = chunk->pins;
+	return pins;
+}
+
+static inline bool chunk_referenced(const GeomChunk *chunk) {
+	int ref;
+	#pragma omp atomic read
+	ref = chunk->referenced;
+	return ref != 0;
+}
+
+static inline void set_chunk_referenced(GeomChunk *chunk, int ref) {
+	#pragma omp atomic write
+	chunk->referenced = ref;
+}
+
+static void unmap_chunk(GeomChunk *chunk) {
+	Mesh *mesh = chunk_mesh(chunk);
+	set_chunk_mesh(chunk, 0);
+	delete mesh;
+	if(chunk->kept) {
+		unpin_chunk(chunk);
+		chunk->kept = false;
+		kept_resident -= chunk->size;
+	} else {
+		lru_unlink(chunk);
+		resident -= chunk->size;
+	}
+}
+
+/* unmaps the chunk unless an intersection has it pinned. The mesh is taken
+ * away before the pins are checked, and acquire_chunk pins before it looks
+ * at the mesh, so either the pin is seen here or the null mesh is seen there.
+ */
+static bool try_unmap_chunk(GeomChunk *chunk) {
+	Mesh *mesh = chunk_mesh(chunk);
+	set_chunk_mesh(chunk, 0);
+	#pragma omp flush
+	if(chunk_pins(chunk)) {
+		set_chunk_mesh(chunk, mesh);
+		#pragma omp flush
+		return false;
+	}
+
+	lru_unlink(chunk);
+	delete mesh;
+	resident -= chunk->size;
+	return true;
+}
+
+/* evicts chunks that are not in use until the mapped geometry fits the cap
+ * again, approximating LRU with a second chance scan from the oldest
+ * mapping: chunks used since the last scan are moved to the front instead.
+ * Two rounds are enough to reach every chunk with its mark cleared.
+ */
+static void evict_chunks() {
+	int count = 0;
+	for(GeomChunk *c = lru_head; c; c = c->lru_next) {
+		count++;
+	}
+
+	GeomChunk *chunk = lru_tail;
+	for(int i=0; i<2 * count && resident > mem_cap && chunk; i++) {
+		GeomChunk *prev = chunk->lru_prev;
+		if(chunk_referenced(chunk)) {
+			set_chunk_referenced(chunk, 0);
+			lru_unlink(chunk);
+			lru_push_front(chunk);
+		} else if(try_unmap_chunk(chunk)) {
+			evictions++;
+		}
+		chunk = prev ? prev : lru_tail;
+	}
+}
+
+/* maps the chunk if needed and pins it, the chunk mesh stays valid until the
+ * matching release_chunk. Chunks that are already mapped are pinned without
+ * taking the cache lock; otherwise the file is mapped outside the lock and
+ * published under it, unless another thread got there first.
+ */
+static const Mesh *acquire_chunk(GeomChunk *chunk) {
+	pin_chunk(chunk);
+	#pragma omp flush
+	const Mesh *mesh = chunk_mesh(chunk);
+	if(mesh) {
+		set_chunk_referenced(chunk, 1);
+		return mesh;
+	}
+	unpin_chunk(chunk);
+
+	Mesh *newmesh = new Mesh;
+	if(!map_binary_mesh(newmesh, chunk->fname)) {
+		delete newmesh;
+		lock_cache();
+		page_in_failures++;
+		unlock_cache();
+		return 0;
+	}
+	if(chunk->emissive) {
+		newmesh->prepare_light_sampling();
+	}
+
+	lock_cache();
+	if(chunk_mesh(chunk)) {
+		delete newmesh;
+	} else {
+		set_chunk_mesh(chunk, newmesh);
+		resident += chunk->size;
+		page_ins++;
+		lru_push_front(chunk);
+	}
+	pin_chunk(chunk);
+	set_chunk_referenced(chunk, 1);
+
+	evict_chunks();
+	if(resident > peak_resident) {
+		peak_resident = resident;
+	}
+
+	mesh = chunk_mesh(chunk);
+	unlock_cache();
+	return mesh;
+}
+
+static void release_chunk(GeomChunk *chunk) {
+	unpin_chunk(chunk);
+}
+
+/* orders faces by the coordinate of their centroid along one axis */
+struct CentroidLess {
+	const std::vector<Vector3> *centroids;
+	int axis;
+
+	bool operator ()(int a, int b) const {
+		return (&(*centroids)[a].x)[axis] < (&(*centroids)[b].x)[axis];
+	}
+};
+
+/* splits the faces at the median centroid along the longest axis of their
+ * centroid bounds, until every range fits in a chunk
+ */
+static void split_faces(const std::vector<Vector3> &centroids, int *faces, int count,
+		std::vector<int> &range_sizes) {
+	if(count <= GEOM_CHUNK_FACES) {
+		range_sizes.push_back(count);
+		return;
+	}
+
+	Vector3 cmin(FLT_MAX, FLT_MAX, FLT_MAX), cmax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(int i=0; i<count; i++) {
+		const Vector3 &c = centroids[faces[i]];
+		for(int j=0; j<3; j++) {
+			if((&c.x)[j] < (&cmin.x)[j]) (&cmin.x)[j] = (&c.x)[j];
+			if((&c.x)[j] > (&cmax.x)[j]) (&cmax.x)[j] = (&c.x)[j];
+		}
+	}
+
+	Vector3 ext = cmax - cmin;
+	CentroidLess less;
+	less.centroids = &centroids;
+	less.axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+
+	int half = count / 2;
+	std::nth_element(faces, faces + half, faces + count, less);
+
+	split_faces(centroids, faces, half, range_sizes);
+	split_faces(centroids, faces + half, count - half, range_sizes);
+}
+
+/* orders chunks by the center of their bounds along one axis */
+struct ChunkLess {
+	const std::vector<GeomChunk*> *chunks;
+	int axis;
+
+	bool operator ()(int a, int b) const {
+		const BBox &ba = (*chunks)[a]->bounds;
+		const BBox &bb = (*chunks)[b]->bounds;
+		return (&ba.min.x)[axis] + (&ba.max.x)[axis] < (&bb.min.x)[axis] + (&bb.max.x)[axis];
+	}
+};
+
+/* builds the hierarchy over the chunks, splitting them at the median center
+ * along the longest axis of their bounds, returns the index of the node
+ */
+static int build_chunk_tree(PagedGeometry *geom, int *chunks, int count) {
+	int idx = (int)geom->nodes.size();
+	geom->nodes.push_back(ChunkNode());
+
+	BBox bounds(Vector3(FLT_MAX, FLT_MAX, FLT_MAX), Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	for(int i=0; i<count; i++) {
+		const BBox &cb = geom->chunks[chunks[i]]->bounds;
+		bounds.min = Vector3(MIN(bounds.min.x, cb.min.x), MIN(bounds.min.y, cb.min.y),
+				MIN(bounds.min.z, cb.min.z));
+		bounds.max = Vector3(MAX(bounds.max.x, cb.max.x), MAX(bounds.max.y, cb.max.y),
+				MAX(bounds.max.z, cb.max.z));
+	}
+
+	int left = -1, right = -1, chunk = -1;
+	if(count == 1) {
+		chunk = chunks[0];
+	} else {
+		Vector3 ext = bounds.max - bounds.min;
+		ChunkLess less;
+		less.chunks = &geom->chunks;
+		less.axis = ext.x > ext.y ? (ext.x > ext.z ? 0 : 2) : (ext.y > ext.z ? 1 : 2);
+
+		int half = count / 2;
+		std::nth_element(chunks, chunks + half, chunks + count, less);
+
+		left = build_chunk_tree(geom, chunks, half);
+		right = build_chunk_tree(geom, chunks + half, count - half);
+	}
+
+	// push_back may have moved the nodes
+	ChunkNode *node = &geom->nodes[idx];
+	node->bounds = bounds;
+	node->left = left;
+	node->right = right;
+	node->chunk = chunk;
+	return idx;
+}
+
+/* ray-box slab test, returning in tnear where the ray enters the box, if it
+ * does so before tmax
+ */
+static bool hit_bounds(const BBox &bounds, const Ray &ray, scalar_t tmax, scalar_t *tnear) {
+	scalar_t t0 = 0.0, t1 = MIN(tmax, (scalar_t)1.0);
+
+	for(int i=0; i<3; i++) {
+		scalar_t inv = 1.0 / (&ray.dir.x)[i];
+		scalar_t ta = ((&bounds.min.x)[i] - (&ray.origin.x)[i]) * inv;
+		scalar_t tb = ((&bounds.max.x)[i] - (&ray.origin.x)[i]) * inv;
+		if(ta > tb) {
+			std::swap(ta, tb);
+		}
+		if(ta > t0) t0 = ta;
+		if(tb < t1) t1 = tb;
+		if(t0 > t1) {
+			return false;
+		}
+	}
+	*tnear = t0;
+	return true;
+}
+
+/* writes the faces of a chunk, with only the vertices they use */
+static bool write_chunk(const Mesh *mesh, const int *faces, int count, std::vector<int> &remap,
+		GeomChunk *chunk) {
+	int prim = mesh->get_primitive();
+	const float *vpos = mesh->get_vertex_data();
+	const uint32_t *vnorm = mesh->get_normal_data();
+	const uint32_t *indices = mesh->get_index_data();
+	const uint32_t *fnorm = mesh->get_face_normal_data();
+
+	std::vector<float> cvpos;
+	std::vector<uint32_t> cvnorm, cindices, cfnorm;
+	std::vector<int> used;
+
+	cindices.reserve(count * prim);
+	cfnorm.reserve(count * (prim - 2));
+
+	for(int i=0; i<count; i++) {
+		int face = faces[i];
+
+		for(int j=0; j<prim; j++) {
+			int vidx = indices[face * prim + j];
+			if(remap[vidx] == -1) {
+				remap[vidx] = (int)used.size();
+				used.push_back(vidx);
+				cvpos.insert(cvpos.end(), vpos + vidx * 3, vpos + vidx * 3 + 3);
+				cvnorm.push_back(vnorm[vidx]);
+			}
+			cindices.push_back(remap[vidx]);
+		}
+		for(int j=0; j<prim - 2; j++) {
+			cfnorm.push_back(fnorm[face * (prim - 2) + j]);
+		}
+	}
+
+	for(size_t i=0; i<used.size(); i++) {
+		remap[used[i]] = -1;
+	}
+
+	Mesh tmp;
+	tmp.set_primitive((MeshPrim)prim);
+	tmp.set_mapped_data(0, (int)used.size(), count, &cvpos[0], &cvnorm[0], &cindices[0],
+			&cfnorm[0], BBox());
+
+	lock_cache();
+	sprintf(chunk->fname, "%s/rtgeom_%d_%d.bmesh", cache_dir, (int)getpid(), num_files++);
+	unlock_cache();
+
+	if(!save_binary_mesh(&tmp, chunk->fname)) {
+		return false;
+	}
+
+	chunk->bounds.min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	chunk->bounds.max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(size_t i=0; i<cvpos.size(); i+=3) {
+		Vector3 v(cvpos[i], cvpos[i + 1], cvpos[i + 2]);
+		chunk->bounds.min = Vector3(MIN(v.x, chunk->bounds.min.x), MIN(v.y, chunk->bounds.min.y),
+				MIN(v.z, chunk->bounds.min.z));
+		chunk->bounds.max = Vector3(MAX(v.x, chunk->bounds.max.x), MAX(v.y, chunk->bounds.max.y),
+				MAX(v.z, chunk->bounds.max.z));
+	}
+
+	chunk->area = 0.0;
+	for(int i=0; i<count; i++) {
+		const uint32_t *fidx = &cindices[i * prim];
+		const float *p0 = &cvpos[fidx[0] * 3];
+		for(int j=0; j<prim - 2; j++) {
+			const float *p1 = &cvpos[fidx[j + 1] * 3];
+			const float *p2 = &cvpos[fidx[j + 2] * 3];
+			Vector3 a(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]);
+			Vector3 b(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]);
+			chunk->area += length(cross(a, b)) * 0.5;
+		}
+	}
+
+	chunk->num_faces = count;
+	chunk->size = cvpos.size() * sizeof(float) +
+		(cvnorm.size() + cindices.size() + cfnorm.size()) * sizeof(uint32_t);
+	return true;
+}
+
+static void release_geometry(PagedGeometry *geom) {
+	if(--geom->ref_count > 0) {
+		return;
+	}
+
+	for(size_t i=0; i<geom->chunks.size(); i++) {
+		GeomChunk *chunk = geom->chunks[i];
+
+		lock_cache();
+		if(chunk_mesh(chunk)) {
+			unmap_chunk(chunk);
+		}
+		unlock_cache();
+
+		if(chunk->fname[0]) {
+			remove(chunk->fname);
+		}
+		delete chunk;
+	}
+	delete geom;
+}
+
+PagedMesh::PagedMesh() {
+	geom = 0;
+}
+
+PagedMesh::~PagedMesh() {
+	if(geom) {
+		release_geometry(geom);
+	}
+}
+
+void PagedMesh::share_data(const PagedMesh *pmesh) {
+	if(geom) {
+		release_geometry(geom);
+	}
+	geom = pmesh->geom;
+	geom->ref_count++;
+	bbox = pmesh->bbox;
+}
+
+bool PagedMesh::intersection(const Ray &ray, IntInfo *i_info) const {
+	if(ignore || !geom) {
+		return false;
+	}
+
+#ifdef USE_BBOX
+	if(!bbox.intersection(ray)) {
+		return false;
+	}
+#endif
+
+	IntInfo nearest;
+	nearest.t = FLT_MAX;
+	bool found = false;
+
+	/* visit the chunks nearest first, skipping the ones that start past the
+	 * nearest hit so far, so that only the chunks a ray really reaches are
+	 * paged in. Occlusion queries (null i_info) stop at the first hit.
+	 */
+	struct {
+		int node;
+		scalar_t t;
+	} stack[64];
+	int top = 0;
+
+	scalar_t t;
+	if(geom->nodes.empty() || !hit_bounds(geom->nodes[0].bounds, ray, FLT_MAX, &t)) {
+		return false;
+	}
+	stack[top].node = 0;
+	stack[top++].t = t;
+
+	while(top > 0) {
+		top--;
+		if(stack[top].t >= nearest.t) {
+			continue;
+		}
+		const ChunkNode *node = &geom->nodes[stack[top].node];
+
+		if(node->chunk != -1) {
+			GeomChunk *chunk = geom->chunks[node->chunk];
+			const Mesh *mesh = acquire_chunk(chunk);
+			if(!mesh) {
+				continue;
+			}
+
+			if(!i_info) {
+				bool hit = mesh->intersection(ray, 0);
+				release_chunk(chunk);
+				if(hit) {
+					return true;
+				}
+				continue;
+			}
+
+			IntInfo inf;
+			if(mesh->intersection(ray, &inf) && inf.t < nearest.t) {
+				nearest = inf;
+				found = true;
+			}
+			release_chunk(chunk);
+			continue;
+		}
+
+		scalar_t tl, tr;
+		bool hit_left = hit_bounds(geom->nodes[node->left].bounds, ray, nearest.t, &tl);
+		bool hit_right = hit_bounds(geom->nodes[node->right].bounds, ray, nearest.t, &tr);
+
+		// the nearer child goes on top
+		if(hit_left && hit_right && tl < tr) {
+			stack[top].node = node->right;
+			stack[top++].t = tr;
+			hit_right = false;
+		}
+		if(hit_left) {
+			stack[top].node = node->left;
+			stack[top++].t = tl;
+		}
+		if(hit_right) {
+			stack[top].node = node->right;
+			stack[top++].t = tr;
+		}
+	}
+
+	if(found && i_info) {
+		*i_info = nearest;
+		i_info->object = this;
+	}
+	return found;
+}
+
+void PagedMesh::calc_bbox() {
+	if(geom) {
+		bbox = geom->bounds;
+	}
+}
+
+Vector3 PagedMesh::sample() const {
+	int face = (int)((double)rand() / ((double)RAND_MAX + 1) * geom->num_faces);
+
+	for(size_t i=0; i<geom->chunks.size(); i++) {
+		GeomChunk *chunk = geom->chunks[i];
+		if(face >= chunk->num_faces) {
+			face -= chunk->num_faces;
+			continue;
+		}
+
+		const Mesh *mesh = acquire_chunk(chunk);
+		if(!mesh) {
+			break;
+		}
+		Vector3 res = mesh->sample();
+		release_chunk(chunk);
+		return res;
+	}
+	return (geom->bounds.min + geom->bounds.max) / 2.0;
+}
+
+/* the chunks of an emitter are picked by area and then sample their faces
+ * with alias tables. Every light sample would page its chunk in, which
+ * thrashes the cache when the intersections need the rest of it, so the
+ * emitter chunks are mapped here and kept pinned, outside the cap. A chunk
+ * that fails to map is left to be paged in like the others, and builds its
+ * tables whenever it is.
+ */
+void PagedMesh::prepare_light_sampling() {
+	if(!geom) {
+		return;
+	}
+
+	geom->area = 0.0;
+	geom->area_cdf.clear();
+	for(size_t i=0; i<geom->chunks.size(); i++) {
+		GeomChunk *chunk = geom->chunks[i];
+		geom->area_cdf.push_back(geom->area += chunk->area);
+
+		lock_cache();
+		if(chunk->kept) {
+			unlock_cache();
+			continue;
+		}
+		Mesh *mesh = chunk_mesh(chunk);
+		if(mesh) {
+			if(!chunk->emissive) {
+				mesh->prepare_light_sampling();
+			}
+			lru_unlink(chunk);
+			resident -= chunk->size;
+		} else {
+			mesh = new Mesh;
+			if(!map_binary_mesh(mesh, chunk->fname)) {
+				delete mesh;
+				chunk->emissive = true;
+				page_in_failures++;
+				unlock_cache();
+				continue;
+			}
+			mesh->prepare_light_sampling();
+			set_chunk_mesh(chunk, mesh);
+			page_ins++;
+		}
+		chunk->emissive = true;
+		chunk->kept = true;
+		pin_chunk(chunk);
+		kept_resident += chunk->size;
+		unlock_cache();
+	}
+}
+
+bool PagedMesh::sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const {
+	if(!sample_surface(u, v, ls)) {
+		return false;
+	}
+	ls->radiance = material.ke;
+	ls->pdf = area_to_solid_angle(ref, ls->pos, ls->normal, geom->area);
+	return ls->pdf > 0.0;
+}
+
+double PagedMesh::light_pdf(const Vector3 &ref, const IntInfo &hit) const {
+	if(!geom || geom->area_cdf.empty() || geom->area <= 0.0) {
+		return 0.0;
+	}
+	return area_to_solid_angle(ref, hit.i_point, hit.geom_normal, geom->area);
+}
+
+/* picks a chunk by area with u, rescaled to [0, 1) within it, and leaves
+ * the rest to the chunk mesh, which is paged in if needed
+ */
+bool PagedMesh::sample_surface(double u, double v, LightSample *ls) const {
+	if(!geom || geom->area_cdf.empty() || geom->area <= 0.0) {
+		return false;
+	}
+
+	double x = u * geom->area;
+	int idx = (int)(std::upper_bound(geom->area_cdf.begin(), geom->area_cdf.end(), x) -
+			geom->area_cdf.begin());
+	idx = MIN(idx, (int)geom->chunks.size() - 1);
+
+	GeomChunk *chunk = geom->chunks[idx];
+	if(chunk->area <= 0.0) {
+		return false;
+	}
+	double start = idx ? geom->area_cdf[idx - 1] : 0.0;
+	u = MIN(MAX((x - start) / chunk->area, 0.0), 1.0);
+
+	const Mesh *mesh = acquire_chunk(chunk);
+	if(!mesh) {
+		return false;
+	}
+	bool res = mesh->sample_surface(u, v, ls);
+	release_chunk(chunk);
+
+	ls->pdf = 1.0 / geom->area;
+	return res;
+}
+
+double PagedMesh::light_power() const {
+	if(!geom) {
+		return 0.0;
+	}
+	return (material.ke.x + material.ke.y + material.ke.z) / 3.0 * M_PI * geom->area;
+}
+
+PagedMesh *create_paged_mesh(const Mesh *mesh) {
+	int prim = mesh->get_primitive();
+	int num_faces = mesh->get_face_count();
+	const float *vpos = mesh->get_vertex_data();
+	const uint32_t *indices = mesh->get_index_data();
+
+	if(!num_faces) {
+		return 0;
+	}
+
+	std::vector<Vector3> centroids(num_faces);
+	std::vector<int> faces(num_faces);
+	for(int i=0; i<num_faces; i++) {
+		Vector3 c(0, 0, 0);
+		for(int j=0; j<prim; j++) {
+			const float *v = vpos + indices[i * prim + j] * 3;
+			c += Vector3(v[0], v[1], v[2]);
+		}
+		centroids[i] = c / (double)prim;
+		faces[i] = i;
+	}
+
+	std::vector<int> range_sizes;
+	split_faces(centroids, &faces[0], num_faces, range_sizes);
+
+	PagedGeometry *geom = new PagedGeometry;
+	geom->num_faces = num_faces;
+	geom->area = 0.0;
+	geom->ref_count = 1;
+	geom->bounds.min = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	geom->bounds.max = Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	PagedMesh *pmesh = new PagedMesh;
+	pmesh->geom = geom;
+
+	std::vector<int> remap(mesh->get_vertex_count(), -1);
+	const int *range = &faces[0];
+
+	for(size_t i=0; i<range_sizes.size(); i++) {
+		GeomChunk *chunk = new GeomChunk;
+		chunk->fname[0] = 0;
+		chunk->mesh = 0;
+		chunk->pins = 0;
+		chunk->referenced = 0;
+		chunk->emissive = false;
+		chunk->kept = false;
+		chunk->lru_prev = chunk->lru_next = 0;
+		geom->chunks.push_back(chunk);
+
+		if(!write_chunk(mesh, range, range_sizes[i], remap, chunk)) {
+			delete pmesh;
+			return 0;
+		}
+		range += range_sizes[i];
+
+		BBox *gb = &geom->bounds;
+		gb->min = Vector3(MIN(gb->min.x, chunk->bounds.min.x), MIN(gb->min.y, chunk->bounds.min.y),
+				MIN(gb->min.z, chunk->bounds.min.z));
+		gb->max = Vector3(MAX(gb->max.x, chunk->bounds.max.x), MAX(gb->max.y, chunk->bounds.max.y),
+				MAX(gb->max.z, chunk->bounds.max.z));
+	}
+
+	std::vector<int> chunk_idx(geom->chunks.size());
+	for(size_t i=0; i<chunk_idx.size(); i++) {
+		chunk_idx[i] = (int)i;
+	}
+	build_chunk_tree(geom, &chunk_idx[0], (int)chunk_idx.size());
+
+	pmesh->calc_bbox();
+	return pmesh;
+}
@@ -0,0 +1,74 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef PAGEDMESH_H_
+#define PAGEDMESH_H_
+
+#include <stddef.h>
+#include "bbox.h"
+#include "mesh.h"
+#include "object.h"
+
+/* out-of-core meshes: the geometry of a mesh is split in spatially coherent
+ * chunks, which are written as binary meshes to the cache directory and only
+ * mapped while rays that reach their bounds need them. Mapped chunks are
+ * evicted least recently used first, to keep the mapped geometry under the
+ * memory cap.
+ */
+
+/* enables out-of-core meshes, with a cap in bytes for the mapped chunks. The
+ * chunk files go to dir, or the temporary directory if dir is null.
+ */
+void enable_geom_paging(size_t mem_cap, const char *dir);
+bool geom_paging_enabled();
+void print_geom_paging_stats();
+
+struct PagedGeometry;
+
+class PagedMesh : public Object {
+private:
+	PagedGeometry *geom;
+
+public:
+	PagedMesh();
+	virtual ~PagedMesh();
+
+	/* use the chunks of another paged mesh */
+	void share_data(const PagedMesh *pmesh);
+
+	virtual bool intersection(const Ray &ray, IntInfo *i_info) const;
+	virtual void calc_bbox();
+	virtual Vector3 sample() const;
+	virtual void prepare_light_sampling();
+	virtual bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+	virtual double light_pdf(const Vector3 &ref, const IntInfo &hit) const;
+	virtual bool sample_surface(double u, double v, LightSample *ls) const;
+	virtual double light_power() const;
+
+	friend PagedMesh *create_paged_mesh(const Mesh *mesh);
+};
+
+/* splits mesh in chunks and writes them to the cache directory, returns null
+ * on failure. The mesh itself can be deleted afterwards.
+ */
+PagedMesh *create_paged_mesh(const Mesh *mesh);
+
+#endif
@@ -0,0 +1,359 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <algorithm>
+#include "pathguide.h"
+#include "config.h"
+
+static inline double vcomp(const Vector3 &v, int idx)
+{
+	return idx == 0 ? v.x : (idx == 1 ? v.y : v.z);
+}
+
+/* point of the unit square of the direction dir, and back */
+static inline void dir_to_square(const Vector3 &dir, double *x, double *y)
+{
+	double cos_theta = std::max(-1.0, std::min((double)dir.z, 1.0));
+	double phi = atan2((double)dir.y, (double)dir.x);
+	if(phi < 0.0) {
+		phi += 2.0 * M_PI;
+	}
+	*x = std::min((cos_theta + 1.0) * 0.5, 1.0 - 1e-9);
+	*y = std::min(phi / (2.0 * M_PI), 1.0 - 1e-9);
+}
+
+static inline Vector3 square_to_dir(double x, double y)
+{
+	double cos_theta = 2.0 * x - 1.0;
+	double sin_theta = sqrt(std::max(0.0, 1.0 - cos_theta * cos_theta));
+	double phi = 2.0 * M_PI * y;
+	return Vector3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+}
+
+/* the quadrant of a node that x, y fall in, which is then rescaled to the
+ * square of the quadrant
+ */
+static inline int quadrant(double *x, double *y)
+{
+	int q = 0;
+	if(*x >= 0.5) {
+		q |= 1;
+		*x -= 0.5;
+	}
+	if(*y >= 0.5) {
+		q |= 2;
+		*y -= 0.5;
+	}
+	*x *= 2.0;
+	*y *= 2.0;
+	return q;
+}
+
+DirTree::DirTree()
+{
+	DirNode root;
+	for(int i=0; i<4; i++) {
+		root.sum[i] = 0.0f;
+		root.child[i] = 0;
+	}
+	nodes.push_back(root);
+	num_samples = 0;
+}
+
+void DirTree::record(const Vector3 &dir, float value)
+{
+	double x, y;
+	dir_to_square(dir, &x, &y);
+
+	int idx = 0;
+	for(;;) {
+		int q = quadrant(&x, &y);
+		float *sum = &nodes[idx].sum[q];
+		#pragma omp atomic
+		*sum += value;
+
+		if(!(idx = nodes[idx].child[q])) {
+			break;
+		}
+	}
+
+	#pragma omp atomic
+	num_samples++;
+}
+
+unsigned int DirTree::get_sample_count() const
+{
+	return num_samples;
+}
+
+void DirTree::set_sample_count(unsigned int count)
+{
+	num_samples = count;
+}
+
+size_t DirTree::get_node_count() const
+{
+	return nodes.size();
+}
+
+double DirTree::total() const
+{
+	const float *sum = nodes[0].sum;
+	return (double)sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+double DirTree::pdf(const Vector3 &dir) const
+{
+	double x, y;
+	dir_to_square(dir, &x, &y);
+
+	// each level scales the density of the square by 4 * the share of the quadrant
+	double p = 1.0;
+	int idx = 0;
+	for(;;) {
+		const DirNode &node = nodes[idx];
+		double tot = (double)node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+		if(tot <= 0.0) {
+			break;
+		}
+		int q = quadrant(&x, &y);
+		p *= 4.0 * node.sum[q] / tot;
+
+		if(!(idx = node.child[q])) {
+			break;
+		}
+	}
+	return p / (4.0 * M_PI);
+}
+
+Vector3 DirTree::sample(double u, double v) const
+{
+	double x = 0.0, y = 0.0;
+	double size = 1.0;
+
+	int idx = 0;
+	for(;;) {
+		const DirNode &node = nodes[idx];
+		const float *sum = node.sum;
+		double tot = (double)sum[0] + sum[1] + sum[2] + sum[3];
+		if(tot <= 0.0) {
+			break;
+		}
+
+		/* the column of the quadrant with u, and the quadrant in it with
+		 * v, rescaling each to [0, 1) within the choice.
+		 */
+		int q = 0;
+		double left = ((double)sum[0] + sum[2]) / tot;
+		if(u < left) {
+			u /= left;
+		} else {
+			q = 1;
+			u = (u - left) / (1.0 - left);
+		}
+		double col = (double)sum[q] + sum[q + 2];
+		double bottom = col > 0.0 ? sum[q] / col : 0.5;
+		if(v < bottom) {
+			v /= bottom;
+		} else {
+			q |= 2;
+			v = (v - bottom) / (1.0 - bottom);
+		}
+		u = std::min(u, 1.0 - 1e-9);
+		v = std::min(v, 1.0 - 1e-9);
+
+		size *= 0.5;
+		x += (q & 1) ? size : 0.0;
+		y += (q & 2) ? size : 0.0;
+
+		if(!(idx = node.child[q])) {
+			break;
+		}
+	}
+	return square_to_dir(x + u * size, y + v * size);
+}
+
+/* adds the node of the region of stats node snode (-1 if stats doesn't go
+ * that deep), which has frac of the light of stats, and returns its index.
+ */
+int DirTree::refine_node(const DirTree &stats, int snode, double frac, double thres, int depth,
+		int max_depth, bool grow)
+{
+	int idx = (int)nodes.size();
+	DirNode node;
+	for(int i=0; i<4; i++) {
+		node.sum[i] = 0.0f;
+		node.child[i] = 0;
+	}
+	nodes.push_back(node);
+
+	double tot = 0.0;
+	if(snode >= 0) {
+		const float *sum = stats.nodes[snode].sum;
+		tot = (double)sum[0] + sum[1] + sum[2] + sum[3];
+	}
+
+	for(int i=0; i<4; i++) {
+		// quadrants without statistics of their own get an equal share
+		double qfrac = tot > 0.0 ? frac * stats.nodes[snode].sum[i] / tot : frac * 0.25;
+		int schild = snode >= 0 && stats.nodes[snode].child[i] ? stats.nodes[snode].child[i] : -1;
+
+		if(qfrac > thres && depth < max_depth && (grow || schild >= 0)) {
+			int child = refine_node(stats, schild, qfrac, thres, depth + 1, max_depth, grow);
+			nodes[idx].child[i] = child;
+		}
+	}
+	return idx;
+}
+
+void DirTree::refine(const DirTree &stats, double thres, int max_depth, bool grow)
+{
+	nodes.clear();
+	num_samples = 0;
+
+	refine_node(stats, stats.total() > 0.0 ? 0 : -1, 1.0, thres, 1, max_depth, grow);
+}
+
+
+PathGuide::PathGuide(const BBox &bounds, size_t max_mem)
+{
+	this->bounds = bounds;
+	this->max_mem = max_mem;
+
+	SpatialNode root;
+	root.axis = 0;
+	root.child[0] = root.child[1] = -1;
+	root.dtree = 0;
+	snodes.push_back(root);
+
+	sampling.resize(1);
+	building.resize(1);
+}
+
+int PathGuide::find_region(const Vector3 &p) const
+{
+	double min[3], max[3];
+	for(int i=0; i<3; i++) {
+		min[i] = vcomp(bounds.min, i);
+		max[i] = vcomp(bounds.max, i);
+	}
+
+	int idx = 0;
+	while(snodes[idx].child[0] >= 0) {
+		const SpatialNode &node = snodes[idx];
+		double mid = (min[node.axis] + max[node.axis]) * 0.5;
+		if(vcomp(p, node.axis) < mid) {
+			max[node.axis] = mid;
+			idx = node.child[0];
+		} else {
+			min[node.axis] = mid;
+			idx = node.child[1];
+		}
+	}
+	return snodes[idx].dtree;
+}
+
+const DirTree *PathGuide::get_distribution(int region) const
+{
+	const DirTree *dist = &sampling[region];
+	return dist->total() > 0.0 ? dist : 0;
+}
+
+void PathGuide::record(int region, const Vector3 &dir, double radiance, double pdf)
+{
+	// paths that found no light count towards splitting the region as well
+	double value = radiance / pdf;
+	if(pdf > 0.0 && value >= 0.0 && value < HUGE_VAL) {
+		building[region].record(dir, (float)value);
+	}
+}
+
+/* splits the leaf node in half while the samples of its region are more
+ * than thres. The halves start with the statistics of the whole.
+ */
+void PathGuide::split(int node, unsigned int thres)
+{
+	int region = snodes[node].dtree;
+	unsigned int count = building[region].get_sample_count();
+	if(count <= thres || get_memory_usage() > max_mem) {
+		return;
+	}
+
+	int axis = snodes[node].axis;
+	building[region].set_sample_count(count / 2);
+	sampling.push_back(sampling[region]);
+	building.push_back(building[region]);
+
+	SpatialNode child;
+	child.axis = (axis + 1) % 3;
+	child.child[0] = child.child[1] = -1;
+
+	int left = (int)snodes.size();
+	child.dtree = region;
+	snodes.push_back(child);
+	child.dtree = (int)building.size() - 1;
+	snodes.push_back(child);
+
+	snodes[node].child[0] = left;
+	snodes[node].child[1] = left + 1;
+	snodes[node].dtree = -1;
+
+	split(left, thres);
+	split(left + 1, thres);
+}
+
+void PathGuide::refine(int pass)
+{
+	// the regions are split more finely as the sample counts double
+	unsigned int thres = (unsigned int)(GUIDE_SPATIAL_THRES * sqrt(pow(2.0, pass)));
+
+	int num_nodes = (int)snodes.size();
+	for(int i=0; i<num_nodes; i++) {
+		if(snodes[i].child[0] < 0) {
+			split(i, thres);
+		}
+	}
+
+	/* the light recorded by this pass is sampled from in the next, which
+	 * records into trees laid out for it. Past the memory cap the trees
+	 * may only lose nodes.
+	 */
+	bool grow = get_memory_usage() < max_mem;
+	for(size_t i=0; i<building.size(); i++) {
+		sampling[i] = building[i];
+		building[i].refine(sampling[i], GUIDE_DIR_THRES, GUIDE_DIR_MAX_DEPTH, grow);
+	}
+}
+
+int PathGuide::get_region_count() const
+{
+	return (int)building.size();
+}
+
+size_t PathGuide::get_memory_usage() const
+{
+	size_t sz = snodes.size() * sizeof(SpatialNode);
+	for(size_t i=0; i<building.size(); i++) {
+		sz += (sampling[i].get_node_count() + building[i].get_node_count()) * sizeof(DirNode);
+	}
+	return sz;
+}
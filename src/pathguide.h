@@ -0,0 +1,119 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef PATHGUIDE_H_
+#define PATHGUIDE_H_
+
+#include <stddef.h>
+#include <vector>
+#include "bbox.h"
+#include "vector.h"
+
+struct DirNode {
+	float sum[4];		// light arriving through each quadrant
+	int child[4];		// node of each quadrant, 0 for leaves
+};
+
+/* distribution of the light arriving at a region of space over the
+ * directions: a quadtree over the square of the cylindrical coordinates
+ * (cos theta, phi) of the unit sphere, which keeps solid angles. Quadrants
+ * that receive more light are subdivided more finely.
+ */
+class DirTree {
+private:
+	std::vector<DirNode> nodes;
+	unsigned int num_samples;
+
+	int refine_node(const DirTree &stats, int snode, double frac, double thres, int depth,
+			int max_depth, bool grow);
+
+public:
+	DirTree();
+
+	/* adds value to the quadrants of dir, can be called from many threads */
+	void record(const Vector3 &dir, float value);
+
+	unsigned int get_sample_count() const;
+	void set_sample_count(unsigned int count);
+	size_t get_node_count() const;
+
+	double total() const;
+	/* solid angle pdf of sample() picking dir */
+	double pdf(const Vector3 &dir) const;
+	/* picks a direction with the uniform numbers u, v */
+	Vector3 sample(double u, double v) const;
+
+	/* replaces this tree with an empty one, laid out for the distribution
+	 * stats: quadrants with more than thres of the light of stats are
+	 * subdivided, up to max_depth levels, the rest are merged. If grow is
+	 * false no quadrant that stats doesn't have is added.
+	 */
+	void refine(const DirTree &stats, double thres, int max_depth, bool grow);
+};
+
+struct SpatialNode {
+	int axis;		// split at the middle of this axis
+	int child[2];		// -1 for leaves
+	int dtree;		// directional trees of leaves
+};
+
+/* path guiding, after Mueller et al., "Practical Path Guiding for Efficient
+ * Light-Transport Simulation", 2017. A binary tree over the scene holds the
+ * directional distribution of the light arriving at each of its regions,
+ * learned from the paths of training passes of doubling sample counts: each
+ * pass records into a fresh set of directional trees, while sampling from
+ * those the previous pass learned. Between passes the regions that received
+ * many samples are split, and the directional trees are refined to follow
+ * the light they received.
+ */
+class PathGuide {
+private:
+	BBox bounds;
+	std::vector<SpatialNode> snodes;
+	std::vector<DirTree> sampling, building;
+	size_t max_mem;
+
+	void split(int node, unsigned int thres);
+
+public:
+	PathGuide(const BBox &bounds, size_t max_mem);
+
+	/* the region of the point p */
+	int find_region(const Vector3 &p) const;
+
+	/* the distribution learned for region, or 0 if there isn't one yet */
+	const DirTree *get_distribution(int region) const;
+
+	/* records radiance arriving at region from dir, sampled with the
+	 * solid angle pdf pdf. Can be called from many threads.
+	 */
+	void record(int region, const Vector3 &dir, double radiance, double pdf);
+
+	/* ends a training pass: subdivides the regions and directional trees
+	 * with what the pass learned, which later passes sample from.
+	 */
+	void refine(int pass);
+
+	int get_region_count() const;
+	size_t get_memory_usage() const;
+};
+
+#endif
@@ -0,0 +1,359 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <algorithm>
+#include "photonmap.h"
+#include "brdf.h"
+#include "config.h"
+#include "envlight.h"
+#include "sampler.h"
+#include "scene.h"
+
+struct PhotonLess {
+	int axis;
+
+	bool operator ()(const Photon &a, const Photon &b) const
+	{
+		return a.pos[axis] < b.pos[axis];
+	}
+};
+
+/* the nearest photons found so far, as a max heap of their squared
+ * distances
+ */
+struct PhotonMap::NearQuery {
+	double pos[3];
+	Vector3 normal;
+	int found;
+	double max_dist_sq;
+	std::pair<double, int> heap[PHOTON_LOOKUP];
+};
+
+PhotonMap::PhotonMap()
+{
+	max_dist = 0.0;
+}
+
+bool PhotonMap::build(Scene *scene, int num_photons, Sampler *smp)
+{
+	photons.clear();
+
+	/* the lights emit photons in proportion to their power, from their
+	 * surface or, for point lights with an intensity, from their position
+	 */
+	std::vector<const Object*> lights;
+	std::vector<bool> point;
+	std::vector<double> cdf;
+	double total = 0.0;
+
+	for(size_t i=0; i<scene->lights.size(); i++) {
+		const Object *light = scene->lights[i];
+		LightSample ls;
+		double power = light->light_power();
+		if(power <= 0.0) {
+			continue;
+		}
+		if(light->sample_surface(0.5, 0.5, &ls)) {
+			point.push_back(false);
+		} else if(light->sample_light(Vector3(0, 0, 0), 0.5, 0.5, &ls) && ls.delta && ls.falloff) {
+			point.push_back(true);
+		} else {
+			return false;
+		}
+		lights.push_back(light);
+		cdf.push_back(total += power);
+	}
+
+	BBox bounds = scene->get_bounds();
+	max_dist = length(bounds.max - bounds.min) * PHOTON_MAX_DIST;
+
+	/* the environment light shines on the scene through the disk of its
+	 * bounding sphere facing each direction
+	 */
+	const EnvLight *env = scene->get_env();
+	Vector3 center = (bounds.min + bounds.max) / 2.0;
+	double radius = length(bounds.max - bounds.min) / 2.0;
+	if(env && env->light_power() > 0.0 && radius > 0.0) {
+		lights.push_back(env);
+		point.push_back(false);
+		cdf.push_back(total += env->light_power() * M_PI * radius * radius);
+	}
+
+	if(lights.empty() || num_photons <= 0) {
+		return true;
+	}
+
+	for(int i=0; i<num_photons; i++) {
+		smp->start_sample(-1, -1, i, 0);
+
+		/* the light with u, then a side of its surface with what's left of
+		 * it, as surfaces emit from both sides.
+		 */
+		double u = smp->next_1d() * total;
+		int idx = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+		idx = std::min(idx, (int)lights.size() - 1);
+		double prev = idx ? cdf[idx - 1] : 0.0;
+		double sel_prob = (cdf[idx] - prev) / total;
+		u = (u - prev) / (cdf[idx] - prev);
+
+		double su, sv, du, dv;
+		smp->next_2d(&su, &sv);
+		smp->next_2d(&du, &dv);
+
+		LightSample ls;
+		Color power;
+		Vector3 n, dir;
+		double pdf;
+		Ray ray;
+
+		if(lights[idx] == env) {
+			/* a direction of the environment with du, dv, and a point of
+			 * the disk facing it with su, sv: power = L * disk area / pdf
+			 */
+			if(!env->sample_light(center, du, dv, &ls)) {
+				continue;
+			}
+			Basis basis;
+			make_basis(-ls.normal, &basis);
+			double r = sqrt(su);
+			double phi = 2.0 * M_PI * sv;
+
+			ray.origin = center + (basis.z + basis.x * (r * cos(phi)) + basis.y * (r * sin(phi))) * radius;
+			ray.dir = ls.normal * RAY_MAG;
+			power = ls.radiance * (M_PI * radius * radius / (ls.pdf * sel_prob * num_photons));
+		} else if(point[idx]) {
+			/* a uniform direction with du, dv: the intensity ke over the
+			 * whole sphere is a power of 4pi ke
+			 */
+			if(!lights[idx]->sample_light(Vector3(0, 0, 0), su, sv, &ls)) {
+				continue;
+			}
+			double z = 1.0 - 2.0 * du;
+			double r = sqrt(std::max(1.0 - z * z, 0.0));
+			double phi = 2.0 * M_PI * dv;
+			dir = Vector3(r * cos(phi), r * sin(phi), z);
+
+			power = ls.radiance * (4.0 * M_PI / (sel_prob * num_photons));
+			ray.origin = ls.pos;
+			ray.dir = dir * RAY_MAG;
+		} else {
+			if(!lights[idx]->sample_surface(su, sv, &ls)) {
+				continue;
+			}
+			n = u < 0.5 ? ls.normal : -ls.normal;
+
+			// cosine weighted emission: power = ke * cos / (pdf_area * cos / pi) * 2 sides
+			power = lights[idx]->get_material()->ke *
+				(2.0 * M_PI / (ls.pdf * sel_prob * num_photons));
+
+			dir = sample_lambert(n, du, dv, &pdf);
+			ray.origin = offset_ray_origin(ls.pos, n, dir);
+			ray.dir = dir * RAY_MAG;
+		}
+
+		for(int depth=0; depth<PHOTON_MAX_BOUNCES; depth++) {
+			IntInfo hit;
+			if(!scene->intersection(ray, &hit)) {
+				break;
+			}
+			const Material *mat = hit.object->get_material();
+
+			dir = normalize(ray.dir);
+			n = hit.normal;
+			if(dot(n, dir) > 0.0) {
+				n = -n;
+			}
+
+			double avg_diff = (mat->kd.x + mat->kd.y + mat->kd.z) / 3.0;
+			double avg_spec = (mat->ks.x + mat->ks.y + mat->ks.z) / 3.0;
+
+			// the direct light is left to the light samples
+			if(depth > 0 && avg_diff > 0.0) {
+				Photon ph;
+				ph.axis = 0;
+				ph.pos[0] = hit.i_point.x;
+				ph.pos[1] = hit.i_point.y;
+				ph.pos[2] = hit.i_point.z;
+				ph.dir[0] = dir.x;
+				ph.dir[1] = dir.y;
+				ph.dir[2] = dir.z;
+				ph.power[0] = power.x;
+				ph.power[1] = power.y;
+				ph.power[2] = power.z;
+				photons.push_back(ph);
+			}
+
+			/* russian roulette by the reflectances, like the bounces of
+			 * the paths
+			 */
+			double rnd = smp->next_1d();
+			double bu, bv;
+			smp->next_2d(&bu, &bv);
+
+			double range = std::max(avg_diff + avg_spec, 1.0);
+			rnd *= range;
+
+			Vector3 newdir;
+			if(rnd < avg_diff) {
+				newdir = sample_lambert(n, bu, bv, &pdf);
+				power = power * mat->kd * (range / avg_diff);
+			} else if(rnd < avg_diff + avg_spec) {
+				PhongLobe lobe;
+				make_phong_lobe(-dir, n, mat->specexp, &lobe);
+				newdir = sample_phong(lobe, bu, bv, &pdf);
+				double ndotd = dot(newdir, n);
+				if(ndotd <= 0.0) {
+					break;
+				}
+				power = power * mat->ks * ((mat->specexp + 2.0) / (mat->specexp + 1.0) * ndotd *
+						range / avg_spec);
+			} else {
+				break;
+			}
+
+			ray.origin = offset_ray_origin(hit.i_point, hit.geom_normal, newdir);
+			ray.dir = newdir * RAY_MAG;
+		}
+	}
+
+	build_tree(0, (int)photons.size());
+	return true;
+}
+
+int PhotonMap::get_photon_count() const
+{
+	return (int)photons.size();
+}
+
+/* balanced kd-tree in place: the median photon of each range splits it on
+ * the longest axis of the range, the two halves are its subtrees.
+ */
+void PhotonMap::build_tree(int start, int end)
+{
+	if(end - start < 2) {
+		return;
+	}
+
+	float min[3], max[3];
+	for(int i=0; i<3; i++) {
+		min[i] = max[i] = photons[start].pos[i];
+	}
+	for(int i=start + 1; i<end; i++) {
+		for(int j=0; j<3; j++) {
+			min[j] = std::min(min[j], photons[i].pos[j]);
+			max[j] = std::max(max[j], photons[i].pos[j]);
+		}
+	}
+
+	PhotonLess less;
+	less.axis = 0;
+	for(int i=1; i<3; i++) {
+		if(max[i] - min[i] > max[less.axis] - min[less.axis]) {
+			less.axis = i;
+		}
+	}
+
+	int mid = (start + end) / 2;
+	std::nth_element(photons.begin() + start, photons.begin() + mid, photons.begin() + end, less);
+	photons[mid].axis = less.axis;
+
+	build_tree(start, mid);
+	build_tree(mid + 1, end);
+}
+
+void PhotonMap::locate(int start, int end, NearQuery *q) const
+{
+	if(start >= end) {
+		return;
+	}
+	int mid = (start + end) / 2;
+	const Photon &ph = photons[mid];
+
+	// the side of the split the point is on first, the other if it's near enough
+	if(end - start > 1) {
+		double delta = q->pos[ph.axis] - ph.pos[ph.axis];
+		if(delta < 0.0) {
+			locate(start, mid, q);
+			if(delta * delta < q->max_dist_sq) {
+				locate(mid + 1, end, q);
+			}
+		} else {
+			locate(mid + 1, end, q);
+			if(delta * delta < q->max_dist_sq) {
+				locate(start, mid, q);
+			}
+		}
+	}
+
+	double dx = q->pos[0] - ph.pos[0];
+	double dy = q->pos[1] - ph.pos[1];
+	double dz = q->pos[2] - ph.pos[2];
+	double dist_sq = dx * dx + dy * dy + dz * dz;
+	if(dist_sq >= q->max_dist_sq) {
+		return;
+	}
+	// only the photons arriving at the side of the surface that is lit
+	const Vector3 &n = q->normal;
+	if(ph.dir[0] * n.x + ph.dir[1] * n.y + ph.dir[2] * n.z >= 0.0) {
+		return;
+	}
+
+	std::pair<double, int> *heap = q->heap;
+	if(q->found < PHOTON_LOOKUP) {
+		heap[q->found++] = std::make_pair(dist_sq, mid);
+		std::push_heap(heap, heap + q->found);
+	} else {
+		std::pop_heap(heap, heap + PHOTON_LOOKUP);
+		heap[PHOTON_LOOKUP - 1] = std::make_pair(dist_sq, mid);
+		std::push_heap(heap, heap + PHOTON_LOOKUP);
+	}
+	if(q->found == PHOTON_LOOKUP) {
+		q->max_dist_sq = heap[0].first;
+	}
+}
+
+Color PhotonMap::irradiance(const Vector3 &p, const Vector3 &n) const
+{
+	NearQuery q;
+	q.pos[0] = p.x;
+	q.pos[1] = p.y;
+	q.pos[2] = p.z;
+	q.normal = n;
+	q.found = 0;
+	q.max_dist_sq = max_dist * max_dist;
+
+	locate(0, (int)photons.size(), &q);
+	if(!q.found) {
+		return Color(0, 0, 0);
+	}
+
+	// the power of the photons over the area of the disc they were found in
+	double sum[3] = {0, 0, 0};
+	for(int i=0; i<q.found; i++) {
+		const float *power = photons[q.heap[i].second].power;
+		sum[0] += power[0];
+		sum[1] += power[1];
+		sum[2] += power[2];
+	}
+	double area = M_PI * q.max_dist_sq;
+	return Color(sum[0] / area, sum[1] / area, sum[2] / area);
+}
@@ -0,0 +1,75 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef PHOTONMAP_H_
+#define PHOTONMAP_H_
+
+#include <vector>
+#include "color.h"
+#include "vector.h"
+
+class Sampler;
+class Scene;
+
+struct Photon {
+	float pos[3];
+	float dir[3];		// direction of travel
+	float power[3];
+	int axis;		// split axis of the kd-tree node of the photon
+};
+
+/* photon map of the indirect light (Jensen, "Realistic Image Synthesis
+ * Using Photon Mapping", 2001): photons shot from the lights of the scene
+ * are stored where they hit diffuse surfaces after their first bounce, in a
+ * kd-tree. The light they bring to a point is estimated from the nearest
+ * ones, which replaces tracing diffuse interreflection per pixel.
+ */
+class PhotonMap {
+private:
+	std::vector<Photon> photons;
+	double max_dist;
+
+	struct NearQuery;
+
+	void build_tree(int start, int end);
+	void locate(int start, int end, NearQuery *q) const;
+
+public:
+	PhotonMap();
+
+	/* shoots num_photons photons from the area lights, the point lights and
+	 * the environment light of scene, taking the random numbers of photon i
+	 * from sample i of smp. Returns false, leaving the map empty, if some
+	 * light can't emit photons: the map would miss its indirect light. That
+	 * is the case of the "l c()" point lights, which have no physical power.
+	 */
+	bool build(Scene *scene, int num_photons, Sampler *smp);
+
+	int get_photon_count() const;
+
+	/* irradiance at the point p of a surface with normal n, from the
+	 * nearest PHOTON_LOOKUP photons arriving at its side, within
+	 * PHOTON_MAX_DIST of the size of the scene.
+	 */
+	Color irradiance(const Vector3 &p, const Vector3 &n) const;
+};
+
+#endif
@@ -28,7 +28,7 @@ Plane::Plane() {
 	distance = 0;
 }
 
-Plane::Plane(const Vector3 &normal, double distance) {
+Plane::Plane(const Vector3 &normal, scalar_t distance) {
 	this->normal = normalize(normal);
 	this->distance = distance;
 }
@@ -38,7 +38,7 @@ bool Plane::intersection(const Ray &ray, IntInfo* inf) const {
 		return false;
 	}
 
-	double n_dot_dir = dot(ray.dir, normal);
+	scalar_t n_dot_dir = dot(ray.dir, normal);
 
 	if (fabs(n_dot_dir) < EPSILON) {
 		return false;
@@ -47,17 +47,19 @@ bool Plane::intersection(const Ray &ray, IntInfo* inf) const {
 	Vector3 v = normal * distance;
 	Vector3 vorigin = v - ray.origin;
 
-	double n_dot_vo = dot(vorigin, normal);
-	double t = n_dot_vo / n_dot_dir; 
+	scalar_t n_dot_vo = dot(vorigin, normal);
+	scalar_t t = n_dot_vo / n_dot_dir; 
 
-	if (t < EPSILON || t > 1.0) {
+	if (t <= 0.0 || t > 1.0) {
 		return false;
 	}
 
 	if (inf) {
 		inf->t = t;
 		inf->i_point = ray.origin + ray.dir * t;
-		inf->normal = normal;
+		// project back on the plane to remove the error accumulated along the ray
+		inf->i_point = inf->i_point - normal * (dot(inf->i_point, normal) - distance);
+		inf->normal = inf->geom_normal = normal;
 		inf->object = this;
 	}
 	return true;
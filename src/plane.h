@@ -28,10 +28,10 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 class Plane: public Object {
 private:
 	Vector3 normal;
-	double distance;
+	scalar_t distance;
 public:
 	Plane();
-	Plane(const Vector3 &normal, double distance);
+	Plane(const Vector3 &normal, scalar_t distance);
 	bool intersection(const Ray &ray, IntInfo* i_info) const;	
 	Vector3 sample() const;
 	void calc_bbox();
@@ -0,0 +1,78 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <string.h>
+#include <inttypes.h>
+#include "ray.h"
+
+/* ray origin offsetting based on:
+ * "A Fast and Robust Method for Avoiding Self-Intersection",
+ * Carsten Wachter and Nikolaus Binder
+ * Ray Tracing Gems, chapter 6, 2019
+ *
+ * The point is moved along the normal by a number of ulps, so the offset
+ * scales with the magnitude of each coordinate, and with it the rounding error
+ * of the intersection point. Near zero, where the ulps get too small, a tiny
+ * constant offset is used instead.
+ */
+#ifdef SINGLE_PRECISION
+typedef int32_t scalar_bits_t;
+
+#define OFFS_ORIGIN			(1.0f / 32.0f)
+#define OFFS_FLOAT_SCALE	(1.0f / 65536.0f)
+#define OFFS_INT_SCALE		256.0f
+#else
+typedef int64_t scalar_bits_t;
+
+/* the errors of the double precision intersection points are far below
+ * those of the single precision ones, but the mesh vertices are stored in
+ * single precision, so the offsets are kept a good margin above the double
+ * precision rounding.
+ */
+#define OFFS_ORIGIN			(1.0 / 32.0)
+#define OFFS_FLOAT_SCALE	(1.0 / 1073741824.0)
+#define OFFS_INT_SCALE		4194304.0
+#endif
+
+static inline scalar_t offset_ulps(scalar_t x, scalar_bits_t ulps)
+{
+	scalar_bits_t bits;
+
+	memcpy(&bits, &x, sizeof bits);
+	bits += x < 0 ? -ulps : ulps;
+	memcpy(&x, &bits, sizeof x);
+	return x;
+}
+
+static inline scalar_t offset_comp(scalar_t p, scalar_t n)
+{
+	if(fabs(p) < OFFS_ORIGIN) {
+		return p + OFFS_FLOAT_SCALE * n;
+	}
+	return offset_ulps(p, (scalar_bits_t)(OFFS_INT_SCALE * n));
+}
+
+Vector3 offset_ray_origin(const Vector3 &p, const Vector3 &ng, const Vector3 &dir)
+{
+	Vector3 n = dot(ng, dir) < 0.0 ? -ng : ng;
+	return Vector3(offset_comp(p.x, n.x), offset_comp(p.y, n.y), offset_comp(p.z, n.z));
+}
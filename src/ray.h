@@ -29,4 +29,10 @@ struct Ray {
 	Vector3 dir;
 };
 
+/* returns the origin for a ray leaving the surface point p (with geometric
+ * normal ng) in direction dir, offset just enough to not intersect the
+ * surface it starts on.
+ */
+Vector3 offset_ray_origin(const Vector3 &p, const Vector3 &ng, const Vector3 &dir);
+
 #endif
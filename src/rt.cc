@@ -31,15 +31,23 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "camera.h"
 #include "color.h"
 #include "config.h"
+#include "denoise.h"
+#include "envlight.h"
+#include "film.h"
 #include "intinfo.h"
 #include "light.h"
 #include "matrix.h"
 #include "object.h"
+#include "pagedmesh.h"
+#include "pathguide.h"
+#include "photonmap.h"
 #include "plane.h"
 #include "ray.h"
+#include "sampler.h"
 #include "scene.h"
 #include "sphere.h"
 #include "sphereflake.h"
+#include "timer.h"
 #include "vector.h"
 #include "vector.h"
 
@@ -51,29 +59,76 @@ int dbg_curx, dbg_cury;
 int width = 512;
 int height = 512;
 uint32_t *image;
+Film film;
 int rays_ppxl = 4;
-int pix_subdiv;
+int max_depth = MAX_DEPTH;
 double inv_gamma = 1.0;
 
 SDL_Surface *fbsurf;
 Scene scene;
+Sampler *sampler;
+PathGuide *guide;
+PhotonMap *photon_map;
+bool use_denoiser;
+
+/* with the denoiser, the linear colors of the pixels and the albedo, normal
+ * and depth of what their camera rays hit first, averaged over the samples
+ * in the film.
+ */
+float *frame;
+float *frame_albedo;
+float *frame_normal;
+float *frame_depth;
+bool guide_learn;
 bool use_sdl = true;
 
-Color trace(const Ray &ray, int depth);
-Color shade(const Ray &ray, IntInfo *min_info, int depth);
-Color avg_color(double pxl_width, double pxl_height, double x, double y, int depth);
-Vector3 reflect(const Vector3 &l, const Vector3 &n);
+/* the bounce a path takes at a surface point: the ray it continues with and
+ * the brdf * cos / pdf weight of its direction. The point, the shading
+ * normal there and the solid angle pdf of the direction are kept for
+ * weighting the lights the bounce finds against the light samples taken at
+ * that point. A pdf of 0 ends the path. diffuse marks the bounces that
+ * blur what they find, after which the photon map is good enough.
+ */
+struct Bounce {
+	Ray ray;
+	Color weight;
+	Vector3 pos;
+	Vector3 normal;
+	double pdf;
+	int region;	// path guiding region of pos, -1 without guiding
+	bool diffuse;
+};
+
+/* what the camera ray of a sample hits first, for the denoiser */
+struct FirstHit {
+	Color albedo;
+	Vector3 normal;
+	double depth;
+};
+
+Color trace(const Ray &ray, Sampler *smp, FirstHit *first);
+Color shade(const Ray &ray, IntInfo *min_info, const Bounce *bounce, Sampler *smp, Bounce *next);
+Color shade_env(const Ray &ray, const Bounce *bounce);
 
 void update();
 void cleanup();
 void render();
-void render_scanline(uint32_t *fb, int y);
+void render_scanline(int y, int first, int spp);
+void resolve_image(int y0, int y1);
+void finish_frame();
+bool write_aux_buffers();
+uint32_t pack_color(const Color &color);
+void train_guide(int passes);
 bool write_ppm(const char *fname, uint32_t *pixels, int width, int height);
-unsigned long get_msec();
-int calc_subdiv(int rays);
 
 int main(int argc, char **argv) {
 	bool scene_loaded = false;
+	const char *cache_dir = 0;
+	const char *sampler_name = "sobol";
+	const char *filter_name = "box";
+	int guide_passes = 0;
+	double guide_mem = GUIDE_MAX_MEM;
+	int num_photons = 0;
 
 	for (int i=1; i<argc; i++) {
 		// if we run with -nosdl, just render and exit
@@ -94,6 +149,89 @@ int main(int argc, char **argv) {
 			}
 			rays_ppxl = atoi(argv[i]);
 		}
+		else if (strcmp(argv[i], "-maxdepth") == 0) {
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-maxdepth should be followed by the maximum number of bounces\n");
+				return 1;
+			}
+			max_depth = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "-guide") == 0) {
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-guide should be followed by the number of path guiding training passes\n");
+				return 1;
+			}
+			guide_passes = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "-guidemem") == 0) {
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-guidemem should be followed by the path guiding memory cap in MB\n");
+				return 1;
+			}
+			guide_mem = atof(argv[i]);
+		}
+		else if (strcmp(argv[i], "-photons") == 0) {
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-photons should be followed by the number of photons to shoot\n");
+				return 1;
+			}
+			num_photons = atoi(argv[i]);
+		}
+		else if (strcmp(argv[i], "-denoise") == 0) {
+			use_denoiser = true;
+		}
+		else if (strcmp(argv[i], "-sampler") == 0) {
+			if (!argv[++i]) {
+				fprintf(stderr, "-sampler should be followed by random, sobol, halton or bluenoise\n");
+				return 1;
+			}
+			sampler_name = argv[i];
+		}
+		else if (strcmp(argv[i], "-filter") == 0) {
+			if (!argv[++i]) {
+				fprintf(stderr, "-filter should be followed by box, tent, gaussian or mitchell\n");
+				return 1;
+			}
+			filter_name = argv[i];
+		}
+		else if (strcmp(argv[i], "-memcap") == 0) {
+			// out-of-core meshes
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-memcap should be followed by the geometry memory cap in MB\n");
+				return 1;
+			}
+			if (scene_loaded) {
+				fprintf(stderr, "-memcap must come before the scene file\n");
+				return 1;
+			}
+			enable_geom_paging((size_t)(atof(argv[i]) * 1024.0 * 1024.0), cache_dir);
+		}
+		else if (strcmp(argv[i], "-cachedir") == 0) {
+			if (!argv[++i]) {
+				fprintf(stderr, "-cachedir should be followed by the geometry cache directory\n");
+				return 1;
+			}
+			cache_dir = argv[i];
+			if (geom_paging_enabled()) {
+				fprintf(stderr, "-cachedir must come before -memcap\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-lod") == 0) {
+			// mesh levels of detail
+			if (!argv[++i] || !isdigit(argv[i][0])) {
+				fprintf(stderr, "-lod should be followed by the largest error in pixels\n");
+				return 1;
+			}
+			if (scene_loaded) {
+				fprintf(stderr, "-lod must come before the scene file\n");
+				return 1;
+			}
+			scene.set_lod_error(atof(argv[i]));
+		}
+		else if (strcmp(argv[i], "-fulldetail") == 0) {
+			scene.set_full_detail(true);
+		}
 		else if (strcmp(argv[i], "-gamma") == 0) {
 			if (!argv[++i] || !isdigit(argv[i][0])) {
 				fprintf(stderr, "-gamma should be followrd by the desired output gamma\n");
@@ -110,13 +248,25 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	pix_subdiv = calc_subdiv(rays_ppxl);
-	printf("rays: %d  ->  subdiv: %d\n", rays_ppxl, pix_subdiv);
+	if (rays_ppxl < 1) {
+		rays_ppxl = 1;
+	}
+	if (!(sampler = create_sampler(sampler_name))) {
+		fprintf(stderr, "unknown sampler: %s\n", sampler_name);
+		return 1;
+	}
+	Filter *filter = create_filter(filter_name);
+	if (!filter) {
+		fprintf(stderr, "unknown filter: %s\n", filter_name);
+		return 1;
+	}
+	printf("rays: %d  (%s sampler, %s filter)\n", rays_ppxl, sampler_name, filter_name);
 
 	if (!scene_loaded) {
 		fprintf(stderr, "must specify a scene file\n");
 		return 1;
 	}
+	scene.select_detail(height);
 
 	if (use_sdl) {
 		SDL_Init(SDL_INIT_VIDEO);
@@ -128,24 +278,63 @@ int main(int argc, char **argv) {
 		SDL_WM_SetCaption("Eleni's Path Tracer", 0);
 	}
 
-	// allocate framebuffer
+	// allocate framebuffer, and the film the samples go to
 	image = new uint32_t[width * height];
 	memset(image, 0x0f, width * height * sizeof *image);
 
+	bool film_ok = film.create(width, height, filter);
+	delete filter;
+	if (!film_ok) {
+		fprintf(stderr, "failed to allocate the film\n");
+		return 1;
+	}
+
+	if (use_denoiser) {
+		frame = new float[width * height * 3];
+		frame_albedo = new float[width * height * 3];
+		frame_normal = new float[width * height * 3];
+		frame_depth = new float[width * height];
+	}
+
 	unsigned long start = get_msec();
 
+	if (num_photons > 0) {
+		photon_map = new PhotonMap;
+		sampler->set_seed(0);
+		if (!photon_map->build(&scene, num_photons, sampler)) {
+			fprintf(stderr, "some lights can't emit photons, not using the photon map\n");
+		} else {
+			printf("photon map: %d photons stored\n", photon_map->get_photon_count());
+		}
+		// the gather would lose the indirect light the map doesn't have
+		if (!photon_map->get_photon_count()) {
+			delete photon_map;
+			photon_map = 0;
+		}
+	}
+
+	if (guide_passes > 0) {
+		guide = new PathGuide(scene.get_bounds(), (size_t)(guide_mem * 1024.0 * 1024.0));
+		train_guide(guide_passes);
+	}
+
 	if(!use_sdl) {
 		render();
 
 		unsigned long msec = get_msec() - start;
 		printf("rendering completed in %lu msec\n", msec);
+		print_geom_paging_stats();
 
 		cleanup();
 		return 0;
 	}
 
+	/* the image is rendered over and over, each pass adding rays_ppxl
+	 * samples per pixel to the film.
+	 */
 	int next_scanline = 0;
-	
+	int pass = 0;
+
 	for(;;) {
 		SDL_Event ev;
 
@@ -183,14 +372,28 @@ int main(int argc, char **argv) {
 			}
 		}
 
-		if(next_scanline < height) {
-			render_scanline(image, next_scanline++);
+		int y = next_scanline++;
+		render_scanline(y, pass * rays_ppxl, rays_ppxl);
+
+		// the filter spreads the samples of the scanline to the ones around it
+		int reach = (int)ceil(film.get_radius());
+		resolve_image(y - reach, y + reach + 1);
+		update();
+
+		if(next_scanline == height) {
+			finish_frame();
 			update();
 
-			if(next_scanline == height) {
+			if(!pass) {
 				unsigned long msec = get_msec() - start;
 				printf("rendering completed in %lu msec\n", msec);
+				print_geom_paging_stats();
+			} else {
+				printf("refinement pass %d completed: %d samples per pixel\n", pass,
+						(pass + 1) * rays_ppxl);
 			}
+			pass++;
+			next_scanline = 0;
 		}
 	}
 
@@ -219,6 +422,13 @@ void update()
 
 void cleanup() {
 	delete [] image;
+	delete sampler;
+	delete guide;
+	delete photon_map;
+	delete [] frame;
+	delete [] frame_albedo;
+	delete [] frame_normal;
+	delete [] frame_depth;
 	SDL_Quit();
 }
 
@@ -241,61 +451,336 @@ void render() {
 		printf("] %d%%\r", progr);
 		fflush(stdout);
 
-		render_scanline(image, y);
+		render_scanline(y, 0, rays_ppxl);
 	}
 
 	putchar('\n');
 
+	resolve_image(0, height);
+	finish_frame();
+
 	if(!write_ppm("out.ppm", image, width, height)) {
 		fprintf(stderr, "failed to write image: out.ppm\n");
 	}
+	if(frame && !write_aux_buffers()) {
+		fprintf(stderr, "failed to write the denoiser buffers\n");
+	}
 }
 
+/* the training passes of path guiding, with 1, 2, 4, ... samples per pixel.
+ * Their samples are cleared from the film, and the next renders sample with
+ * different seeds.
+ */
+void train_guide(int passes) {
+	guide_learn = true;
 
-void render_scanline(uint32_t *fb, int y) {
-	fb += y * width;	// advance to the start of this scanline
+	for(int i=0; i<passes; i++) {
+		unsigned long start = get_msec();
 
-	// render each pixel of this scanline
-	for (int x = 0; x < width; x++) {
-		double xpos = 2.0 * ((double)x + 0.5) / (double)width - 1.0;
-		double ypos = 1.0 - 2.0 * ((double)y + 0.5) / (double)height;
+		sampler->set_seed(i + 1);
+		for(int y=0; y<height; y++) {
+			render_scanline(y, 0, 1 << i);
+		}
+		guide->refine(i);
 
-		double pxl_width =	2.0 / (double) width;
-		double pxl_height = 2.0 / (double) height;
-		
-		Color color = avg_color(pxl_width, pxl_height, xpos, ypos, pix_subdiv);
-		color.x = pow(color.x, inv_gamma);
-		color.y = pow(color.y, inv_gamma);
-		color.z = pow(color.z, inv_gamma);
+		printf("path guiding pass %d: %d spp, %d regions, %lu KB in %lu msec\n", i, 1 << i,
+				guide->get_region_count(), (unsigned long)(guide->get_memory_usage() / 1024),
+				get_msec() - start);
+	}
 
-		int r = (int)(color.x * 255.0);
-		int g = (int)(color.y * 255.0);
-		int b = (int)(color.z * 255.0);
+	film.clear();
+	sampler->set_seed(0);
+	guide_learn = false;
+}
 
-		if(r > 255) r = 255;
-		if(g > 255) g = 255;
-		if(b > 255) b = 255;
+/* adds the samples first to first + spp - 1 of each pixel of scanline y to
+ * the film.
+ */
+void render_scanline(int y, int first, int spp) {
+	/* the scanline is rendered as a single tile. The camera takes the
+	 * first two dimensions of each sample for the position in the pixel,
+	 * the paths carry on from the third.
+	 */
+	RayBatch batch;
+	scene.get_camera()->get_tile_rays(width, height, 0, y, width, 1, first, spp, sampler, &batch);
+
+	/* the pixels are shared among the threads, each sampling with its own
+	 * copy of the sampler.
+	 */
+	#pragma omp parallel
+	{
+		Sampler *smp = sampler->clone();
+
+		Ray ray;
+		ray.origin = batch.origin;
+
+		#pragma omp for schedule(dynamic)
+		for (int x = 0; x < width; x++) {
+			double aux[7] = {0, 0, 0, 0, 0, 0, 0};
+
+			for(int i=0; i<spp; i++) {
+				int idx = x * spp + i;
+				ray.dir = Vector3(batch.dir_x[idx], batch.dir_y[idx], batch.dir_z[idx]);
+
+				smp->start_sample(x, y, first + i, 2);
+				FirstHit hit;
+				Color c = trace(ray, smp, frame ? &hit : 0);
+				film.add_sample(batch.pos_x[idx], batch.pos_y[idx], c);
+
+				if(frame) {
+					aux[0] += hit.albedo.x;
+					aux[1] += hit.albedo.y;
+					aux[2] += hit.albedo.z;
+					aux[3] += hit.normal.x;
+					aux[4] += hit.normal.y;
+					aux[5] += hit.normal.z;
+					aux[6] += hit.depth;
+				}
+			}
+
+			// the first hits of the new samples join the average of the old
+			if(frame) {
+				int pix = y * width + x;
+				float keep = (float)first / (float)(first + spp);
+				float scale = 1.0f / (float)(first + spp);
+				for(int i=0; i<3; i++) {
+					frame_albedo[pix * 3 + i] = frame_albedo[pix * 3 + i] * keep + aux[i] * scale;
+					frame_normal[pix * 3 + i] = frame_normal[pix * 3 + i] * keep + aux[3 + i] * scale;
+				}
+				frame_depth[pix] = frame_depth[pix] * keep + aux[6] * scale;
+			}
+		}
 
-		fb[x] = ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
+		delete smp;
 	}
 }
 
-Color trace(const Ray &ray, int depth) {
-	if(!depth) {
-		return Color(0, 0, 0);
+/* gamma corrects the scanlines y0 to y1 - 1 of the film into the image */
+void resolve_image(int y0, int y1) {
+	if(y0 < 0) y0 = 0;
+	if(y1 > height) y1 = height;
+
+	for(int y=y0; y<y1; y++) {
+		for(int x=0; x<width; x++) {
+			image[y * width + x] = pack_color(film.get_pixel(x, y));
+		}
 	}
+}
 
-	IntInfo min_info;
-	bool isect = scene.intersection(ray, &min_info);
-	if (isect) {
-		return shade(ray, &min_info, depth);
+/* runs the denoiser over the finished image, when it's enabled */
+void finish_frame() {
+	if(!frame) {
+		return;
 	}
 
-	return Color(0, 0, 0);
+	unsigned long start = get_msec();
+
+	for(int y=0; y<height; y++) {
+		for(int x=0; x<width; x++) {
+			Color c = film.get_pixel(x, y);
+			float *pix = frame + (y * width + x) * 3;
+			pix[0] = c.x;
+			pix[1] = c.y;
+			pix[2] = c.z;
+		}
+	}
+	denoise(frame, frame_albedo, frame_normal, frame_depth, width, height, DENOISE_ITERATIONS);
+
+	for(int i=0; i<width * height; i++) {
+		image[i] = pack_color(Color(frame[i * 3], frame[i * 3 + 1], frame[i * 3 + 2]));
+	}
+	printf("denoising completed in %lu msec\n", get_msec() - start);
 }
 
-Color shade(const Ray &ray, IntInfo* min_info, int depth) {
-	
+/* writes the buffers the denoiser works with to albedo.ppm, normal.ppm
+ * (mapped from [-1, 1]) and depth.ppm (over the farthest hit).
+ */
+bool write_aux_buffers() {
+	int num = width * height;
+	uint32_t *pixels = new uint32_t[num];
+
+	for(int i=0; i<num; i++) {
+		const float *a = frame_albedo + i * 3;
+		pixels[i] = pack_color(Color(a[0], a[1], a[2]));
+	}
+	bool res = write_ppm("albedo.ppm", pixels, width, height);
+
+	for(int i=0; i<num; i++) {
+		const float *n = frame_normal + i * 3;
+		int r = (int)((n[0] * 0.5 + 0.5) * 255.0);
+		int g = (int)((n[1] * 0.5 + 0.5) * 255.0);
+		int b = (int)((n[2] * 0.5 + 0.5) * 255.0);
+		pixels[i] = ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
+	}
+	res = res && write_ppm("normal.ppm", pixels, width, height);
+
+	float far = 0.0f;
+	for(int i=0; i<num; i++) {
+		far = MAX(far, frame_depth[i]);
+	}
+	for(int i=0; i<num; i++) {
+		uint32_t d = far > 0.0f ? (uint32_t)(frame_depth[i] / far * 255.0f) : 0;
+		pixels[i] = (d << 16) | (d << 8) | d;
+	}
+	res = res && write_ppm("depth.ppm", pixels, width, height);
+
+	delete [] pixels;
+	return res;
+}
+
+/* gamma corrects a linear color and packs it into a framebuffer pixel */
+uint32_t pack_color(const Color &color) {
+	int r = (int)(pow(color.x, inv_gamma) * 255.0);
+	int g = (int)(pow(color.y, inv_gamma) * 255.0);
+	int b = (int)(pow(color.z, inv_gamma) * 255.0);
+
+	if(r > 255) r = 255;
+	if(g > 255) g = 255;
+	if(b > 255) b = 255;
+
+	return ((uint32_t) r << 16) | ((uint32_t) g << 8) | (uint32_t) b;
+}
+
+/* a bounce of a path that path guiding learns from: the light found after
+ * it, over the throughput of the path up to it, is the light that arrived
+ * from its direction.
+ */
+struct GuideVertex {
+	int region;
+	Vector3 dir;
+	double pdf;
+	Color throughput;
+	Color light;
+};
+
+static void learn_path(const GuideVertex *verts, int count);
+
+/* follows the path of ray for up to max_depth bounces, adding up the light
+ * shade() finds at each of them weighted by the throughput of the path so
+ * far. smp provides the random numbers of the path. If first isn't 0, it's
+ * filled with what ray hits.
+ */
+Color trace(const Ray &ray, Sampler *smp, FirstHit *first) {
+	Color color(0, 0, 0);
+	Color throughput(1, 1, 1);
+
+	Bounce bnc[2];
+	const Bounce *prev = 0;
+	Ray cur = ray;
+
+	GuideVertex verts[GUIDE_PATH_VERTICES];
+	int num_verts = 0;
+
+	if (first) {
+		first->albedo = Color(0, 0, 0);
+		first->normal = Vector3(0, 0, 0);
+		first->depth = 0.0;
+	}
+
+	for (int depth = 0; depth <= max_depth; depth++) {
+		// rays that miss everything end the path, with the environment light
+		IntInfo min_info;
+		bool hit = scene.intersection(cur, &min_info);
+		if (!hit && !scene.get_env()) {
+			break;
+		}
+
+		if (hit && first && depth == 0) {
+			first->albedo = min_info.object->get_material()->kd;
+			first->normal = dot(min_info.normal, ray.dir) > 0.0 ? -min_info.normal : min_info.normal;
+			first->depth = length(min_info.i_point - ray.origin);
+		}
+
+		Bounce *next = bnc + (depth & 1);
+		Color found = throughput * (hit ? shade(cur, &min_info, prev, smp, next) : shade_env(cur, prev));
+		color += found;
+
+		/* the bounces learn the light they bring in as weighted against
+		 * the light samples, so that guiding goes after the light that
+		 * the light samples miss.
+		 */
+		if (guide_learn) {
+			for (int i = 0; i < num_verts; i++) {
+				verts[i].light += found;
+			}
+		}
+
+		if (!hit) {
+			break;
+		}
+
+		/* russian roulette after RR_MIN_DEPTH bounces, going on with the
+		 * largest component of the throughput as the probability, so
+		 * that paths that can't add much end early. The number is
+		 * always drawn, to keep the dimensions of the later hits in place.
+		 */
+		double rr = smp->next_1d();
+		if (next->pdf <= 0.0) {
+			break;
+		}
+		throughput = throughput * next->weight;
+
+		if (depth >= RR_MIN_DEPTH) {
+			double q = MAX(throughput.x, MAX(throughput.y, throughput.z));
+			if (q < 1.0) {
+				if (rr >= q) {
+					break;
+				}
+				throughput = throughput / q;
+			}
+		}
+
+		if (guide_learn && next->region >= 0 && num_verts < GUIDE_PATH_VERTICES) {
+			GuideVertex *vert = verts + num_verts++;
+			vert->region = next->region;
+			vert->dir = normalize(next->ray.dir);
+			vert->pdf = next->pdf;
+			vert->throughput = throughput;
+			vert->light = Color(0, 0, 0);
+		}
+
+		cur = next->ray;
+		prev = next;
+	}
+
+	if (num_verts) {
+		learn_path(verts, num_verts);
+	}
+	return color;
+}
+
+static void learn_path(const GuideVertex *verts, int count) {
+	for (int i = 0; i < count; i++) {
+		const Color &t = verts[i].throughput;
+		const Color &l = verts[i].light;
+
+		double lum = 0.0;
+		lum += t.x > 0.0 ? l.x / t.x : 0.0;
+		lum += t.y > 0.0 ? l.y / t.y : 0.0;
+		lum += t.z > 0.0 ? l.z / t.z : 0.0;
+		guide->record(verts[i].region, verts[i].dir, lum / 3.0, verts[i].pdf);
+	}
+}
+
+/* power heuristic weight of a sample taken with pdf_a, against another
+ * strategy that would take it with pdf_b (Veach, "Robust Monte Carlo
+ * Methods for Light Transport Simulation", 1997).
+ */
+static inline double mis_weight(double pdf_a, double pdf_b) {
+	double a = pdf_a * pdf_a;
+	double b = pdf_b * pdf_b;
+	return a + b > 0.0 ? a / (a + b) : 0.0;
+}
+
+/* shading of the hits on materials of class mclass, with the terms of the
+ * lobes the class doesn't have compiled away. See shade().
+ */
+template <int mclass>
+static Color shade_material(const Ray &ray, IntInfo* min_info, const Bounce *bounce, Sampler *smp,
+		Bounce *next) {
+	const bool has_diffuse = mclass == MAT_DIFFUSE || mclass == MAT_MIXED;
+	const bool has_specular = mclass == MAT_GLOSSY || mclass == MAT_MIXED;
+
 	Vector3 n = min_info->normal;
 	
 	if ( dot(n, ray.dir) > 0 ) {
@@ -303,84 +788,273 @@ Color shade(const Ray &ray, IntInfo* min_info, int depth) {
 	}
 
 	Vector3 p = min_info->i_point;
+	Vector3 ng = min_info->geom_normal;
 	Vector3 v = normalize(ray.origin - p);
 
-	const Material *mat = min_info->object->get_material();
+	const Object *obj = min_info->object;
+	const Material *mat = obj->get_material();
 
-	Color color = scene.get_ambient() * mat->kd + mat->ke;
+	Color color(0, 0, 0);
+	if (has_diffuse) {
+		color = scene.get_ambient() * mat->kd;
+	}
 
-	for (int i = 0; i < (int)scene.lights.size(); i++) {
-		Object *light = scene.lights[i];
-		light->ignore = true;
+	/* emitters found by a bounce share the light they contribute with the
+	 * light samples of the previous hit, so that it's not counted twice.
+	 */
+	if (bounce && obj->is_light()) {
+		double lpdf = LIGHT_SAMPLES * scene.light_prob(bounce->pos, bounce->normal, obj) *
+			obj->light_pdf(bounce->pos, *min_info);
+		color += mat->ke * mis_weight(bounce->pdf, lpdf);
+	} else {
+		color += mat->ke;
+	}
 
-		Ray sray;
-		sray.origin = p;
-		sray.dir = light->sample() - p;
+	// nothing is reflected, the path ends here
+	next->pdf = 0.0;
+	if (!has_diffuse && !has_specular) {
+		return color;
+	}
 
-		if (!scene.intersection(sray, 0)) {
-			Vector3 l = normalize(sray.dir);
-			Vector3 lr = reflect(l, n); 
+	/* the bounce picks the diffuse or the specular lobe, by their average
+	 * reflectance. Paths are only ended by the roulette of trace().
+	 */
+	double avg_spec = has_specular ? (mat->ks.x + mat->ks.y + mat->ks.z) / 3 : 0.0;
+	double avg_diff = has_diffuse ? (mat->kd.x + mat->kd.y + mat->kd.z) / 3 : 0.0;
+
+	/* with a photon map, hits found by a diffuse bounce take the light
+	 * their diffuse lobe reflects from the photons instead of bouncing off
+	 * it again, and only the specular lobe goes on. The light samples still
+	 * bring in the direct light, unweighted, as no bounce can find it now.
+	 */
+	bool gather = has_diffuse && photon_map && bounce && bounce->diffuse;
+	if (gather) {
+		color += mat->kd / M_PI * photon_map->irradiance(p, n);
+		avg_diff = 0.0;
+	}
 
-			double d = dot(n, l);
-			if (d < 0.0) {
-				d = 0;
-			}
+	double range = avg_spec + avg_diff;
+	double prob_diff = range > 0.0 ? avg_diff / range : 0.0;
+	double prob_spec = range > 0.0 ? avg_spec / range : 0.0;
+
+	/* every hit takes the same dimensions of the sample, whatever happens
+	 * to the light samples and the bounce below: 3 for each light sample
+	 * (which light and the point on it), then 3 for the bounce (the lobe
+	 * and the direction).
+	 */
+	double light_rnd[LIGHT_SAMPLES][3];
+	for (int i = 0; i < LIGHT_SAMPLES; i++) {
+		light_rnd[i][0] = smp->next_1d();
+		smp->next_2d(light_rnd[i] + 1, light_rnd[i] + 2);
+	}
+	double lobe_rnd = smp->next_1d();
+	double dir_u, dir_v;
+	smp->next_2d(&dir_u, &dir_v);
+
+	/* with path guiding, GUIDE_FRACTION of the bounces sample the light
+	 * learned to arrive at p instead of the brdf. Both the bounce and the
+	 * light samples are then weighted with the pdf of the mix, over the
+	 * whole brdf.
+	 */
+	int region = guide ? guide->find_region(p) : -1;
+	const DirTree *dist = region >= 0 && range > 0.0 && !gather ? guide->get_distribution(region) : 0;
+
+	// the light samples and the bounce share the setup of the phong lobe
+	PhongLobe lobe;
+	if (has_specular) {
+		make_phong_lobe(v, n, mat->specexp, &lobe);
+	}
+	double spec_norm = has_specular ? (mat->specexp + 2.0) / (2.0 * M_PI) : 0.0;
+
+	/* direct lighting from LIGHT_SAMPLES lights, picked by their estimated
+	 * contribution. Area lights are weighted against the bounces by
+	 * multiple importance sampling, per lobe, with the energy conserving
+	 * lambert and phong brdfs.
+	 */
+	for (int i = 0; i < LIGHT_SAMPLES; i++) {
+		double sel_prob;
+		const Object *light = scene.sample_light(p, n, light_rnd[i][0], &sel_prob);
+		if (!light) {
+			break;
+		}
+		sel_prob *= LIGHT_SAMPLES;
 
-			double lrdotv = dot(lr, v);
-			if(lrdotv < 0.0) {
-				lrdotv = 0.0;
-			}
+		LightSample ls;
+		if (!light->sample_light(p, light_rnd[i][1], light_rnd[i][2], &ls)) {
+			continue;
+		}
 
-			double s = pow(lrdotv, mat->specexp);
-			Color light_color = light->get_material()->ke; 
-			color = color + (d * mat->kd + s * mat->ks) * light_color;
+		Ray sray;
+		sray.origin = offset_ray_origin(p, ng, ls.pos - p);
+		sray.dir = ls.pos - sray.origin;
+		if (!ls.delta) {
+			// stop short of the light surface itself
+			sray.dir = sray.dir * SHADOW_RAY_SCALE;
+		}
+
+		Vector3 l = normalize(sray.dir);
+		double d = dot(n, l);
+		if (d <= 0.0 || scene.intersection(sray, 0)) {
+			continue;
+		}
+
+		double s = has_specular ? phong(lobe, l) : 0.0;
+		Color light_color = ls.radiance;
+
+		if (ls.delta) {
+			/* point lights have no area to weight against the bounces. An
+			 * intensity falls off with the squared distance, the plain
+			 * colour of an "l c()" light keeps the old phong model.
+			 */
+			Color f(0, 0, 0);
+			if (ls.falloff) {
+				double dist_sq = dot(ls.pos - p, ls.pos - p);
+				if (has_diffuse) f += d / M_PI * mat->kd;
+				if (has_specular) f += spec_norm * s * d * mat->ks;
+				color += f * light_color / (sel_prob * dist_sq);
+			} else {
+				if (has_diffuse) f += d * mat->kd;
+				if (has_specular) f += s * mat->ks;
+				color += f * light_color / sel_prob;
+			}
+			continue;
 		}
 
-		light->ignore = false;
+		double lpdf = ls.pdf * sel_prob;
+		double diff_pdf = has_diffuse ? prob_diff * lambert_pdf(l, n) : 0.0;
+		double spec_pdf = has_specular ? prob_spec * phong_pdf(lobe, l) : 0.0;
+
+		if (dist) {
+			double bpdf = GUIDE_FRACTION * dist->pdf(l) + (1.0 - GUIDE_FRACTION) * (diff_pdf + spec_pdf);
+			double w = mis_weight(lpdf, bpdf) / lpdf;
+			Color f(0, 0, 0);
+			if (has_diffuse) f += d / M_PI * mat->kd;
+			if (has_specular) f += spec_norm * s * d * mat->ks;
+			color += f * light_color * w;
+			continue;
+		}
+		Color f(0, 0, 0);
+		if (has_diffuse) f += (d / M_PI * mis_weight(lpdf, diff_pdf) / lpdf) * mat->kd;
+		if (has_specular) f += (spec_norm * s * d * mis_weight(lpdf, spec_pdf) / lpdf) * mat->ks;
+		color += f * light_color;
 	}
 
-	/* russian roulette */
+	next->pos = p;
+	next->normal = n;
+	next->region = region;
+	next->diffuse = false;
 
-	double avg_spec = (mat->ks.x + mat->ks.y + mat->ks.z) / 3;
-	double avg_diff = (mat->kd.x + mat->kd.y + mat->kd.z) / 3;
 	Vector3 newdir;
+	double pdf;
+	double rnd = lobe_rnd;
+	if (dist) {
+		if (rnd < GUIDE_FRACTION) {
+			newdir = dist->sample(dir_u, dir_v);
+			rnd = -1.0;
+		} else {
+			rnd = (rnd - GUIDE_FRACTION) / (1.0 - GUIDE_FRACTION);
+		}
+	}
+	rnd *= range;
+
+	if (dist) {
+		// guided interaction, or either lobe of the brdf
+		if (has_diffuse && rnd >= 0.0 && rnd < avg_diff) {
+			newdir = sample_lambert(n, dir_u, dir_v, &pdf);
+			next->diffuse = true;
+		} else if (has_specular && rnd >= avg_diff) {
+			newdir = sample_phong(lobe, dir_u, dir_v, &pdf);
+		}
 
-	double range = MAX(avg_spec + avg_diff, 1.0);
-	double rnd = (double)rand() / RAND_MAX * range;
+		double ndotd = dot(newdir, n);
+		if (ndotd > 0.0) {
+			double phong_term = has_specular ? phong(lobe, newdir) : 0.0;
+			double diff_pdf = 0.0, spec_pdf = 0.0;
+			Color brdf(0, 0, 0);
+			if (has_diffuse) {
+				diff_pdf = prob_diff * lambert_pdf(newdir, n);
+				brdf += mat->kd / M_PI;
+			}
+			if (has_specular) {
+				spec_pdf = prob_spec * lobe.norm * phong_term;
+				brdf += mat->ks * (spec_norm * phong_term);
+			}
+			next->pdf = GUIDE_FRACTION * dist->pdf(newdir) + (1.0 - GUIDE_FRACTION) * (diff_pdf + spec_pdf);
 
-	if (rnd < avg_diff) {
-		// diffuse interaction
-		newdir = sample_lambert(n);
-		if ((double) rand() / RAND_MAX <= lambert(newdir, n)) {
-			Ray newray;
-			newray.origin = p;
-			newray.dir = newdir * RAY_MAG;
-			color += trace(newray, depth - 1) * mat->kd / avg_diff;
+			/* a guided bounce counts as diffuse, for the photon map, where
+			 * the diffuse lobe is the likelier of the two to have taken it
+			 */
+			if (rnd < 0.0) {
+				next->diffuse = diff_pdf > 0.0 && diff_pdf >= spec_pdf;
+			}
+
+			if (next->pdf > 0.0) {
+				next->weight = brdf * (ndotd / next->pdf);
+			}
 		}
 	}
-	else if (rnd < avg_diff + avg_spec) {
+	else if (has_diffuse && rnd < avg_diff) {
+		// diffuse interaction
+		newdir = sample_lambert(n, dir_u, dir_v, &pdf);
+		next->diffuse = true;
+
+		// the cosine cancels out of brdf * cos / pdf = (kd / pi) * cos / (prob_diff * cos / pi)
+		next->pdf = prob_diff * pdf;
+		next->weight = mat->kd / prob_diff;
+	}
+	else if (has_specular && rnd < range) {
 		// specular interaction
-		newdir = sample_phong(-ray.dir, n, mat->specexp);
-		double pdf_spec = phong(newdir, -normalize(ray.dir), n, mat->specexp);
-		if((double)rand() / RAND_MAX <= pdf_spec) {
-			Ray newray;
-			newray.origin = p;
-			newray.dir = newdir * RAY_MAG;
-			color += trace(newray, depth - 1) * mat->ks / avg_spec;
+		newdir = sample_phong(lobe, dir_u, dir_v, &pdf);
+		double ndotd = dot(newdir, n);
+		if (ndotd > 0.0) {
+			next->pdf = prob_spec * pdf;
+
+			// the phong lobe cancels out of brdf * cos / pdf
+			next->weight = mat->ks * ((mat->specexp + 2.0) / (mat->specexp + 1.0) * ndotd / prob_spec);
 		}
 	}
 
-/* reflections */
-/*	if (mat->kr > 0.0) {
-		Ray refray;
-		refray.origin = p;
-		refray.dir = reflect(-ray.dir, n);
-		color = color + mat->kr * trace(refray, depth-1) * mat->ks;
+	if (next->pdf > 0.0) {
+		next->ray.origin = offset_ray_origin(p, ng, newdir);
+		next->ray.dir = newdir * RAY_MAG;
 	}
-*/
 	return color;
 }
 
+/* the light of the environment seen by ray, which missed everything, shared
+ * with the light samples like the emitters in shade_material().
+ */
+Color shade_env(const Ray &ray, const Bounce *bounce) {
+	const EnvLight *env = scene.get_env();
+	Vector3 dir = normalize(ray.dir);
+
+	Color le = env->radiance(dir);
+	if (!bounce) {
+		return le;
+	}
+	double lpdf = LIGHT_SAMPLES * scene.light_prob(bounce->pos, bounce->normal, env) * env->pdf(dir);
+	return le * mis_weight(bounce->pdf, lpdf);
+}
+
+/* shades the hit of ray, returning the light emitted there and the direct
+ * light from the light samples. bounce is the bounce that produced ray, or
+ * 0 for primary rays. Fills next with the bounce the path goes on with. The
+ * material class picked at load time selects the shading code.
+ */
+Color shade(const Ray &ray, IntInfo* min_info, const Bounce *bounce, Sampler *smp, Bounce *next) {
+	switch (min_info->object->get_material()->mclass) {
+	case MAT_DIFFUSE:
+		return shade_material<MAT_DIFFUSE>(ray, min_info, bounce, smp, next);
+	case MAT_GLOSSY:
+		return shade_material<MAT_GLOSSY>(ray, min_info, bounce, smp, next);
+	case MAT_EMISSIVE:
+		return shade_material<MAT_EMISSIVE>(ray, min_info, bounce, smp, next);
+	default:
+		break;
+	}
+	return shade_material<MAT_MIXED>(ray, min_info, bounce, smp, next);
+}
+
 bool write_ppm(const char *fname, uint32_t *pixels, int width, int height) {
 	FILE *fp;
 
@@ -404,66 +1078,3 @@ bool write_ppm(const char *fname, uint32_t *pixels, int width, int height) {
 	fclose(fp);
 	return true;
 }
-
-Color avg_color(double pxl_width, double pxl_height, double x, double y, int depth) {
-	Color c;
-	double w = pxl_width;
-	double h = pxl_height;	
-
-	if (depth == 0) {
-		if(rays_ppxl > 1) {
-			x += (double) rand() / RAND_MAX * pxl_width - pxl_width / 2.0;
-			y += (double) rand() / RAND_MAX * pxl_height - pxl_height / 2.0;
-		}
-		Ray ray = scene.get_camera()->get_primary_ray(x, y);
-		c = trace(ray, MAX_DEPTH);
-		c.x = c.x > 1.0 ? 1.0 : c.x;
-		c.y = c.y > 1.0 ? 1.0 : c.y;
-		c.z = c.z > 1.0 ? 1.0 : c.z;
-		return c;
-	}
-	c = c + avg_color(w/2, h/2, x + w/4, y + h/4, depth-1);
-	c = c + avg_color(w/2, h/2, x + w/4, y - h/4, depth-1);
-	c = c + avg_color(w/2, h/2, x - w/4, y + h/4, depth-1);
-	c = c + avg_color(w/2, h/2, x - w/4, y - h/4, depth-1);
-	c = c/4;
-	return c;
-}
-
-#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
-#include <sys/time.h>
-
-unsigned long get_msec() {
-	struct timeval tv;
-	static struct timeval tv0;
-
-	gettimeofday(&tv, 0);
-
-	if(tv0.tv_sec == 0 && tv0.tv_usec == 0) {
-		tv0 = tv;
-		return 0;
-	}
-
-	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
-}
-
-#elif defined(WIN32) || defined(__WIN32__)
-#include <windows.h>
-
-unsigned long get_msec() {
-	return timeGetTime();
-}
-
-#else
-#error "unsupported platform"
-#endif
-
-int calc_subdiv(int rays)
-{
-	int sub = 0;
-
-	while(pow(4.0, sub) <= rays) {
-		sub++;
-	}
-	return sub - 1;
-}
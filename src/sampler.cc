@@ -0,0 +1,418 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "sampler.h"
+
+#define BLUE_NOISE_SIZE		64
+
+static inline uint32_t hash(uint32_t x)
+{
+	// integer finalizer of murmurhash3
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline uint32_t hash_combine(uint32_t seed, uint32_t v)
+{
+	return hash(seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2)));
+}
+
+static inline double to_unit(uint32_t x)
+{
+	return (double)x / 4294967296.0;
+}
+
+static inline uint32_t reverse_bits(uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+	x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+	x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+	x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+	return x;
+}
+
+/* Owen scrambling with a hash, from Burley, "Practical Hash-based Owen
+ * Scrambling", JCGT 2020. The Laine-Karras permutation only carries bits
+ * upwards, so it's applied to the reversed bits.
+ */
+static inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47c;
+	x ^= x * 0xb82f1e52;
+	x ^= x * 0xc7afe638;
+	x ^= x * 0x8d22f6e6;
+	return reverse_bits(x);
+}
+
+/* the first two dimensions of the Sobol sequence, which form a (0, 2)
+ * sequence: the van der Corput sequence and the one of the primitive
+ * polynomial x + 1.
+ */
+static inline uint32_t sobol(uint32_t idx, int comp)
+{
+	if(comp == 0) {
+		return reverse_bits(idx);
+	}
+
+	uint32_t res = 0;
+	uint32_t dir = 0x80000000;
+	for(; idx; idx >>= 1) {
+		if(idx & 1) {
+			res ^= dir;
+		}
+		dir ^= dir >> 1;
+	}
+	return res;
+}
+
+/* component comp of a scrambled 2D Sobol point. The points of every pair of
+ * dimensions are shuffled by their own seed, which keeps each pair well
+ * stratified and the pairs uncorrelated ("padding").
+ */
+static inline uint32_t sobol_owen(uint32_t idx, uint32_t seed, int comp)
+{
+	uint32_t shuffled = nested_uniform_scramble(idx, seed);
+	return nested_uniform_scramble(sobol(shuffled, comp), hash_combine(seed, comp + 1));
+}
+
+
+Sampler::Sampler()
+{
+	px = py = index = dim = 0;
+	sample_seed = pixel_seed = 0;
+}
+
+Sampler::~Sampler()
+{
+}
+
+void Sampler::set_seed(uint32_t seed)
+{
+	sample_seed = seed;
+}
+
+void Sampler::start_sample(int px, int py, int index, int dim)
+{
+	this->px = px;
+	this->py = py;
+	this->index = index;
+	this->dim = dim;
+	pixel_seed = hash_combine(hash_combine(hash((uint32_t)px), (uint32_t)py), sample_seed);
+}
+
+void Sampler::next_2d(double *u, double *v)
+{
+	*u = next_1d();
+	*v = next_1d();
+}
+
+
+class RandomSampler : public Sampler {
+public:
+	Sampler *clone() const;
+	double next_1d();
+};
+
+Sampler *RandomSampler::clone() const
+{
+	return new RandomSampler(*this);
+}
+
+/* a hash of the pixel, sample index and dimension rather than rand(), so
+ * that the clones of the threads don't share its state and the numbers of a
+ * sample don't depend on which thread renders it.
+ */
+double RandomSampler::next_1d()
+{
+	uint32_t seed = hash_combine(pixel_seed, (uint32_t)index);
+	return to_unit(hash_combine(seed, (uint32_t)dim++));
+}
+
+
+class SobolSampler : public Sampler {
+public:
+	Sampler *clone() const;
+	double next_1d();
+	void next_2d(double *u, double *v);
+};
+
+Sampler *SobolSampler::clone() const
+{
+	return new SobolSampler(*this);
+}
+
+double SobolSampler::next_1d()
+{
+	int d = dim++;
+	return to_unit(sobol_owen(index, hash_combine(pixel_seed, d / 2), d & 1));
+}
+
+void SobolSampler::next_2d(double *u, double *v)
+{
+	// 2D points start at an even dimension, to come from the same pair
+	dim = (dim + 1) & ~1;
+	uint32_t seed = hash_combine(pixel_seed, dim / 2);
+	*u = to_unit(sobol_owen(index, seed, 0));
+	*v = to_unit(sobol_owen(index, seed, 1));
+	dim += 2;
+}
+
+
+static const int primes[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+	59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+	137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+	227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+#define NUM_PRIMES	(int)(sizeof primes / sizeof *primes)
+
+class HaltonSampler : public Sampler {
+public:
+	Sampler *clone() const;
+	double next_1d();
+};
+
+Sampler *HaltonSampler::clone() const
+{
+	return new HaltonSampler(*this);
+}
+
+static double radical_inverse(uint32_t idx, int base)
+{
+	double inv_base = 1.0 / base;
+	double scale = inv_base;
+	double res = 0.0;
+
+	while(idx) {
+		res += (double)(idx % base) * scale;
+		idx /= base;
+		scale *= inv_base;
+	}
+	return res;
+}
+
+/* the Halton sequence, with every dimension shifted by a random amount per
+ * pixel (Cranley-Patterson rotation). Dimensions past the prime table are
+ * plain hashed random numbers.
+ */
+double HaltonSampler::next_1d()
+{
+	int d = dim++;
+	uint32_t seed = hash_combine(pixel_seed, d);
+	if(d >= NUM_PRIMES) {
+		return to_unit(hash_combine(seed, index));
+	}
+
+	double x = radical_inverse(index, primes[d]) + to_unit(seed);
+	return x >= 1.0 ? x - 1.0 : x;
+}
+
+
+/* blue noise mask: the ranks of a void and cluster dither array (Ulichney,
+ * "The void-and-cluster method for dither array generation", 1993), scaled
+ * to [0, 1). Built on first use.
+ */
+static std::vector<float> blue_noise;
+
+/* adds (sign 1) or removes (sign -1) the energy of a 1 at pix */
+static void update_energy(std::vector<double> &energy, const std::vector<double> &kernel,
+		int size, int pix, double sign)
+{
+	int px = pix % size;
+	int py = pix / size;
+	for(int y=0; y<size; y++) {
+		const double *krow = &kernel[((y - py + size) % size) * size];
+		double *erow = &energy[y * size];
+		for(int x=0; x<size; x++) {
+			erow[x] += sign * krow[(x - px + size) % size];
+		}
+	}
+}
+
+/* the tightest cluster (the 1 with the most energy) if val is 1, or the
+ * largest void (the 0 with the least) if it's 0
+ */
+static int find_extreme(const std::vector<double> &energy, const std::vector<char> &pattern,
+		char val)
+{
+	int best = -1;
+	for(size_t i=0; i<energy.size(); i++) {
+		if(pattern[i] != val) continue;
+		if(best == -1 || (val ? energy[i] > energy[best] : energy[i] < energy[best])) {
+			best = (int)i;
+		}
+	}
+	return best;
+}
+
+static void calc_blue_noise()
+{
+	const int size = BLUE_NOISE_SIZE;
+	const int npix = size * size;
+	const double sigma = 1.9;
+
+	// gaussian energy kernel on the torus
+	std::vector<double> kernel(npix);
+	for(int y=0; y<size; y++) {
+		int dy = y < size / 2 ? y : size - y;
+		for(int x=0; x<size; x++) {
+			int dx = x < size / 2 ? x : size - x;
+			kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2.0 * sigma * sigma));
+		}
+	}
+
+	std::vector<double> energy(npix, 0.0);
+	std::vector<char> pattern(npix, 0);
+	std::vector<int> rank(npix, -1);
+
+	// initial pattern: a tenth of the pixels at random, then spread evenly
+	uint32_t rng = 1;
+	int ones = npix / 10;
+	for(int i=0; i<ones; ) {
+		rng = hash(rng + i);
+		int pix = rng % npix;
+		if(!pattern[pix]) {
+			pattern[pix] = 1;
+			update_energy(energy, kernel, size, pix, 1.0);
+			i++;
+		}
+	}
+
+	for(int i=0; i<npix; i++) {
+		int cluster = find_extreme(energy, pattern, 1);
+		pattern[cluster] = 0;
+		update_energy(energy, kernel, size, cluster, -1.0);
+
+		int fill = find_extreme(energy, pattern, 0);
+		pattern[fill] = 1;
+		update_energy(energy, kernel, size, fill, 1.0);
+
+		if(fill == cluster) {
+			break;
+		}
+	}
+
+	// ranks of the initial pattern: remove the tightest clusters
+	std::vector<char> init_pattern = pattern;
+	std::vector<double> init_energy = energy;
+
+	for(int r=ones - 1; r>=0; r--) {
+		int cluster = find_extreme(energy, pattern, 1);
+		pattern[cluster] = 0;
+		update_energy(energy, kernel, size, cluster, -1.0);
+		rank[cluster] = r;
+	}
+
+	/* the rest: fill the largest voids. Past half, the tightest cluster of
+	 * 0s is the largest void of 1s as well, since the energies of the two
+	 * add up to a constant.
+	 */
+	pattern = init_pattern;
+	energy = init_energy;
+	for(int r=ones; r<npix; r++) {
+		int fill = find_extreme(energy, pattern, 0);
+		pattern[fill] = 1;
+		update_energy(energy, kernel, size, fill, 1.0);
+		rank[fill] = r;
+	}
+
+	blue_noise.resize(npix);
+	for(int i=0; i<npix; i++) {
+		blue_noise[i] = ((float)rank[i] + 0.5f) / (float)npix;
+	}
+}
+
+/* Sobol points, scrambled the same way for every pixel, and shifted by the
+ * blue noise mask. Each dimension reads the mask at a different offset, so
+ * that the shifts of the dimensions aren't correlated.
+ */
+class BlueNoiseSampler : public Sampler {
+private:
+	double shift(int d) const;
+public:
+	Sampler *clone() const;
+	double next_1d();
+	void next_2d(double *u, double *v);
+};
+
+Sampler *BlueNoiseSampler::clone() const
+{
+	return new BlueNoiseSampler(*this);
+}
+
+double BlueNoiseSampler::shift(int d) const
+{
+	uint32_t offs = hash_combine(sample_seed, d + 1);
+	int x = (px + (offs & 0xffff)) % BLUE_NOISE_SIZE;
+	int y = (py + (offs >> 16)) % BLUE_NOISE_SIZE;
+	return blue_noise[y * BLUE_NOISE_SIZE + x];
+}
+
+double BlueNoiseSampler::next_1d()
+{
+	int d = dim++;
+	double x = to_unit(sobol_owen(index, hash_combine(sample_seed, d / 2), d & 1)) + shift(d);
+	return x >= 1.0 ? x - 1.0 : x;
+}
+
+void BlueNoiseSampler::next_2d(double *u, double *v)
+{
+	dim = (dim + 1) & ~1;
+	uint32_t seed = hash_combine(sample_seed, dim / 2);
+
+	double x = to_unit(sobol_owen(index, seed, 0)) + shift(dim);
+	double y = to_unit(sobol_owen(index, seed, 1)) + shift(dim + 1);
+	*u = x >= 1.0 ? x - 1.0 : x;
+	*v = y >= 1.0 ? y - 1.0 : y;
+	dim += 2;
+}
+
+
+Sampler *create_sampler(const char *name)
+{
+	if(strcmp(name, "random") == 0) {
+		return new RandomSampler;
+	}
+	if(strcmp(name, "sobol") == 0) {
+		return new SobolSampler;
+	}
+	if(strcmp(name, "halton") == 0) {
+		return new HaltonSampler;
+	}
+	if(strcmp(name, "bluenoise") == 0) {
+		if(blue_noise.empty()) {
+			calc_blue_noise();
+		}
+		return new BlueNoiseSampler;
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <inttypes.h>
+
+/* source of the random numbers of a path. Each path is sample index of a
+ * pixel, and everything it samples (position in the pixel, light, bounce
+ * direction, ...) takes the next dimension(s) of it, so that samplers can
+ * spread the samples of each pixel evenly over every dimension, for any
+ * number of samples.
+ */
+class Sampler {
+protected:
+	int px, py, index, dim;
+	uint32_t sample_seed, pixel_seed;
+
+public:
+	Sampler();
+	virtual ~Sampler();
+
+	/* samples of different seeds are uncorrelated, 0 by default */
+	void set_seed(uint32_t seed);
+
+	/* a new sampler of the same kind and seed, for another thread */
+	virtual Sampler *clone() const = 0;
+
+	/* starts the sample index of pixel (px, py), at dimension dim */
+	void start_sample(int px, int py, int index, int dim);
+
+	/* the next dimension of the current sample, in [0, 1) */
+	virtual double next_1d() = 0;
+	/* the next two dimensions, well distributed as a 2D point */
+	virtual void next_2d(double *u, double *v);
+};
+
+/* creates the sampler named: "random" (uncorrelated hashed numbers),
+ * "sobol" (Owen scrambled Sobol), "halton" (randomly shifted per pixel) or
+ * "bluenoise" (Sobol shifted per pixel by a blue noise mask, which spreads
+ * the error of neighbouring pixels as blue noise). Returns 0 for unknown
+ * names.
+ */
+Sampler *create_sampler(const char *name);
+
+#endif
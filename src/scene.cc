@@ -25,30 +25,59 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include <ctype.h>
 #include <errno.h>
 #include <float.h>
+#include <algorithm>
 #include "config.h"
 #include "scene.h"
 #include "sphere.h"
 #include "plane.h"
 #include "sphereflake.h"
 #include "mesh.h"
+#include "meshfile.h"
+#include "pagedmesh.h"
+#include "simplify.h"
 #include "camera.h"
 #include "light.h"
 
 #define DEG_TO_RAD(x)	(M_PI * (x) / 180.0)
 
+/* a mesh referenced by the scene file. Meshes are loaded after the whole
+ * file is read, so that they can be loaded concurrently.
+ */
+struct MeshRef {
+	char fname[512];
+	float xform[10];	// pos, rotation angle and axis, scale, as in the file
+	Material mat;
+	char line[1024];
+	int lnum;
+	int same_as;		// earlier reference to the same file and transform, or -1
+	Object *mesh;		// Mesh, or PagedMesh for out-of-core meshes
+};
+
+/* scene file entries in file order, so that the objects and lights can be
+ * added in the same order, whenever their meshes finish loading.
+ */
+struct SceneEntry {
+	Object *obj;		// object or light, if not a mesh
+	bool light;
+	int mesh_ref;		// index in the mesh references, or -1
+};
+
 static Sphere *load_sphere(const char *line);
 static Plane *load_plane(const char *line);
 static SphereFlake *load_sphflake(const char *line);
-static Mesh *load_mesh(const char *line);
-static bool load_mesh_data(Mesh *mesh, const char *fname, const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale);
-static char *strip_space(char *buf);
+static bool parse_mesh(const char *line, MeshRef *ref);
+static void load_meshes(std::vector<MeshRef> &refs, bool build_lods);
 static Camera *load_camera(const char *line);
 static PointLight *load_light(const char *line);
+static EnvLight *load_env(const char *line);
 
 Scene::Scene(){
 	cam = 0;
 	ambient = Color(0, 0, 0);
 	bbroot = 0;
+	env = 0;
+	lod_error = 0.0;
+	full_detail = false;
 }
 
 Scene::~Scene() {
@@ -65,6 +94,7 @@ Scene::~Scene() {
 	if (bbroot) {
 		delete bbroot;
 	}
+	delete env;
 }
 
 bool Scene::load(const char *fname) {
@@ -89,7 +119,11 @@ bool Scene::load(FILE *fp) {
 	Plane *plane;
 	Camera *cam;
 	PointLight *lt;
-	Mesh *mesh;
+	EnvLight *envl;
+	MeshRef ref;
+
+	std::vector<SceneEntry> entries;
+	std::vector<MeshRef> mesh_refs;
 
 	int lnum = 0;
 	while(fgets(line, sizeof line, fp)) {
@@ -99,10 +133,15 @@ bool Scene::load(FILE *fp) {
 			continue;
 		}
 
+		SceneEntry ent;
+		ent.obj = 0;
+		ent.light = false;
+		ent.mesh_ref = -1;
+
 		switch(line[0]) {
 		case 's':
 			if((sph = load_sphere(line))) {
-				add_object(sph);
+				ent.obj = sph;
 			} else {
 				ERROR(line, lnum);
 			}
@@ -110,7 +149,7 @@ bool Scene::load(FILE *fp) {
 
 		case 'p':
 			if((plane = load_plane(line))) {
-				add_object(plane);
+				ent.obj = plane;
 			} else {
 				ERROR(line, lnum);
 			}
@@ -118,7 +157,7 @@ bool Scene::load(FILE *fp) {
 
 		case 'f':
 			if((sflake = load_sphflake(line))) {
-				add_object(sflake);
+				ent.obj = sflake;
 			} else {
 				ERROR(line, lnum);
 			}
@@ -126,7 +165,17 @@ bool Scene::load(FILE *fp) {
 
 		case 'l':
 			if((lt = load_light(line))) {
-				lights.push_back(lt);
+				ent.obj = lt;
+				ent.light = true;
+			} else {
+				ERROR(line, lnum);
+			}
+			break;
+
+		case 'e':
+			if((envl = load_env(line))) {
+				delete env;
+				env = envl;
 			} else {
 				ERROR(line, lnum);
 			}
@@ -141,8 +190,11 @@ bool Scene::load(FILE *fp) {
 			break;
 
 		case 'm':
-			if((mesh = load_mesh(line))) {
-				add_object(mesh);
+			if(parse_mesh(line, &ref)) {
+				strcpy(ref.line, line);
+				ref.lnum = lnum;
+				ent.mesh_ref = (int)mesh_refs.size();
+				mesh_refs.push_back(ref);
 			}
 			else {
 				ERROR(line, lnum);
@@ -152,15 +204,39 @@ bool Scene::load(FILE *fp) {
 		default:
 			ERROR(line, lnum);
 		}
+
+		if(ent.obj || ent.mesh_ref != -1) {
+			entries.push_back(ent);
+		}
+	}
+
+	load_meshes(mesh_refs, lod_error > 0.0 && !full_detail);
+
+	for(size_t i=0; i<entries.size(); i++) {
+		const SceneEntry &ent = entries[i];
+
+		if(ent.mesh_ref != -1) {
+			const MeshRef &mref = mesh_refs[ent.mesh_ref];
+			if(mref.mesh) {
+				add_object(mref.mesh);
+			} else {
+				ERROR(mref.line, mref.lnum);
+			}
+		} else if(ent.light) {
+			lights.push_back(ent.obj);
+		} else {
+			add_object(ent.obj);
+		}
 	}
 
 	return true;
 }
 
-
 void Scene::add_object(Object* object) {
+	classify_material(object->get_material());
 	objects.push_back(object);
 	if (object->is_light()) {
+		object->prepare_light_sampling();
 		lights.push_back(object);
 	}
 }
@@ -181,6 +257,10 @@ Camera* Scene::get_camera() {
 	return cam;
 }
 
+const EnvLight *Scene::get_env() const {
+	return env;
+}
+
 void Scene::set_ambient(const Color &amb) {
 	ambient = amb;
 }
@@ -189,6 +269,30 @@ Color Scene::get_ambient() {
 	return ambient;
 }
 
+void Scene::set_lod_error(double max_error) {
+	lod_error = max_error;
+}
+
+void Scene::set_full_detail(bool full) {
+	full_detail = full;
+}
+
+void Scene::select_detail(int img_height) {
+	if(!cam) {
+		return;
+	}
+	if(!bbroot) {
+		build_bbtree();	// calculates the bounding boxes
+	}
+
+	double pixel_size = 2.0 * tan(cam->get_fov() / 2.0) / (double)img_height;
+	double max_error = full_detail ? 0.0 : lod_error;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		objects[i]->select_detail(cam->get_position(), pixel_size, max_error);
+	}
+}
+
 void Scene::build_bbtree() {
 	/* since we have infinite planes make the root bounding box *LARGE*
 	 * (not quite correct but works for our purposes, the ray
@@ -203,6 +307,56 @@ void Scene::build_bbtree() {
 		objects[i]->calc_bbox();
 		bbroot->add_object(objects[i]);
 	}
+
+	light_tree.build(lights);
+}
+
+BBox Scene::get_bounds() const {
+	Vector3 pos = cam ? cam->get_position() : Vector3(0, 0, 0);
+	BBox res(pos, pos);
+
+	for(size_t i = 0; i < objects.size(); i++) {
+		const BBox &b = objects[i]->get_bbox();
+		if(b.max.x - b.min.x >= RAY_MAG || b.max.y - b.min.y >= RAY_MAG ||
+				b.max.z - b.min.z >= RAY_MAG) {
+			continue;	// planes
+		}
+		res.min.x = std::min(res.min.x, b.min.x);
+		res.min.y = std::min(res.min.y, b.min.y);
+		res.min.z = std::min(res.min.z, b.min.z);
+		res.max.x = std::max(res.max.x, b.max.x);
+		res.max.y = std::max(res.max.y, b.max.y);
+		res.max.z = std::max(res.max.z, b.max.z);
+	}
+	return res;
+}
+
+const Object *Scene::sample_light(const Vector3 &p, const Vector3 &n, double u, double *prob) const {
+	if(!env) {
+		return light_tree.sample(p, n, u, prob);
+	}
+
+	double env_prob = light_tree.get_light_count() ? ENV_LIGHT_PROB : 1.0;
+	if(u < env_prob) {
+		*prob = env_prob;
+		return env;
+	}
+
+	const Object *light = light_tree.sample(p, n, (u - env_prob) / (1.0 - env_prob), prob);
+	*prob *= 1.0 - env_prob;
+	return light;
+}
+
+double Scene::light_prob(const Vector3 &p, const Vector3 &n, const Object *light) const {
+	if(!env) {
+		return light_tree.prob(p, n, light);
+	}
+
+	double env_prob = light_tree.get_light_count() ? ENV_LIGHT_PROB : 1.0;
+	if(light == env) {
+		return env_prob;
+	}
+	return light_tree.prob(p, n, light) * (1.0 - env_prob);
 }
 
 static Sphere *load_sphere(const char *line) {
@@ -271,136 +425,106 @@ static SphereFlake *load_sphflake(const char *line) {
 	return sflake;
 }
 
-static Mesh *load_mesh(const char *line) {
-	char fname[512];
-	float x, y, z, rx, ry, rz, angle, sx, sy, sz;
+static bool parse_mesh(const char *line, MeshRef *ref) {
+	float *xf = ref->xform;
 	float dr, dg, db, sr, sg, sb, specexp, kr;
 	float er, eg, eb;
 
-	int res = sscanf(line, "m %s pos(%f %f %f) rot(%f %f %f %f) scale(%f %f %f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f) ke(%f %f %f)\n",
-			fname, &x, &y, &z, &angle, &rx, &ry, &rz, &sx, &sy, &sz,
+	int res = sscanf(line, "m %511s pos(%f %f %f) rot(%f %f %f %f) scale(%f %f %f) kd(%f %f %f) ks(%f %f %f) s(%f) kr(%f) ke(%f %f %f)\n",
+			ref->fname, xf, xf + 1, xf + 2, xf + 3, xf + 4, xf + 5, xf + 6, xf + 7, xf + 8, xf + 9,
 			&dr, &dg, &db, &sr, &sg, &sb, &specexp, &kr, &er, &eg, &eb);
 	if(res < 22) {
-		return 0;
-	}
-
-	Vector3 pos(x, y, z), scale(sx, sy, sz);
-
-	Matrix4x4 rot;
-	rot.set_rotation(Vector3(rx, ry, rz), DEG_TO_RAD(angle));
-
-	Mesh *mesh = new Mesh;
-	if(!load_mesh_data(mesh, fname, pos, rot, scale)) {
-		delete mesh;
-		return 0;
+		return false;
 	}
 
-	Material *mat = mesh->get_material();
-	mat->kd = Vector3(dr, dg, db);
-	mat->ks = Vector3(sr, sg, sb);
-	mat->ke = Vector3(er, eg, eb);
-	mat->specexp = specexp;
-	mat->kr = kr;
-	return mesh;
+	ref->mat.kd = Vector3(dr, dg, db);
+	ref->mat.ks = Vector3(sr, sg, sb);
+	ref->mat.ke = Vector3(er, eg, eb);
+	ref->mat.specexp = specexp;
+	ref->mat.kr = kr;
+	ref->same_as = -1;
+	ref->mesh = 0;
+	return true;
 }
 
-static bool load_mesh_data(Mesh *mesh, const char *fname, const Vector3 &pos, const Matrix4x4 &rot, const Vector3 &scale) {
-	FILE *fp;
-	char buf[256];
-	int prim;
-	Face face;
-
-	std::vector<Vector3> verts, normals;
-
-	if(!(fp = fopen(fname, "r"))) {
-		fprintf(stderr, "failed to open mesh data file: %s: %s\n", fname, strerror(errno));
-		return false;
+/* loads the referenced meshes, each distinct file and transform once, in
+ * parallel. The file loaders parallelize the parsing themselves, which is
+ * used instead when there's only one mesh to load. Out-of-core meshes are
+ * loaded one at a time, to keep only one of them in memory before it's
+ * written to the geometry cache, and they don't get levels of detail.
+ */
+static void load_meshes(std::vector<MeshRef> &refs, bool build_lods) {
+	std::vector<int> unique;
+
+	for(size_t i=0; i<refs.size(); i++) {
+		for(size_t j=0; j<unique.size(); j++) {
+			const MeshRef &uref = refs[unique[j]];
+			if(strcmp(uref.fname, refs[i].fname) == 0 &&
+					memcmp(uref.xform, refs[i].xform, sizeof uref.xform) == 0) {
+				refs[i].same_as = unique[j];
+				break;
+			}
+		}
+		if(refs[i].same_as == -1) {
+			unique.push_back(i);
+		}
 	}
 
-	if(!fgets(buf, sizeof buf, fp)) {
-		goto err;
-	}
-	if(sscanf(buf, "MESH%d\n", &prim) != 1) {
-		goto err;
-	}
+	int num_unique = (int)unique.size();
+	bool paging = geom_paging_enabled();
 
-	mesh->set_primitive((MeshPrim)prim);
+	#pragma omp parallel for schedule(dynamic) if(num_unique > 1 && !paging)
+	for(int i=0; i<num_unique; i++) {
+		MeshRef *ref = &refs[unique[i]];
+		const float *xf = ref->xform;
 
-	while(fgets(buf, sizeof buf, fp)) {
-		char *line = strip_space(buf);
-		float x, y, z;
-		int vidx[4], nidx[4], res;
-		Vector3 vec;
+		Vector3 pos(xf[0], xf[1], xf[2]), scale(xf[7], xf[8], xf[9]);
 
-		if(!line[0] || line[0] == '#') {
+		Matrix4x4 rot;
+		rot.set_rotation(Vector3(xf[4], xf[5], xf[6]), DEG_TO_RAD(xf[3]));
+
+		Mesh *mesh = new Mesh;
+		if(!load_mesh_file(mesh, ref->fname, pos, rot, scale)) {
+			delete mesh;
 			continue;
 		}
 
-		switch(line[0]) {
-		case 'v':
-			if(sscanf(line, "v %f %f %f", &x, &y, &z) < 3) {
-				goto err;
-			}
-			vec = Vector3(x * scale.x, y * scale.y, z * scale.z);
-			vec.transform(rot);
-			verts.push_back(vec + pos);
-			break;
-
-		case 'n':
-			if(sscanf(line, "n %f %f %f", &x, &y, &z) < 3) {
-				goto err;
-			}
-			vec = Vector3(x, y, z);
-			vec.transform(rot);
-			normals.push_back(normalize(vec));
-			break;
-
-		case 'f':
-			res = sscanf(line, "f %d/%d %d/%d %d/%d %d/%d", vidx, nidx, vidx + 1, nidx + 1,
-					vidx + 2, nidx + 2, vidx + 3, nidx + 3);
-			if(res != prim * 2) {
-				goto err;
+		if(build_lods && !paging) {
+			std::vector<Mesh*> levels;
+			std::vector<double> errors;
+			if(simplify_mesh(mesh, LOD_MIN_FACES, &levels, &errors)) {
+				mesh->set_lods(levels, errors);
 			}
+		}
 
-			for(int i=0; i<prim; i++) {
-				face.v[i].pos = verts[vidx[i] - 1];
-				face.v[i].norm = normals[nidx[i] - 1];
+		if(paging) {
+			if(!(ref->mesh = create_paged_mesh(mesh))) {
+				fprintf(stderr, "failed to write %s to the geometry cache\n", ref->fname);
 			}
-			face.calc_normal();
-			mesh->add_face(face);
-			break;
-
-		default:
-			goto err;
+			delete mesh;
+		} else {
+			ref->mesh = mesh;
 		}
 	}
 
-	fclose(fp);
-	return true;
-
-err:
-	fprintf(stderr, "failed to read mesh data file: %s: invalid format\n", fname);
-	fclose(fp);
-	return false;
-}
+	for(size_t i=0; i<refs.size(); i++) {
+		MeshRef *ref = &refs[i];
 
-static char *strip_space(char *buf)
-{
-	while(*buf && isspace(*buf)) {
-		buf++;
-	}
-
-	char *end = buf + strlen(buf) - 1;
-	if(end < buf) {
-		end = buf;
-	}
-
-	while(isspace(*end)) {
-		end--;
+		if(ref->same_as != -1 && refs[ref->same_as].mesh) {
+			if(paging) {
+				PagedMesh *pmesh = new PagedMesh;
+				pmesh->share_data((PagedMesh*)refs[ref->same_as].mesh);
+				ref->mesh = pmesh;
+			} else {
+				Mesh *mesh = new Mesh;
+				mesh->share_data((Mesh*)refs[ref->same_as].mesh);
+				ref->mesh = mesh;
+			}
+		}
+		if(ref->mesh) {
+			*ref->mesh->get_material() = ref->mat;
+		}
 	}
-
-	if(*end) end[1] = 0;
-	return buf;
 }
 
 static Camera *load_camera(const char *line) {
@@ -417,17 +541,50 @@ static Camera *load_camera(const char *line) {
 	return cam;
 }
 
+/* l p(x y z) c(r g b) is the original point light: c scales the diffuse and
+ * specular terms directly, with no falloff and no brdf normalization, so it
+ * does not balance against the area lights.
+ * l p(x y z) i(r g b) is a physical point light: i is its radiant intensity,
+ * in the same units as the radiance of the area lights, and a point at
+ * distance r receives i / r^2.
+ */
 static PointLight *load_light(const char *line) {
 	float x, y, z, r, g, b;
+	bool intensity = false;
 
 	int res = sscanf(line, "l p(%f %f %f) c(%f %f %f)\n", &x, &y, &z, &r, &g, &b);
 	if(res < 6) {
-		return 0;
+		res = sscanf(line, "l p(%f %f %f) i(%f %f %f)\n", &x, &y, &z, &r, &g, &b);
+		if(res < 6) {
+			return 0;
+		}
+		intensity = true;
 	}
 
 	PointLight *lt = new PointLight;
 	lt->position = Vector3(x, y, z);
 	lt->get_material()->ke = Vector3(r, g, b);
+	lt->falloff = intensity;
 
 	return lt;
 }
+
+static EnvLight *load_env(const char *line) {
+	char fname[512];
+	float r, g, b;
+
+	int res = sscanf(line, "e %511s ke(%f %f %f)\n", fname, &r, &g, &b);
+	if(res < 4) {
+		return 0;
+	}
+
+	EnvLight *env = new EnvLight;
+	if(!env->load(fname)) {
+		delete env;
+		return 0;
+	}
+	env->get_material()->ke = Vector3(r, g, b);
+	env->prepare_light_sampling();
+
+	return env;
+}
@@ -26,7 +26,9 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "light.h"
 #include "camera.h"
 #include "bbox.h"
+#include "envlight.h"
 #include "intinfo.h"
+#include "lighttree.h"
 #include "object.h"
 
 class Scene {
@@ -35,6 +37,10 @@ private:
 	Camera *cam;
 	Color ambient;
 	BBoxNode* bbroot;
+	LightTree light_tree;
+	EnvLight *env;
+	double lod_error;
+	bool full_detail;
 
 public:
 	std::vector<Object*> lights;
@@ -50,8 +56,33 @@ public:
 	void set_ambient(const Color &amb);
 	Color get_ambient();
 	Camera* get_camera();
+	/* the environment light, 0 if rays that miss everything see black */
+	const EnvLight *get_env() const;
 	bool intersection(const Ray &ray, IntInfo* inter);
 	void build_bbtree();
+	/* bounds of the camera and the objects that aren't infinite, after
+	 * build_bbtree
+	 */
+	BBox get_bounds() const;
+
+	/* picks one of the lights to sample for the point p with normal n,
+	 * with the uniform number u, and the probability it had, see lighttree.h.
+	 * The environment light is picked ENV_LIGHT_PROB of the time, if there
+	 * are other lights.
+	 */
+	const Object *sample_light(const Vector3 &p, const Vector3 &n, double u, double *prob) const;
+	double light_prob(const Vector3 &p, const Vector3 &n, const Object *light) const;
+
+	/* meshes get levels of detail at load time when max_error, the largest
+	 * error in pixels they may show, is positive. Must be set before load.
+	 */
+	void set_lod_error(double max_error);
+	/* always use the full detail meshes, even if they have levels of detail */
+	void set_full_detail(bool full);
+	/* picks the level of detail of each object from the camera, for an image
+	 * img_height pixels high.
+	 */
+	void select_detail(int img_height);
 };
 
 #endif
@@ -0,0 +1,585 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <queue>
+#include "meshfile.h"
+#include "simplify.h"
+#include "timer.h"
+
+/* weight of the planes that keep the boundary edges in place, relative to
+ * the planes of the faces.
+ */
+#define BOUNDARY_WEIGHT		10.0
+
+/* symmetric 4x4 matrix of the squared distance to a set of planes, upper
+ * triangle only: a2 ab ac ad b2 bc bd c2 cd d2
+ */
+struct Quadric {
+	double q[10];
+};
+
+struct SimpVertex {
+	double pos[3];
+	Quadric quad;
+	std::vector<int> faces;
+	int stamp;	// changes every time the vertex moves, to invalidate old collapses
+	bool removed;
+};
+
+struct SimpFace {
+	int v[3];
+	bool removed;
+};
+
+/* a candidate collapse of the edge (u, v) to pos. It's valid only as long as
+ * the stamps of both vertices stay the same.
+ */
+struct Collapse {
+	double cost;
+	double pos[3];
+	int u, v;
+	int stamp_u, stamp_v;
+
+	bool operator <(const Collapse &c) const
+	{
+		return cost > c.cost;	// cheapest first
+	}
+};
+
+struct SimpMesh {
+	std::vector<SimpVertex> verts;
+	std::vector<SimpFace> faces;
+	std::priority_queue<Collapse> queue;
+};
+
+static void add_plane(Quadric *quad, double a, double b, double c, double d, double w)
+{
+	double *q = quad->q;
+	q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+	q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+	q[7] += w * c * c; q[8] += w * c * d;
+	q[9] += w * d * d;
+}
+
+static double eval_quadric(const Quadric &quad, const double *p)
+{
+	const double *q = quad.q;
+	double x = p[0], y = p[1], z = p[2];
+
+	return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+		q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+		q[7] * z * z + 2.0 * q[8] * z + q[9];
+}
+
+/* the position where the quadric is minimal, false if it isn't unique (flat
+ * or straight neighbourhoods).
+ */
+static bool quadric_minimum(const Quadric &quad, double *p)
+{
+	const double *q = quad.q;
+	double a = q[0], b = q[1], c = q[2];
+	double d = q[4], e = q[5], f = q[7];
+
+	double c00 = d * f - e * e;
+	double c01 = c * e - b * f;
+	double c02 = b * e - c * d;
+	double det = a * c00 + b * c01 + c * c02;
+
+	double tr = a + d + f;
+	if(fabs(det) <= 1e-10 * tr * tr * tr) {
+		return false;
+	}
+
+	double c11 = a * f - c * c;
+	double c12 = b * c - a * e;
+	double c22 = a * d - b * b;
+
+	double rx = -q[3], ry = -q[6], rz = -q[8];
+	p[0] = (c00 * rx + c01 * ry + c02 * rz) / det;
+	p[1] = (c01 * rx + c11 * ry + c12 * rz) / det;
+	p[2] = (c02 * rx + c12 * ry + c22 * rz) / det;
+	return true;
+}
+
+static inline void sub3(const double *a, const double *b, double *res)
+{
+	res[0] = a[0] - b[0];
+	res[1] = a[1] - b[1];
+	res[2] = a[2] - b[2];
+}
+
+static inline void cross3(const double *a, const double *b, double *res)
+{
+	res[0] = a[1] * b[2] - a[2] * b[1];
+	res[1] = a[2] * b[0] - a[0] * b[2];
+	res[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static inline double dot3(const double *a, const double *b)
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static void face_normal(const double *p0, const double *p1, const double *p2, double *n)
+{
+	double e1[3], e2[3];
+	sub3(p1, p0, e1);
+	sub3(p2, p0, e2);
+	cross3(e1, e2, n);
+}
+
+static void calc_collapse(const SimpMesh &sm, int u, int v, Collapse *col)
+{
+	const SimpVertex &vu = sm.verts[u];
+	const SimpVertex &vv = sm.verts[v];
+
+	Quadric quad;
+	for(int i=0; i<10; i++) {
+		quad.q[i] = vu.quad.q[i] + vv.quad.q[i];
+	}
+
+	col->u = u;
+	col->v = v;
+	col->stamp_u = vu.stamp;
+	col->stamp_v = vv.stamp;
+
+	/* the optimal position, unless it's far from the edge (nearly
+	 * singular quadrics), otherwise the best of the endpoints and midpoint
+	 */
+	double mid[3], edge[3];
+	for(int i=0; i<3; i++) {
+		mid[i] = (vu.pos[i] + vv.pos[i]) * 0.5;
+	}
+	sub3(vv.pos, vu.pos, edge);
+
+	double p[3], dist[3];
+	if(quadric_minimum(quad, p)) {
+		sub3(p, mid, dist);
+		if(dot3(dist, dist) <= dot3(edge, edge)) {
+			col->cost = eval_quadric(quad, p);
+			for(int i=0; i<3; i++) {
+				col->pos[i] = p[i];
+			}
+			if(col->cost < 0.0) col->cost = 0.0;
+			return;
+		}
+	}
+
+	const double *cand[] = {vu.pos, vv.pos, mid};
+	col->cost = -1.0;
+	for(int i=0; i<3; i++) {
+		double cost = eval_quadric(quad, cand[i]);
+		if(col->cost < 0.0 || cost < col->cost) {
+			col->cost = cost;
+			for(int j=0; j<3; j++) {
+				col->pos[j] = cand[i][j];
+			}
+		}
+	}
+	if(col->cost < 0.0) col->cost = 0.0;
+}
+
+static inline bool face_has(const SimpFace &f, int v)
+{
+	return f.v[0] == v || f.v[1] == v || f.v[2] == v;
+}
+
+static void get_neighbours(const SimpMesh &sm, int v, std::vector<int> *nb)
+{
+	nb->clear();
+	const std::vector<int> &vf = sm.verts[v].faces;
+	for(size_t i=0; i<vf.size(); i++) {
+		const SimpFace &f = sm.faces[vf[i]];
+		if(f.removed) continue;
+
+		for(int j=0; j<3; j++) {
+			if(f.v[j] != v) nb->push_back(f.v[j]);
+		}
+	}
+	std::sort(nb->begin(), nb->end());
+	nb->erase(std::unique(nb->begin(), nb->end()), nb->end());
+}
+
+/* false if moving v (collapsing it with other) to pos would flip or
+ * degenerate any of the faces around it that survive the collapse.
+ */
+static bool keeps_orientation(const SimpMesh &sm, int v, int other, const double *pos)
+{
+	const std::vector<int> &vf = sm.verts[v].faces;
+	for(size_t i=0; i<vf.size(); i++) {
+		const SimpFace &f = sm.faces[vf[i]];
+		if(f.removed || face_has(f, other)) continue;
+
+		const double *p[3], *q[3];
+		for(int j=0; j<3; j++) {
+			p[j] = sm.verts[f.v[j]].pos;
+			q[j] = f.v[j] == v ? pos : p[j];
+		}
+
+		double n0[3], n1[3];
+		face_normal(p[0], p[1], p[2], n0);
+		face_normal(q[0], q[1], q[2], n1);
+
+		double len1 = dot3(n1, n1);
+		if(len1 <= 0.0 || dot3(n0, n1) < 0.25 * sqrt(dot3(n0, n0) * len1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* number of the faces left around v that contain the edge (v, other) */
+static int count_edge_faces(const SimpMesh &sm, int v, int other)
+{
+	int count = 0;
+	const std::vector<int> &vf = sm.verts[v].faces;
+	for(size_t i=0; i<vf.size(); i++) {
+		const SimpFace &f = sm.faces[vf[i]];
+		if(!f.removed && face_has(f, other)) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/* true if v is on the border of the surface: one of its edges has a single
+ * face. nb are the neighbours of v.
+ */
+static bool on_border(const SimpMesh &sm, int v, const std::vector<int> &nb)
+{
+	for(size_t i=0; i<nb.size(); i++) {
+		if(count_edge_faces(sm, v, nb[i]) == 1) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool can_collapse(const SimpMesh &sm, const Collapse &col, std::vector<int> *nb_u,
+		std::vector<int> *nb_v)
+{
+	/* link condition: the edge endpoints must share only the opposite
+	 * vertices of its faces (two inside the surface, one on its border), or
+	 * the collapse would pinch the surface into a non-manifold. For the
+	 * same reason an inner edge can't join two vertices of the border.
+	 */
+	int edge_faces = count_edge_faces(sm, col.u, col.v);
+
+	get_neighbours(sm, col.u, nb_u);
+	get_neighbours(sm, col.v, nb_v);
+
+	int shared = 0;
+	size_t i = 0, j = 0;
+	while(i < nb_u->size() && j < nb_v->size()) {
+		if((*nb_u)[i] < (*nb_v)[j]) {
+			i++;
+		} else if((*nb_u)[i] > (*nb_v)[j]) {
+			j++;
+		} else {
+			shared++;
+			i++;
+			j++;
+		}
+	}
+	if(shared > edge_faces) {
+		return false;
+	}
+	if(edge_faces > 1 && on_border(sm, col.u, *nb_u) && on_border(sm, col.v, *nb_v)) {
+		return false;
+	}
+
+	return keeps_orientation(sm, col.u, col.v, col.pos) &&
+		keeps_orientation(sm, col.v, col.u, col.pos);
+}
+
+/* collapses v into u, returns the number of faces removed */
+static int do_collapse(SimpMesh *sm, const Collapse &col)
+{
+	SimpVertex &vu = sm->verts[col.u];
+	SimpVertex &vv = sm->verts[col.v];
+
+	for(int i=0; i<3; i++) {
+		vu.pos[i] = col.pos[i];
+	}
+	for(int i=0; i<10; i++) {
+		vu.quad.q[i] += vv.quad.q[i];
+	}
+
+	int removed = 0;
+	for(size_t i=0; i<vv.faces.size(); i++) {
+		SimpFace &f = sm->faces[vv.faces[i]];
+		if(f.removed) continue;
+
+		if(face_has(f, col.u)) {
+			f.removed = true;
+			removed++;
+		} else {
+			for(int j=0; j<3; j++) {
+				if(f.v[j] == col.v) f.v[j] = col.u;
+			}
+			vu.faces.push_back(vv.faces[i]);
+		}
+	}
+
+	size_t nfaces = 0;
+	for(size_t i=0; i<vu.faces.size(); i++) {
+		if(!sm->faces[vu.faces[i]].removed) {
+			vu.faces[nfaces++] = vu.faces[i];
+		}
+	}
+	vu.faces.resize(nfaces);
+
+	vv.removed = true;
+	std::vector<int>().swap(vv.faces);
+
+	vu.stamp++;
+	return removed;
+}
+
+static void push_collapses(SimpMesh *sm, int u, const std::vector<int> &nb)
+{
+	for(size_t i=0; i<nb.size(); i++) {
+		Collapse col;
+		calc_collapse(*sm, u, nb[i], &col);
+		sm->queue.push(col);
+	}
+}
+
+static bool snapshot(const SimpMesh &sm, Mesh *mesh)
+{
+	std::vector<int> new_idx(sm.verts.size(), -1);
+	std::vector<Vector3> verts, normals;
+	std::vector<int> face_idx;
+
+	for(size_t i=0; i<sm.faces.size(); i++) {
+		const SimpFace &f = sm.faces[i];
+		if(f.removed) continue;
+
+		for(int j=0; j<3; j++) {
+			int v = f.v[j];
+			if(new_idx[v] == -1) {
+				const double *p = sm.verts[v].pos;
+				new_idx[v] = (int)verts.size();
+				verts.push_back(Vector3(p[0], p[1], p[2]));
+			}
+			face_idx.push_back(new_idx[v]);
+			face_idx.push_back(-1);
+		}
+	}
+
+	if(!build_mesh(mesh, MESH_PRIM_TRI, verts, normals, face_idx)) {
+		return false;
+	}
+	mesh->calc_bbox();
+	return true;
+}
+
+struct PosLess {
+	const float *vpos;
+
+	bool operator ()(int a, int b) const
+	{
+		const float *pa = vpos + a * 3;
+		const float *pb = vpos + b * 3;
+		if(pa[0] != pb[0]) return pa[0] < pb[0];
+		if(pa[1] != pb[1]) return pa[1] < pb[1];
+		return pa[2] < pb[2];
+	}
+};
+
+/* builds the simplification mesh: the mesh vertices are welded by position,
+ * since they are split wherever the normals are, and quads are split in
+ * triangles.
+ */
+static void init_simp_mesh(const Mesh *mesh, SimpMesh *sm)
+{
+	int num_verts = mesh->get_vertex_count();
+	int num_faces = mesh->get_face_count();
+	int prim = mesh->get_primitive();
+	const float *vpos = mesh->get_vertex_data();
+	const uint32_t *indices = mesh->get_index_data();
+
+	std::vector<int> order(num_verts), weld(num_verts);
+	for(int i=0; i<num_verts; i++) {
+		order[i] = i;
+	}
+	PosLess less;
+	less.vpos = vpos;
+	std::sort(order.begin(), order.end(), less);
+
+	for(int i=0; i<num_verts; i++) {
+		if(i == 0 || less(order[i - 1], order[i])) {
+			const float *p = vpos + order[i] * 3;
+
+			SimpVertex v;
+			v.pos[0] = p[0];
+			v.pos[1] = p[1];
+			v.pos[2] = p[2];
+			for(int j=0; j<10; j++) {
+				v.quad.q[j] = 0.0;
+			}
+			v.stamp = 0;
+			v.removed = false;
+			sm->verts.push_back(v);
+		}
+		weld[order[i]] = (int)sm->verts.size() - 1;
+	}
+
+	sm->faces.reserve(num_faces * (prim - 2));
+	for(int i=0; i<num_faces; i++) {
+		const uint32_t *fidx = indices + i * prim;
+		for(int j=0; j<prim - 2; j++) {
+			SimpFace f;
+			f.v[0] = weld[fidx[0]];
+			f.v[1] = weld[fidx[j + 1]];
+			f.v[2] = weld[fidx[j + 2]];
+			f.removed = f.v[0] == f.v[1] || f.v[1] == f.v[2] || f.v[2] == f.v[0];
+			if(f.removed) continue;
+
+			int fnum = (int)sm->faces.size();
+			sm->faces.push_back(f);
+			for(int k=0; k<3; k++) {
+				sm->verts[f.v[k]].faces.push_back(fnum);
+			}
+		}
+	}
+
+	/* initial quadrics: the planes of the faces around each vertex */
+	for(size_t i=0; i<sm->faces.size(); i++) {
+		const SimpFace &f = sm->faces[i];
+		const double *p0 = sm->verts[f.v[0]].pos;
+
+		double n[3];
+		face_normal(p0, sm->verts[f.v[1]].pos, sm->verts[f.v[2]].pos, n);
+		double len = sqrt(dot3(n, n));
+		if(len <= 0.0) continue;
+
+		n[0] /= len; n[1] /= len; n[2] /= len;
+		double d = -dot3(n, p0);
+		for(int j=0; j<3; j++) {
+			add_plane(&sm->verts[f.v[j]].quad, n[0], n[1], n[2], d, 1.0);
+		}
+	}
+
+	/* boundary edges (used by a single face) get a plane perpendicular to
+	 * their face, so that open borders don't shrink.
+	 */
+	std::vector<std::pair<std::pair<int, int>, int> > edges;
+	edges.reserve(sm->faces.size() * 3);
+	for(size_t i=0; i<sm->faces.size(); i++) {
+		const SimpFace &f = sm->faces[i];
+		for(int j=0; j<3; j++) {
+			int a = f.v[j];
+			int b = f.v[(j + 1) % 3];
+			edges.push_back(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), (int)i));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	for(size_t i=0; i<edges.size(); ) {
+		size_t j = i + 1;
+		while(j < edges.size() && edges[j].first == edges[i].first) {
+			j++;
+		}
+
+		int a = edges[i].first.first;
+		int b = edges[i].first.second;
+		if(j - i == 1) {
+			const SimpFace &f = sm->faces[edges[i].second];
+			const double *pa = sm->verts[a].pos;
+
+			double fn[3], e[3], n[3];
+			face_normal(sm->verts[f.v[0]].pos, sm->verts[f.v[1]].pos, sm->verts[f.v[2]].pos, fn);
+			sub3(sm->verts[b].pos, pa, e);
+			cross3(e, fn, n);
+
+			double len = sqrt(dot3(n, n));
+			if(len > 0.0) {
+				n[0] /= len; n[1] /= len; n[2] /= len;
+				double d = -dot3(n, pa);
+				add_plane(&sm->verts[a].quad, n[0], n[1], n[2], d, BOUNDARY_WEIGHT);
+				add_plane(&sm->verts[b].quad, n[0], n[1], n[2], d, BOUNDARY_WEIGHT);
+			}
+		}
+
+		Collapse col;
+		calc_collapse(*sm, a, b, &col);
+		sm->queue.push(col);
+		i = j;
+	}
+}
+
+bool simplify_mesh(const Mesh *mesh, int min_faces, std::vector<Mesh*> *levels,
+		std::vector<double> *errors)
+{
+	unsigned long start = get_msec();
+
+	SimpMesh sm;
+	init_simp_mesh(mesh, &sm);
+
+	int num_faces = (int)sm.faces.size();
+	int target = num_faces / 4;
+	int num_levels = 0;
+	double max_cost = 0.0;
+
+	std::vector<int> nb_u, nb_v;
+	while(target >= min_faces && !sm.queue.empty()) {
+		Collapse col = sm.queue.top();
+		sm.queue.pop();
+
+		const SimpVertex &vu = sm.verts[col.u];
+		const SimpVertex &vv = sm.verts[col.v];
+		if(vu.removed || vv.removed || vu.stamp != col.stamp_u || vv.stamp != col.stamp_v) {
+			continue;	// stale
+		}
+		if(!can_collapse(sm, col, &nb_u, &nb_v)) {
+			continue;
+		}
+
+		num_faces -= do_collapse(&sm, col);
+		if(col.cost > max_cost) {
+			max_cost = col.cost;
+		}
+
+		get_neighbours(sm, col.u, &nb_u);
+		push_collapses(&sm, col.u, nb_u);
+
+		if(num_faces <= target) {
+			Mesh *lod = new Mesh;
+			if(!snapshot(sm, lod)) {
+				delete lod;
+				return false;
+			}
+			levels->push_back(lod);
+			errors->push_back(sqrt(max_cost));
+			num_levels++;
+
+			target = num_faces / 4;
+		}
+	}
+
+	printf("simplified mesh: %d faces, %d levels of detail in %lu msec\n",
+			mesh->get_face_count(), num_levels, get_msec() - start);
+	return true;
+}
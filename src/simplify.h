@@ -0,0 +1,38 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef SIMPLIFY_H_
+#define SIMPLIFY_H_
+
+#include <vector>
+#include "mesh.h"
+
+/* builds the levels of detail of a mesh by quadric error edge collapses
+ * (Garland and Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics", SIGGRAPH 97). Each level has about a quarter of the faces of the
+ * previous one, down to min_faces, and is a triangle mesh with smooth normals.
+ * The geometric error of each level, the estimated distance of its surface
+ * from the original one, is appended to errors.
+ */
+bool simplify_mesh(const Mesh *mesh, int min_faces, std::vector<Mesh*> *levels,
+		std::vector<double> *errors);
+
+#endif
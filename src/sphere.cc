@@ -20,6 +20,7 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 */
 
 #include <stdlib.h>
+#include <algorithm>
 #include "math.h"
 #include "sphere.h"
 #include "config.h"
@@ -29,7 +30,7 @@ Sphere::Sphere() {
 	radius = 1;
 }
 
-Sphere::Sphere(const Vector3 &center, double radius) {
+Sphere::Sphere(const Vector3 &center, scalar_t radius) {
 	this->center = center;
 	this->radius = radius;
 }
@@ -47,36 +48,38 @@ bool Sphere::intersection(const Ray &ray, IntInfo* i_info) const {
 	}
 #endif
 
-	double a = dot(ray.dir, ray.dir);
-	double b = 2 * ray.dir.x * (ray.origin.x - center.x) +
-		2 * ray.dir.y * (ray.origin.y - center.y) +
-		2 * ray.dir.z * (ray.origin.z - center.z);
-	double c = dot(center, center) + dot(ray.origin, ray.origin) + 
-		2 * dot(-center, ray.origin) - radius * radius;
+	// ray origin relative to the center, keeps c accurate in single precision
+	Vector3 oc = ray.origin - center;
+
+	scalar_t a = dot(ray.dir, ray.dir);
+	scalar_t b = 2 * dot(ray.dir, oc);
+	scalar_t c = dot(oc, oc) - radius * radius;
 	
-	double discr = (b * b - 4 * a * c);
+	scalar_t discr = (b * b - 4 * a * c);
 
 	if (discr < 0.0) {
 		return false;
 	}
 
-	double sqrt_discr = sqrt(discr);
-	double t1 = (-b + sqrt_discr) / (2.0 * a);
-	double t2 = (-b - sqrt_discr) / (2.0 * a);
+	scalar_t sqrt_discr = sqrt(discr);
+	scalar_t t1 = (-b + sqrt_discr) / (2 * a);
+	scalar_t t2 = (-b - sqrt_discr) / (2 * a);
 
-	if (t1 < EPSILON) t1 = t2;
-	if (t2 < EPSILON) t2 = t1;
+	if (t1 <= 0.0) t1 = t2;
+	if (t2 <= 0.0) t2 = t1;
 
-	double t = t1 < t2 ? t1 : t2;
+	scalar_t t = t1 < t2 ? t1 : t2;
 
-	if (t < EPSILON || t > 1.0) {
+	if (t <= 0.0 || t > 1.0) {
 		return false;
 	}
 
 	if (i_info) {
 		i_info->t = t;
-		i_info->i_point = ray.origin + ray.dir * t;
-		i_info->normal = (i_info->i_point - center) / radius;
+		i_info->normal = normalize(oc + ray.dir * t);
+		// project back on the sphere to remove the error accumulated along the ray
+		i_info->i_point = center + i_info->normal * radius;
+		i_info->geom_normal = i_info->normal;
 		i_info->object = this;
 	}
 	return true;
@@ -100,3 +103,78 @@ Vector3 Sphere::sample() const {
 	Vector3 rnd_point(rndx / magnitude, rndy / magnitude, rndz / magnitude);
 	return rnd_point * radius + center;
 }
+
+/* 1 - cos of the half angle of the cone, the solid angle is 2pi times it */
+static double cone_extent(double sin_sq_max) {
+	double cos_max = sqrt(1.0 - sin_sq_max);
+	return sin_sq_max / (1.0 + cos_max);	// 1 - cos_max, without the cancellation
+}
+
+/* seen from outside, the sphere is sampled uniformly within the cone it
+ * subtends, otherwise uniformly by area (pdf converted to solid angle).
+ */
+bool Sphere::sample_light(const Vector3 &ref, double rnd1, double rnd2, LightSample *ls) const {
+	Vector3 wc = center - ref;
+	double dist_sq = dot(wc, wc);
+	double rad_sq = radius * radius;
+
+	ls->delta = false;
+	ls->radiance = material.ke;
+
+	if(dist_sq <= rad_sq) {
+		sample_surface(rnd1, rnd2, ls);
+		ls->pdf = area_to_solid_angle(ref, ls->pos, ls->normal, 4.0 * M_PI * rad_sq);
+		return ls->pdf > 0.0;
+	}
+
+	double dist = sqrt(dist_sq);
+	double extent = cone_extent(rad_sq / dist_sq);
+
+	double cos_theta = 1.0 - rnd1 * extent;
+	double sin_theta = sqrt(std::max(0.0, 1.0 - cos_theta * cos_theta));
+	double phi = 2.0 * M_PI * rnd2;
+
+	// basis around the direction to the center
+	Vector3 k = wc / dist;
+	Vector3 i = fabs(k.x) > 0.9 ? Vector3(0, 1, 0) : Vector3(1, 0, 0);
+	i = normalize(cross(i, k));
+	Vector3 j = cross(k, i);
+
+	Vector3 dir = i * (cos(phi) * sin_theta) + j * (sin(phi) * sin_theta) + k * cos_theta;
+
+	// nearest intersection of the direction with the sphere
+	double b = dist * cos_theta;
+	double t = b - sqrt(std::max(0.0, rad_sq - (dist_sq - b * b)));
+
+	ls->normal = normalize(ref + dir * t - center);
+	ls->pos = center + ls->normal * radius;
+	ls->pdf = 1.0 / (2.0 * M_PI * extent);
+	return true;
+}
+
+bool Sphere::sample_surface(double u, double v, LightSample *ls) const {
+	double z = 1.0 - 2.0 * u;
+	double r = sqrt(std::max(0.0, 1.0 - z * z));
+	double phi = 2.0 * M_PI * v;
+
+	ls->normal = Vector3(r * cos(phi), r * sin(phi), z);
+	ls->pos = center + ls->normal * radius;
+	ls->pdf = 1.0 / (4.0 * M_PI * radius * radius);
+	ls->delta = false;
+	return true;
+}
+
+double Sphere::light_pdf(const Vector3 &ref, const IntInfo &hit) const {
+	Vector3 wc = center - ref;
+	double dist_sq = dot(wc, wc);
+	double rad_sq = radius * radius;
+
+	if(dist_sq <= rad_sq) {
+		return area_to_solid_angle(ref, hit.i_point, hit.geom_normal, 4.0 * M_PI * rad_sq);
+	}
+	return 1.0 / (2.0 * M_PI * cone_extent(rad_sq / dist_sq));
+}
+
+double Sphere::light_power() const {
+	return (material.ke.x + material.ke.y + material.ke.z) / 3.0 * M_PI * 4.0 * M_PI * radius * radius;
+}
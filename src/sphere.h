@@ -28,13 +28,17 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 class Sphere: public Object {
 private:
 	Vector3 center;
-	double radius;
+	scalar_t radius;
 public:
 	Sphere();
-	Sphere(const Vector3 &center, double radius);
+	Sphere(const Vector3 &center, scalar_t radius);
 	bool intersection(const Ray &ray, IntInfo* i_info) const;
 	void calc_bbox();
 	Vector3 sample() const;
+	bool sample_light(const Vector3 &ref, double u, double v, LightSample *ls) const;
+	double light_pdf(const Vector3 &ref, const IntInfo &hit) const;
+	bool sample_surface(double u, double v, LightSample *ls) const;
+	double light_power() const;
 };
 
 #endif
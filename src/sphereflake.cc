@@ -24,7 +24,7 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #include "sphereflake.h"
 #include "config.h"
 
-SphereFlake::SphereFlake(const Vector3 &center, double radius) {
+SphereFlake::SphereFlake(const Vector3 &center, scalar_t radius) {
 	this->center = center;
 	this->radius = radius;
 	sph = 0;
@@ -79,7 +79,7 @@ bool SphereFlake::intersection(const Ray &ray, IntInfo* i_info) const {
 }
 
 void SphereFlake::calc_bbox() {
-	double max_rad = 3.0 * radius;
+	scalar_t max_rad = 3 * radius;
 
 	bbox.max = center + Vector3(max_rad, max_rad, max_rad);
 	bbox.min = center - Vector3(max_rad, max_rad, max_rad);
@@ -95,7 +95,7 @@ static const Vector3 offs[] = {
 	Vector3(0, 0, 1), Vector3(0, 0, -1)
 };
 
-SphereFlake *create_sflake(const Vector3 &center, double radius, int iter) {
+SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter) {
 	if (!iter) return 0;
 
 	SphereFlake *sflake = new SphereFlake(center, radius);
@@ -105,10 +105,10 @@ SphereFlake *create_sflake(const Vector3 &center, double radius, int iter) {
 	sflake->sph->calc_bbox();
 
 	for (int i = 0; i < 6; i++) {
-		double d = radius + radius / 2.0;
+		scalar_t d = radius + radius / 2;
 		Vector3 sub_pos = center + offs[i] * d;
 
-		sflake->subflakes[i] = create_sflake(sub_pos, radius / 2.0, iter - 1);
+		sflake->subflakes[i] = create_sflake(sub_pos, radius / 2, iter - 1);
 	}
 	return sflake;
 }
@@ -32,19 +32,19 @@ private:
 	SphereFlake *subflakes[6];
 
 	Vector3 center;
-	double radius;
+	scalar_t radius;
 
 public:
-	SphereFlake(const Vector3 &center, double radius);
+	SphereFlake(const Vector3 &center, scalar_t radius);
 	~SphereFlake();
 
 	bool intersection(const Ray &ray, IntInfo* i_info) const;
 	void calc_bbox();
 	Vector3 sample() const;
 
-	friend SphereFlake *create_sflake(const Vector3 &center, double radius, int iter);
+	friend SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter);
 };
 
-SphereFlake *create_sflake(const Vector3 &center, double radius, int iter);
+SphereFlake *create_sflake(const Vector3 &center, scalar_t radius, int iter);
 
 #endif
@@ -0,0 +1,162 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#ifndef TEXTPARSE_H_
+#define TEXTPARSE_H_
+
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+/* number and line parsing helpers of the mesh file loaders. They work on
+ * ranges of a mapped file, so nothing is assumed to be null terminated.
+ */
+
+inline bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+inline const char *skip_space(const char *ptr, const char *end) {
+	while(ptr < end && is_space(*ptr)) {
+		ptr++;
+	}
+	return ptr;
+}
+
+inline const char *find_eol(const char *ptr, const char *end) {
+	const char *eol = (const char*)memchr(ptr, '\n', end - ptr);
+	return eol ? eol : end;
+}
+
+/* parses a decimal floating point number with optional sign, fraction and
+ * exponent. Returns the first character after the number or null if there is
+ * no number at ptr.
+ */
+inline const char *parse_float(const char *ptr, const char *end, double *res) {
+	static const double pow10_tab[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	ptr = skip_space(ptr, end);
+
+	bool neg = false;
+	if(ptr < end && (*ptr == '-' || *ptr == '+')) {
+		neg = *ptr++ == '-';
+	}
+
+	/* up to 19 significant digits fit in the 64bit mantissa, the rest only
+	 * affect the exponent
+	 */
+	uint64_t mant = 0;
+	int exp = 0, ndigits = 0;
+	bool valid = false;
+
+	while(ptr < end && is_digit(*ptr)) {
+		if(ndigits < 19) {
+			mant = mant * 10 + (*ptr - '0');
+			ndigits += mant != 0;
+		} else {
+			exp++;
+		}
+		valid = true;
+		ptr++;
+	}
+	if(ptr < end && *ptr == '.') {
+		ptr++;
+		while(ptr < end && is_digit(*ptr)) {
+			if(ndigits < 19) {
+				mant = mant * 10 + (*ptr - '0');
+				ndigits += mant != 0;
+				exp--;
+			}
+			valid = true;
+			ptr++;
+		}
+	}
+	if(!valid) {
+		return 0;
+	}
+
+	if(ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+		const char *eptr = ptr + 1;
+		bool eneg = false;
+		if(eptr < end && (*eptr == '-' || *eptr == '+')) {
+			eneg = *eptr++ == '-';
+		}
+		if(eptr < end && is_digit(*eptr)) {
+			int e = 0;
+			while(eptr < end && is_digit(*eptr)) {
+				if(e < 10000) {
+					e = e * 10 + (*eptr - '0');
+				}
+				eptr++;
+			}
+			exp += eneg ? -e : e;
+			ptr = eptr;
+		}
+	}
+
+	double val = (double)mant;
+	if(mant) {
+		if(exp < 0) {
+			val = -exp <= 22 ? val / pow10_tab[-exp] : val * pow(10.0, exp);
+		} else if(exp > 0) {
+			val = exp <= 22 ? val * pow10_tab[exp] : val * pow(10.0, exp);
+		}
+	}
+
+	*res = neg ? -val : val;
+	return ptr;
+}
+
+inline const char *parse_int(const char *ptr, const char *end, int *res) {
+	ptr = skip_space(ptr, end);
+
+	bool neg = false;
+	if(ptr < end && (*ptr == '-' || *ptr == '+')) {
+		neg = *ptr++ == '-';
+	}
+	if(ptr >= end || !is_digit(*ptr)) {
+		return 0;
+	}
+
+	int64_t val = 0;
+	while(ptr < end && is_digit(*ptr)) {
+		if(val <= INT_MAX) {
+			val = val * 10 + (*ptr - '0');
+		}
+		ptr++;
+	}
+	if(val > INT_MAX) {
+		val = INT_MAX;
+	}
+
+	*res = neg ? (int)-val : (int)val;
+	return ptr;
+}
+
+#endif
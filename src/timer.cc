@@ -0,0 +1,53 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+#include "timer.h"
+
+#if defined(unix) || defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <sys/time.h>
+
+/* the start time is set before main, so that the first calls can't race
+ * when made from several threads
+ */
+static struct timeval tv0;
+static int init_tv0() {
+	gettimeofday(&tv0, 0);
+	return 0;
+}
+static int tv0_init = init_tv0();
+
+unsigned long get_msec() {
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	return (tv.tv_sec - tv0.tv_sec) * 1000 + (tv.tv_usec - tv0.tv_usec) / 1000;
+}
+
+#elif defined(WIN32) || defined(__WIN32__)
+#include <windows.h>
+
+unsigned long get_msec() {
+	return timeGetTime();
+}
+
+#else
+#error "unsupported platform"
+#endif
@@ -22,36 +22,105 @@ Author: Eleni Maria Stea <elene.mst@gmail.com>
 #ifndef VECTOR_H_
 #define VECTOR_H_
 
+#include <math.h>
+#include <stdio.h>
+#include "config.h"
+
+#ifdef SINGLE_PRECISION
+typedef float scalar_t;
+#else
+typedef double scalar_t;
+#endif
+
+/* everything is defined inline here, so that the vector math used by the
+ * intersection routines can be inlined without link time optimization.
+ * Functions consisting of a single expression are constexpr when the compiler
+ * supports it.
+ */
+#if __cplusplus >= 201103L
+#define VEC_CONSTEXPR	constexpr
+#else
+#define VEC_CONSTEXPR	inline
+#endif
+
 class Matrix4x4;
 
 class Vector3 {
 public:
-	double x,y,z;
-	Vector3();
-	Vector3(double x, double y, double z);
-	void transform(const Matrix4x4 &tm);
-	void printv();
+	scalar_t x,y,z;
+	VEC_CONSTEXPR Vector3() : x(0), y(0), z(0) {}
+	VEC_CONSTEXPR Vector3(scalar_t x, scalar_t y, scalar_t z) : x(x), y(y), z(z) {}
+
+	inline void transform(const Matrix4x4 &tm);	// defined in matrix.h
+	inline void printv() const;
 };
 
-bool operator < (const Vector3 &a, const Vector3 &b);
-bool operator > (const Vector3 &a, const Vector3 &b);
+inline void Vector3::printv() const {
+	printf("%f\t%f\t%f\n", x, y, z);
+}
 
-Vector3 operator + (const Vector3 &a, const Vector3 &b);
-Vector3 operator - (const Vector3 &a, const Vector3 &b);
-Vector3 operator - (const Vector3 &a);
-Vector3 operator * (const Vector3 &a, const Vector3 &b);
-Vector3 operator * (const Vector3 &a, double b);
-Vector3 operator * (double b, const Vector3 &a);
-Vector3 operator / (const Vector3 &a, double b);
+VEC_CONSTEXPR bool operator < (const Vector3 &a, const Vector3 &b) {
+	return a.x < b.x && a.y < b.y && a.z < b.z;
+}
 
-const Vector3 &operator += (Vector3 &a, const Vector3 &b);
+VEC_CONSTEXPR bool operator > (const Vector3 &a, const Vector3 &b) {
+	return a.x > b.x && a.y > b.y && a.z > b.z;
+}
 
-double length (const Vector3 &a);
-double dot (const Vector3 &a, const Vector3 &b);
-Vector3 cross (const Vector3 &a, const Vector3 &b);
-Vector3 normalize (const Vector3 &a);
+VEC_CONSTEXPR Vector3 operator + (const Vector3 &a, const Vector3 &b) {
+	return Vector3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
 
-Vector3 reflect(const Vector3 &v, const Vector3 &n);
+VEC_CONSTEXPR Vector3 operator - (const Vector3 &a, const Vector3 &b) {
+	return Vector3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
 
-#endif
+VEC_CONSTEXPR Vector3 operator - (const Vector3 &a) {
+	return Vector3(-a.x, -a.y, -a.z);
+}
+
+VEC_CONSTEXPR Vector3 operator * (const Vector3 &a, const Vector3 &b) {
+	return Vector3(a.x * b.x, a.y * b.y, a.z * b.z);
+}
+
+VEC_CONSTEXPR Vector3 operator * (const Vector3 &a, scalar_t b) {
+	return Vector3(a.x*b, a.y*b, a.z*b);
+}
 
+VEC_CONSTEXPR Vector3 operator * (scalar_t b, const Vector3 &a) {
+	return Vector3(a.x*b, a.y*b, a.z*b);
+}
+
+VEC_CONSTEXPR Vector3 operator / (const Vector3 &a, scalar_t b) {
+	return Vector3(a.x / b, a.y / b, a.z / b);
+}
+
+inline const Vector3 &operator += (Vector3 &a, const Vector3 &b) {
+	a.x += b.x;
+	a.y += b.y;
+	a.z += b.z;
+	return a;
+}
+
+VEC_CONSTEXPR scalar_t dot(const Vector3 &a, const Vector3 &b) {
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+inline scalar_t length(const Vector3 &a) {
+	return sqrt(dot(a, a));
+}
+
+VEC_CONSTEXPR Vector3 cross(const Vector3 &a, const Vector3 &b) {
+	return Vector3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+
+inline Vector3 normalize(const Vector3 &vec) {
+	scalar_t inv_mag = 1 / sqrt(dot(vec, vec));
+	return vec * inv_mag;
+}
+
+inline Vector3 reflect(const Vector3 &v, const Vector3 &n) {
+	return 2 * dot(v, n) * n - v;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* brdfbench: times the brdf sampling and evaluation kernels of src/brdf.cc
+ * against the functions they replaced (kept as they were in oldbrdf.cc),
+ * and checks the pdfs the sampling kernels return.
+ *
+ * usage: brdfbench [iterations in millions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "brdf.h"
+#include "config.h"
+#include "timer.h"
+
+#define NUM_INPUTS	4096
+
+/* the old functions, in tools/oldbrdf.cc so that neither set can be inlined
+ * into the loops below
+ */
+double old_phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp);
+Vector3 old_sample_lambert(const Vector3 &n, double rnd1, double rnd2);
+Vector3 old_sample_phong(const Vector3 &outdir, const Vector3 &n, double specexp, double rnd1,
+		double rnd2);
+
+static double frand() {
+	return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static Vector3 rand_dir() {
+	double z = 2.0 * frand() - 1.0;
+	double r = sqrt(std::max(0.0, 1.0 - z * z));
+	double phi = 2.0 * M_PI * frand();
+	return Vector3(r * cos(phi), r * sin(phi), z);
+}
+
+struct Input {
+	Vector3 n, v;
+	double u1, u2;
+};
+static Input inputs[NUM_INPUTS];
+
+// keeps the results alive, so that the compiler can't drop the calls
+static volatile double sink;
+
+static void report(const char *name, unsigned long msec, long calls) {
+	printf("%-40s %8.2f ns/call\n", name, msec * 1e6 / (double)calls);
+}
+
+int main(int argc, char **argv) {
+	long iter = argc > 1 ? atol(argv[1]) : 4;
+	if(iter < 1) {
+		iter = 1;
+	}
+	long count = iter * 1000000 / NUM_INPUTS;
+	long calls = count * NUM_INPUTS;
+
+	for(int i=0; i<NUM_INPUTS; i++) {
+		inputs[i].n = rand_dir();
+		inputs[i].v = rand_dir();
+		if(dot(inputs[i].n, inputs[i].v) < 0.0) {
+			inputs[i].v = -inputs[i].v;
+		}
+		inputs[i].u1 = frand();
+		inputs[i].u2 = frand();
+	}
+	const double specexp = 30.0;
+
+	printf("%ld million calls each, phong exponent %g\n", calls / 1000000, specexp);
+
+	// lambert sampling
+	unsigned long start = get_msec();
+	double sum = 0.0;
+	for(long k=0; k<count; k++) {
+		for(int i=0; i<NUM_INPUTS; i++) {
+			sum += old_sample_lambert(inputs[i].n, inputs[i].u1, inputs[i].u2).x;
+		}
+	}
+	sink = sum;
+	report("old sample_lambert", get_msec() - start, calls);
+
+	start = get_msec();
+	sum = 0.0;
+	for(long k=0; k<count; k++) {
+		for(int i=0; i<NUM_INPUTS; i++) {
+			double pdf;
+			sum += sample_lambert(inputs[i].n, inputs[i].u1, inputs[i].u2, &pdf).x + pdf;
+		}
+	}
+	sink = sum;
+	report("sample_lambert + pdf", get_msec() - start, calls);
+
+	/* phong: a bounce off the lobe, as shade() takes it, and the
+	 * evaluation of the pdf of another direction, as for a light sample.
+	 */
+	start = get_msec();
+	sum = 0.0;
+	for(long k=0; k<count; k++) {
+		for(int i=0; i<NUM_INPUTS; i++) {
+			const Input &in = inputs[i];
+			Vector3 dir = old_sample_phong(in.v, in.n, specexp, in.u1, in.u2);
+			double pdf = (specexp + 1.0) / (2.0 * M_PI) * old_phong(dir, in.v, in.n, specexp);
+			double light = old_phong(in.n, in.v, in.n, specexp);
+			sum += dir.x + pdf + light;
+		}
+	}
+	sink = sum;
+	report("old sample_phong + 2 phong", get_msec() - start, calls);
+
+	start = get_msec();
+	sum = 0.0;
+	for(long k=0; k<count; k++) {
+		for(int i=0; i<NUM_INPUTS; i++) {
+			const Input &in = inputs[i];
+			PhongLobe lobe;
+			make_phong_lobe(in.v, in.n, specexp, &lobe);
+			double pdf;
+			Vector3 dir = sample_phong(lobe, in.u1, in.u2, &pdf);
+			double light = phong(lobe, in.n);
+			sum += dir.x + pdf + light;
+		}
+	}
+	sink = sum;
+	report("make_phong_lobe + sample_phong + phong", get_msec() - start, calls);
+
+	/* the pdfs returned with the samples against the pdf kernels, and the
+	 * directions against the old sampling
+	 */
+	double max_pdf_err = 0.0, max_dir_err = 0.0;
+	for(int i=0; i<NUM_INPUTS; i++) {
+		const Input &in = inputs[i];
+		PhongLobe lobe;
+		make_phong_lobe(in.v, in.n, specexp, &lobe);
+		double pdf;
+		Vector3 dir = sample_phong(lobe, in.u1, in.u2, &pdf);
+		double ref_pdf = phong_pdf(lobe, dir);
+		max_pdf_err = std::max(max_pdf_err, fabs(pdf - ref_pdf) / std::max(ref_pdf, 1e-12));
+
+		Vector3 old_dir = old_sample_phong(in.v, in.n, specexp, in.u1, in.u2);
+		double cos_new = dot(dir, lobe.basis.z);
+		double cos_old = dot(old_dir, lobe.basis.z);
+		max_dir_err = std::max(max_dir_err, fabs(cos_new - cos_old));
+
+		dir = sample_lambert(in.n, in.u1, in.u2, &pdf);
+		ref_pdf = lambert_pdf(dir, in.n);
+		max_pdf_err = std::max(max_pdf_err, fabs(pdf - ref_pdf) / std::max(ref_pdf, 1e-12));
+	}
+	printf("largest relative pdf error: %g\n", max_pdf_err);
+	printf("largest difference of the angle to the mirror direction (cos): %g\n", max_dir_err);
+	return 0;
+}
@@ -0,0 +1,196 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* isectbench: times the intersection routines of spheres, bounding boxes
+ * and small meshes over a fixed set of rays, about half of which hit. The
+ * meshes are random triangles, parallelograms built on them, and the same
+ * parallelograms split in two triangles each.
+ * Prints the best of several rounds in ns per call, to compare builds: for
+ * single precision enable SINGLE_PRECISION in config.h and rebuild from
+ * clean.
+ *
+ * usage: isectbench [passes over the rays per round]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "bbox.h"
+#include "config.h"
+#include "intinfo.h"
+#include "mesh.h"
+#include "ray.h"
+#include "sphere.h"
+#include "timer.h"
+
+#define NUM_RAYS	4096
+#define NUM_ROUNDS	30
+#define MESH_FACES	16
+
+static Ray rays[NUM_RAYS];
+
+// keeps the results alive, so that the compiler can't drop the calls
+static volatile double sink;
+
+static double frand() {
+	return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+static void report(const char *name, unsigned long msec, long calls) {
+	printf("%-40s %8.2f ns/call\n", name, msec * 1e6 / (double)calls);
+}
+
+/* one pass of every ray over the mesh, returns the time it took */
+static unsigned long time_mesh(const Mesh &mesh, long passes) {
+	unsigned long start = get_msec();
+	double sum = 0.0;
+	for(long k=0; k<passes; k++) {
+		for(int i=0; i<NUM_RAYS; i++) {
+			IntInfo inf;
+			if(mesh.intersection(rays[i], &inf)) {
+				sum += inf.t;
+			}
+		}
+	}
+	sink = sum;
+	return get_msec() - start;
+}
+
+/* rays from points around the unit sphere towards points in a box twice
+ * its size, long enough to go through it
+ */
+static void make_rays() {
+	for(int i=0; i<NUM_RAYS; i++) {
+		double z = 2.0 * frand() - 1.0;
+		double r = sqrt(1.0 - z * z);
+		double phi = 2.0 * M_PI * frand();
+		Vector3 org = Vector3(r * cos(phi), r * sin(phi), z) * 4.0;
+		Vector3 target(frand() * 4.0 - 2.0, frand() * 4.0 - 2.0, frand() * 4.0 - 2.0);
+
+		rays[i].origin = org;
+		rays[i].dir = (target - org) * 2.0;
+	}
+}
+
+int main(int argc, char **argv) {
+	long passes = argc > 1 ? atol(argv[1]) : 200;
+	if(passes < 1) {
+		passes = 1;
+	}
+	long calls = passes * NUM_RAYS;
+
+	make_rays();
+
+	Sphere sphere(Vector3(0, 0, 0), 1.0);
+	sphere.calc_bbox();
+
+	BBox box(Vector3(-1, -1, -1), Vector3(1, 1, 1));
+
+	/* random triangles, and parallelograms built on the same triangles */
+	Mesh mesh(MESH_PRIM_TRI), qmesh(MESH_PRIM_QUAD), smesh(MESH_PRIM_TRI);
+	for(int i=0; i<MESH_FACES; i++) {
+		Vector3 pos[4];
+		int vidx[3], qidx[4];
+		for(int j=0; j<3; j++) {
+			pos[j] = Vector3(frand() * 2.0 - 1.0, frand() * 2.0 - 1.0, frand() * 2.0 - 1.0);
+			vidx[j] = mesh.add_vertex(pos[j], Vector3(0, 0, 1));
+		}
+		pos[3] = pos[0] + pos[2] - pos[1];
+		for(int j=0; j<4; j++) {
+			qidx[j] = qmesh.add_vertex(pos[j], Vector3(0, 0, 1));
+		}
+		mesh.add_face(vidx);
+		qmesh.add_face(qidx);
+
+		int sidx[4];
+		for(int j=0; j<4; j++) {
+			sidx[j] = smesh.add_vertex(pos[j], Vector3(0, 0, 1));
+		}
+		int half0[3] = {sidx[0], sidx[1], sidx[2]}, half1[3] = {sidx[0], sidx[2], sidx[3]};
+		smesh.add_face(half0);
+		smesh.add_face(half1);
+	}
+	mesh.calc_bbox();
+	qmesh.calc_bbox();
+	smesh.calc_bbox();
+
+#if defined(SINGLE_PRECISION)
+	const char *mode = "single precision";
+#else
+	const char *mode = "double precision";
+#endif
+	printf("%s, best of %d rounds of %ld calls\n", mode, NUM_ROUNDS, calls);
+
+	unsigned long best[5] = {~0ul, ~0ul, ~0ul, ~0ul, ~0ul};
+	int hits[5] = {0, 0, 0, 0, 0};
+
+	for(int round=0; round<NUM_ROUNDS; round++) {
+		unsigned long start = get_msec();
+		double sum = 0.0;
+		for(long k=0; k<passes; k++) {
+			for(int i=0; i<NUM_RAYS; i++) {
+				IntInfo inf;
+				if(sphere.intersection(rays[i], &inf)) {
+					sum += inf.t;
+				}
+			}
+		}
+		sink = sum;
+		unsigned long msec = get_msec() - start;
+		if(msec < best[0]) best[0] = msec;
+
+		start = get_msec();
+		int count = 0;
+		for(long k=0; k<passes; k++) {
+			for(int i=0; i<NUM_RAYS; i++) {
+				count += box.intersection(rays[i]);
+			}
+		}
+		sink = count;
+		msec = get_msec() - start;
+		if(msec < best[1]) best[1] = msec;
+
+		msec = time_mesh(mesh, passes);
+		if(msec < best[2]) best[2] = msec;
+		msec = time_mesh(qmesh, passes);
+		if(msec < best[3]) best[3] = msec;
+		msec = time_mesh(smesh, passes);
+		if(msec < best[4]) best[4] = msec;
+	}
+
+	for(int i=0; i<NUM_RAYS; i++) {
+		IntInfo inf;
+		hits[0] += sphere.intersection(rays[i], &inf);
+		hits[1] += box.intersection(rays[i]);
+		hits[2] += mesh.intersection(rays[i], &inf);
+		hits[3] += qmesh.intersection(rays[i], &inf);
+		hits[4] += smesh.intersection(rays[i], &inf);
+	}
+
+	report("Sphere::intersection", best[0], calls);
+	report("BBox::intersection", best[1], calls);
+	report("Mesh::intersection (16 triangles)", best[2], calls);
+	report("Mesh::intersection (16 quads)", best[3], calls);
+	report("Mesh::intersection (the quads as 32 tris)", best[4], calls);
+	printf("hits out of %d rays: sphere %d, box %d, triangles %d, quads %d, split quads %d\n",
+			NUM_RAYS, hits[0], hits[1], hits[2], hits[3], hits[4]);
+	return 0;
+}
@@ -0,0 +1,53 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* meshconv: converts MESH3/MESH4 text mesh data files, or OBJ and PLY files,
+ * to the binary mesh format, which the path tracer maps and uses in place.
+ *
+ * usage: meshconv <input mesh> <output .bmesh>
+ */
+
+#include <stdio.h>
+#include "matrix.h"
+#include "mesh.h"
+#include "meshfile.h"
+
+int main(int argc, char **argv) {
+	if(argc != 3) {
+		fprintf(stderr, "usage: %s <input mesh> <output .bmesh>\n", argv[0]);
+		return 1;
+	}
+
+	Mesh mesh;
+	Matrix4x4 identity;
+	if(!load_mesh_file(&mesh, argv[1], Vector3(0, 0, 0), identity, Vector3(1, 1, 1))) {
+		fprintf(stderr, "failed to load mesh: %s\n", argv[1]);
+		return 1;
+	}
+
+	if(!save_binary_mesh(&mesh, argv[2])) {
+		return 1;
+	}
+
+	printf("wrote %s: %d vertices, %d faces\n", argv[2], mesh.get_vertex_count(),
+			mesh.get_face_count());
+	return 0;
+}
@@ -0,0 +1,102 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* the brdf sampling functions of src/brdf.cc before they were redone as
+ * kernels, for brdfbench to compare with.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "config.h"
+#include "matrix.h"
+
+double old_phong(const Vector3 &indir, const Vector3 &outdir, const Vector3 &n, double specexp) {
+	Vector3 refindir = reflect(indir, n);
+	double s = dot(refindir, outdir);
+	if (s < 0.0) {
+		return 0.0;
+	}
+	return pow(s, specexp);
+}
+
+Vector3 old_sample_lambert(const Vector3 &n, double rnd1, double rnd2) {
+	double r = sqrt(rnd1);
+	double phi = 2.0 * M_PI * rnd2;
+	double x = r * cos(phi);
+	double y = r * sin(phi);
+	double z = sqrt(std::max(0.0, 1.0 - rnd1));
+
+	double sign = n.z >= 0.0 ? 1.0 : -1.0;
+	double a = -1.0 / (sign + n.z);
+	double b = n.x * n.y * a;
+	Vector3 t(1.0 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	Vector3 bt(b, sign + n.y * n.y * a, -n.y);
+
+	return t * x + bt * y + n * z;
+}
+
+Vector3 old_sample_phong(const Vector3 &outdir, const Vector3 &n, double specexp, double rnd1,
+		double rnd2) {
+	Matrix4x4 mat;
+	Vector3 ldir = normalize(outdir);
+
+	Vector3 ref = reflect(ldir, n);
+
+	double ndotl = dot(ldir, n);
+
+	if(1.0 - ndotl > EPSILON) {
+		Vector3 ivec, kvec, jvec;
+
+		// build orthonormal basis
+		if(fabs(ndotl) < EPSILON) {
+			kvec = -normalize(ldir);
+			jvec = n;
+			ivec = cross(jvec, kvec);
+		} else {
+			ivec = normalize(cross(ldir, ref));
+			jvec = ref;
+			kvec = cross(ref, ivec);
+		}
+
+		mat.matrix[0][0] = ivec.x;
+		mat.matrix[1][0] = ivec.y;
+		mat.matrix[2][0] = ivec.z;
+
+		mat.matrix[0][1] = jvec.x;
+		mat.matrix[1][1] = jvec.y;
+		mat.matrix[2][1] = jvec.z;
+
+		mat.matrix[0][2] = kvec.x;
+		mat.matrix[1][2] = kvec.y;
+		mat.matrix[2][2] = kvec.z;
+	}
+
+	double phi = acos(pow(rnd1, 1.0 / (specexp + 1)));
+	double theta = 2.0 * M_PI * rnd2;
+
+	Vector3 v;
+	v.x = cos(theta) * sin(phi);
+	v.y = cos(phi);
+	v.z = sin(theta) * sin(phi);
+	v.transform(mat);
+
+	return v;
+}
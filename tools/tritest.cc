@@ -0,0 +1,155 @@
+/*
+Path_tracer - A CPU path tracer
+
+Copyright (C) 2013 Eleni Maria Stea
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Author: Eleni Maria Stea <elene.mst@gmail.com>
+*/
+
+/* tritest: checks that the ray-triangle and ray-quad tests of
+ * Mesh::intersection are watertight, by shooting rays aimed exactly at the
+ * shared edges and vertices of an irregular, slightly curved grid, from
+ * above and from below. The grid is made of triangles first, then of
+ * non-planar quads. Every ray must hit the mesh; the number of misses is
+ * printed and the exit status is non-zero if there are any. Also reports how
+ * many face tests per second the rays took.
+ *
+ * usage: tritest [grid size] [rays per edge]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include "intinfo.h"
+#include "mesh.h"
+#include "ray.h"
+#include "timer.h"
+
+static double frand() {
+	return (double)rand() / ((double)RAND_MAX + 1.0);
+}
+
+/* rays towards target, from a random point on either side of the grid, long
+ * enough to reach it halfway
+ */
+static void add_rays(const Vector3 &target, std::vector<Ray> &rays) {
+	for(int side=0; side<2; side++) {
+		Ray ray;
+		ray.origin = Vector3(target.x + frand() * 4.0 - 2.0, target.y + frand() * 4.0 - 2.0,
+				side ? -3.0 : 3.0);
+		ray.dir = (target - ray.origin) * 2.0;
+		rays.push_back(ray);
+	}
+}
+
+/* tests a size x size grid of jittered, slightly curved cells, each split
+ * along a random diagonal in two triangles, or made a quad with that
+ * diagonal, returns the number of misses. The jitter keeps the cells convex
+ * and the slope stays under 0.7, so that no ray grazes a fold of the grid,
+ * where rounding can legitimately put it on the outer side.
+ */
+static int run_test(MeshPrim prim, int size, int per_edge) {
+	Mesh mesh(prim);
+	std::vector<Vector3> verts;
+	for(int i=0; i<=size; i++) {
+		for(int j=0; j<=size; j++) {
+			double x = j + (j > 0 && j < size ? frand() * 0.4 - 0.2 : 0.0);
+			double y = i + (i > 0 && i < size ? frand() * 0.4 - 0.2 : 0.0);
+			Vector3 pos(x / size - 0.5, y / size - 0.5, sin(x * 0.7) * cos(y * 0.5) / size);
+			// the rays aim at the float positions the mesh keeps
+			verts.push_back(mesh.get_vertex_pos(mesh.add_vertex(pos, Vector3(0, 0, 1))));
+		}
+	}
+
+	std::vector<Ray> rays;
+	for(int i=0; i<size; i++) {
+		for(int j=0; j<size; j++) {
+			int v00 = i * (size + 1) + j;
+			int v01 = v00 + 1;
+			int v10 = v00 + size + 1;
+			int v11 = v10 + 1;
+
+			bool flip = frand() < 0.5;
+			if(prim == MESH_PRIM_QUAD) {
+				// the diagonal of a quad is from its first to its third vertex
+				int q0[4] = {v00, v01, v11, v10}, q1[4] = {v01, v11, v10, v00};
+				mesh.add_face(flip ? q0 : q1);
+			} else if(flip) {
+				int t0[3] = {v00, v01, v11}, t1[3] = {v00, v11, v10};
+				mesh.add_face(t0);
+				mesh.add_face(t1);
+			} else {
+				int t0[3] = {v00, v01, v10}, t1[3] = {v01, v11, v10};
+				mesh.add_face(t0);
+				mesh.add_face(t1);
+			}
+
+			/* the diagonal, and the left and bottom edges of the cell
+			 * unless they are on the border of the grid
+			 */
+			int edges[3][2] = {{flip ? v00 : v01, flip ? v11 : v10}, {v00, v10}, {v00, v01}};
+			bool inner[3] = {true, j > 0, i > 0};
+			for(int e=0; e<3; e++) {
+				if(!inner[e]) {
+					continue;
+				}
+				const Vector3 &a = verts[edges[e][0]];
+				const Vector3 &b = verts[edges[e][1]];
+				for(int k=0; k<per_edge; k++) {
+					double t = k ? frand() : 0.5;
+					add_rays(a + (b - a) * t, rays);
+				}
+			}
+
+			// inner vertices
+			if(i > 0 && j > 0) {
+				add_rays(verts[v00], rays);
+			}
+		}
+	}
+	mesh.calc_bbox();
+
+	const char *name = prim == MESH_PRIM_QUAD ? "quads" : "triangles";
+	printf("%d %s, %d rays at shared edges and vertices\n", mesh.get_face_count(), name,
+			(int)rays.size());
+
+	int misses = 0;
+	unsigned long start = get_msec();
+	for(size_t i=0; i<rays.size(); i++) {
+		IntInfo inf;
+		if(!mesh.intersection(rays[i], &inf)) {
+			misses++;
+		}
+	}
+	unsigned long msec = get_msec() - start;
+
+	double tests = (double)rays.size() * mesh.get_face_count();
+	printf("  %d misses\n", misses);
+	printf("  %.1f million %s tests per second\n", msec ? tests / (msec * 1000.0) : 0.0,
+			prim == MESH_PRIM_QUAD ? "quad" : "triangle");
+	return misses;
+}
+
+int main(int argc, char **argv) {
+	int size = argc > 1 ? atoi(argv[1]) : 40;
+	int per_edge = argc > 2 ? atoi(argv[2]) : 8;
+	if(size < 2) size = 2;
+	if(per_edge < 1) per_edge = 1;
+
+	int misses = run_test(MESH_PRIM_TRI, size, per_edge);
+	misses += run_test(MESH_PRIM_QUAD, size, per_edge);
+	return misses ? 1 : 0;
+}